@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "base64.h"
+
 // from https://stackoverflow.com/a/6782480/283067
 static char encoding_table[] = {
   'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
@@ -27,12 +29,11 @@ void base64_cleanup(void) {
   free(decoding_table);
 }
 
-char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length)
+// encode into out, which must hold at least base64_encoded_length(input_length) bytes;
+// returns the length of the encoded string (out is nul terminated)
+size_t base64_encode_to(const unsigned char *data, size_t input_length, char *out)
 {
-  *output_length = 4 * ((input_length + 2) / 3);
-
-  char *encoded_data = malloc(*output_length);
-  if (encoded_data == NULL) return NULL;
+  size_t output_length = 4 * ((input_length + 2) / 3);
 
   for (int i = 0, j = 0; i < input_length;) {
     uint32_t octet_a = i < input_length ? (unsigned char)data[i++] : 0;
@@ -41,15 +42,26 @@ char *base64_encode(const unsigned char *data, size_t input_length, size_t *outp
 
     uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
 
-    encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
-    encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
-    encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
-    encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
+    out[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
+    out[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
+    out[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
+    out[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
   }
 
   for (int i = 0; i < mod_table[input_length % 3]; i++) {
-    encoded_data[*output_length - 1 - i] = '=';
+    out[output_length - 1 - i] = '=';
   }
+  out[output_length] = '\0';
+
+  return output_length;
+}
+
+char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length)
+{
+  char *encoded_data = malloc(base64_encoded_length(input_length));
+  if (encoded_data == NULL) return NULL;
+
+  *output_length = base64_encode_to(data, input_length, encoded_data);
 
   return encoded_data;
 }
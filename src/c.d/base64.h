@@ -1,6 +1,12 @@
 #ifndef BASE64_H
 #define BASE64_H
 
+#include <stddef.h>
+
+// size of the buffer needed to encode input_length bytes, including the trailing nul
+#define base64_encoded_length(input_length) (4 * (((input_length) + 2) / 3) + 1)
+
+size_t base64_encode_to(const unsigned char *data, size_t input_length, char *out);
 char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length);
 unsigned char *base64_decode(const char *data, size_t input_length, size_t *output_length);
 
@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// one JSON object per line, to compare the results of two builds
+static inline void bench_report(const char *name, uint64_t iterations, uint64_t elapsed_ns)
+{
+  printf("{\"benchmark\": \"%s\", \"iterations\": %"PRIu64", \"ns_per_op\": %.1f, \"ops_per_s\": %.0f}\n",
+    name, iterations, (double)elapsed_ns / iterations, iterations * 1e9 / elapsed_ns);
+  fflush(stdout);
+}
+
+// fixed seed xorshift64*, so that every run works on the same data
+static uint64_t bench_rng_state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint64_t bench_rng(void)
+{
+  bench_rng_state ^= bench_rng_state >> 12;
+  bench_rng_state ^= bench_rng_state << 25;
+  bench_rng_state ^= bench_rng_state >> 27;
+  return bench_rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+// keep the compiler from optimizing away a result
+#define bench_keep(x) __asm__ volatile("" : : "r"(x) : "memory")
+
+#endif
@@ -0,0 +1,111 @@
+/*
+replay the macs of the probe requests of a pcap file (see pcapgen) through the
+mac cache, the way db.c uses it (a lookup, then a set after a miss), with each
+replacement policy and a few cache sizes, and print the hit ratios: the macs
+randomized at each scan are looked up once, and shouldn't flush those of the
+devices seen all the time
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pcap/pcap.h>
+
+#include "lruc.h"
+#include "parsers.h"
+#include "bench.h"
+#include "config.h"
+
+// in macs; the first one is the size probemon uses
+static const uint32_t sizes[] = { MAC_CACHE_SIZE / sizeof(int64_t), 64, 512, 4096 };
+static const struct {
+  const char *name;
+  lruc_policy policy;
+} policies[] = { { "lru", LRUC_LRU }, { "tinylfu", LRUC_TINYLFU } };
+
+// the macs of the probe requests, in order
+static char (*macs)[18] = NULL;
+static size_t macs_count = 0;
+
+static int read_macs(const char *pcap_file)
+{
+  char errbuf[PCAP_ERRBUF_SIZE];
+  struct pcap_pkthdr *header;
+  const uint8_t *packet;
+  size_t allocated = 0;
+
+  pcap_t *handle = pcap_open_offline(pcap_file, errbuf);
+  if (handle == NULL) {
+    fprintf(stderr, "Error: %s\n", errbuf);
+    return -1;
+  }
+  while (pcap_next_ex(handle, &header, &packet) == 1) {
+    uint16_t freq, rx_flags, seq;
+    uint8_t flags, ssid[32], ssid_len;
+    int8_t rssi;
+    uint64_t fingerprint;
+
+    if (macs_count == allocated) {
+      allocated = allocated ? allocated * 2 : 65536;
+      if ((macs = realloc(macs, allocated * sizeof(*macs))) == NULL) {
+        pcap_close(handle);
+        return -1;
+      }
+    }
+    int8_t offset = parse_radiotap_header(packet, &freq, &rssi, &flags, &rx_flags);
+    if (offset > 0 && parse_probereq_frame(packet, header->caplen, offset, macs[macs_count], &seq,
+        ssid, &ssid_len, &fingerprint) == 0) {
+      macs_count++;
+    }
+  }
+  pcap_close(handle);
+
+  return 0;
+}
+
+static void replay(const char *name, lruc_policy policy, uint32_t size)
+{
+  char full_name[64];
+  uint64_t hits = 0;
+  lruc *cache = lruc_new(size * sizeof(int64_t), 1, policy);
+
+  uint64_t start = bench_now_ns();
+  for (size_t i = 0; i < macs_count; i++) {
+    void *value = NULL;
+    lruc_get(cache, macs[i], 18, &value);
+    if (value == NULL) {
+      int64_t *new_value = malloc(sizeof(int64_t));
+      *new_value = i;
+      lruc_set(cache, strdup(macs[i]), 18, new_value, sizeof(int64_t));
+    } else {
+      hits++;
+    }
+  }
+  snprintf(full_name, sizeof(full_name), "cache_replay/%s/%u", name, size);
+  bench_report(full_name, macs_count, bench_now_ns() - start);
+  fprintf(stderr, "%s: %.1f%% hits\n", full_name, 100.0 * hits / macs_count);
+
+  lruc_free(cache);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: bench_cache PCAP_FILE\n");
+    return EXIT_FAILURE;
+  }
+  if (read_macs(argv[1]) || macs_count == 0) {
+    fprintf(stderr, "Error: no probe request in %s\n", argv[1]);
+    free(macs);
+    return EXIT_FAILURE;
+  }
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+      replay(policies[p].name, policies[p].policy, sizes[s]);
+    }
+  }
+  free(macs);
+
+  return EXIT_SUCCESS;
+}
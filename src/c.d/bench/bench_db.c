@@ -0,0 +1,104 @@
+/*
+microbenchmark of insert_probereq() against an in-memory and an on-disk sqlite
+db, within one transaction committed at the end, like the logger thread does,
+then with a new (randomized) mac for most probe requests, without and with the
+filter of the macs already in the db
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "db.h"
+#include "lruc.h"
+#include "logger_thread.h"
+#include "bench.h"
+#include "config.h"
+
+#define ITERATIONS 20000
+#define MACS 1000
+#define SSIDS 100
+#define BENCH_DB "./bench_db.db"
+
+static char macs[MACS][18];
+static char ssids[SSIDS][64];
+
+// new_macs is the share of probe requests with a mac never seen before, in %
+static int run(const char *name, const char *db_file, int new_macs, bool filter)
+{
+  sqlite3 *db;
+  char full_name[64];
+
+  if (init_probemon_db(db_file, &db) != SQLITE_OK) {
+    return -1;
+  }
+  lruc *mac_pk_cache = lruc_new(MAC_CACHE_SIZE, 1, LRUC_LRU);
+  lruc *ssid_pk_cache = lruc_new(SSID_CACHE_SIZE, 1, LRUC_LRU);
+  bloom_t *mac_filter = filter ? load_mac_filter(db) : NULL;
+
+  probereq_t pr;
+  memset(&pr, 0, sizeof(pr));
+  pr.tv.tv_sec = 1600000000;
+  pr.vendor = "Apple, Inc.";
+
+  uint64_t start = bench_now_ns();
+  begin_txn(db);
+  for (int i = 0; i < ITERATIONS; i++) {
+    // a few macs come back often, most are seen once in a while
+    uint64_t r = bench_rng();
+    if ((int)(r % 100) < new_macs) {
+      snprintf(pr.mac, sizeof(pr.mac), "da:a1:19:%02x:%02x:%02x", i >> 16, (i >> 8) & 0xff, i & 0xff);
+    } else {
+      strcpy(pr.mac, macs[(r & 1) ? r % 16 : r % MACS]);
+    }
+    strcpy(pr.ssid_str, ssids[(r >> 16) % SSIDS]);
+    pr.rssi = -30 - (int)((r >> 32) % 60);
+    pr.tv.tv_usec = i % 1000000;
+    if (insert_probereq(pr, db, mac_pk_cache, ssid_pk_cache, mac_filter, 0)) {
+      return -1;
+    }
+  }
+  commit_txn(db);
+  snprintf(full_name, sizeof(full_name), "insert_probereq/%s", name);
+  bench_report(full_name, ITERATIONS, bench_now_ns() - start);
+
+  lruc_free(mac_pk_cache);
+  lruc_free(ssid_pk_cache);
+  bloom_free(mac_filter);
+  sqlite3_close(db);
+
+  return 0;
+}
+
+int main(void)
+{
+  for (int i = 0; i < MACS; i++) {
+    uint64_t r = bench_rng();
+    snprintf(macs[i], 18, "%02x:%02x:%02x:%02x:%02x:%02x",
+      (int)(r >> 40) & 0xff, (int)(r >> 32) & 0xff, (int)(r >> 24) & 0xff,
+      (int)(r >> 16) & 0xff, (int)(r >> 8) & 0xff, (int)r & 0xff);
+  }
+  for (int i = 0; i < SSIDS; i++) {
+    snprintf(ssids[i], sizeof(ssids[i]), "network-%d", i);
+  }
+  // and the wildcard probe requests
+  ssids[0][0] = '\0';
+
+  int ret = run("memory", ":memory:", 0, false);
+  unlink(BENCH_DB);
+  if (ret == 0) {
+    ret = run("disk", BENCH_DB, 0, false);
+  }
+  if (ret == 0) {
+    ret = run("new_macs", ":memory:", 80, false);
+  }
+  if (ret == 0) {
+    ret = run("new_macs_filter", ":memory:", 80, true);
+  }
+  unlink(BENCH_DB);
+
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
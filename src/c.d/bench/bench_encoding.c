@@ -0,0 +1,70 @@
+/*
+microbenchmark of the ssid encoding: utf-8 validation, and base64 for the
+ssids that aren't valid utf-8
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8.h"
+#include "base64.h"
+#include "bench.h"
+
+#define ITERATIONS 2000000
+
+struct ssid {
+  const char *name;
+  const uint8_t *bytes;
+  size_t len;
+};
+
+static const uint8_t binary[] = { 0xde, 0xad, 0xbe, 0xef, 0x00, 0x01, 0xff, 0xfe,
+  0x10, 0x20, 0x30, 0x40, 0x80, 0x90, 0xa0, 0xb0, 0xc0, 0xd0, 0xe0, 0xf0 };
+
+#define TEXT(s) (const uint8_t *)(s), sizeof(s) - 1
+
+static const struct ssid ssids[] = {
+  { "ascii", TEXT("home-network-5G") },
+  { "ascii_32", TEXT("0123456789abcdefghijklmnopqrstuv") },
+  { "utf8", TEXT("Wi-Fi du café ☕ 住宅") },
+  { "binary", binary, sizeof(binary) },
+};
+
+int main(void)
+{
+  char name[64];
+  char out[base64_encoded_length(32)];
+
+  for (int s = 0; s < sizeof(ssids) / sizeof(ssids[0]); s++) {
+    const struct ssid *ssid = &ssids[s];
+
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+      bool valid = is_utf8(ssid->bytes, ssid->len);
+      bench_keep(valid);
+    }
+    snprintf(name, sizeof(name), "is_utf8/%s", ssid->name);
+    bench_report(name, ITERATIONS, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+      size_t len;
+      char *encoded = base64_encode(ssid->bytes, ssid->len, &len);
+      bench_keep(encoded);
+      free(encoded);
+    }
+    snprintf(name, sizeof(name), "base64_encode/%s", ssid->name);
+    bench_report(name, ITERATIONS, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+      size_t len = base64_encode_to(ssid->bytes, ssid->len, out);
+      bench_keep(len);
+    }
+    snprintf(name, sizeof(name), "base64_encode_to/%s", ssid->name);
+    bench_report(name, ITERATIONS, bench_now_ns() - start);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+/*
+microbenchmark of the lru cache, used the way db.c does it: mac address keys,
+int64 primary keys as values, and a set after each miss. With low churn the
+working set fits in the cache, with high churn most lookups miss and evict.
+Each runs with both replacement policies (see bench_cache for the hit ratios
+on a capture).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lruc.h"
+#include "bench.h"
+#include "config.h"
+
+#define ITERATIONS 1000000
+#define KEYS 4096
+
+static char keys[KEYS][18];
+
+// get, then set on a miss; returns the number of hits
+static uint64_t get_or_set(lruc *cache, uint32_t working_set, uint64_t iterations)
+{
+  uint64_t hits = 0;
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    const char *key = keys[bench_rng() % working_set];
+    void *value = NULL;
+    lruc_get(cache, (void *)key, 18, &value);
+    if (value == NULL) {
+      int64_t *new_value = malloc(sizeof(int64_t));
+      *new_value = i;
+      lruc_set(cache, strdup(key), 18, new_value, sizeof(int64_t));
+    } else {
+      hits++;
+    }
+  }
+
+  return hits;
+}
+
+static void run(const char *name, uint32_t working_set, lruc_policy policy)
+{
+  char full_name[64];
+  // same size as the mac cache of the logger thread
+  lruc *cache = lruc_new(MAC_CACHE_SIZE, 1, policy);
+
+  get_or_set(cache, working_set, KEYS);
+  uint64_t start = bench_now_ns();
+  uint64_t hits = get_or_set(cache, working_set, ITERATIONS);
+  snprintf(full_name, sizeof(full_name), "lruc_get_set/%s", name);
+  bench_report(full_name, ITERATIONS, bench_now_ns() - start);
+  fprintf(stderr, "%s: %.1f%% hits\n", full_name, 100.0 * hits / ITERATIONS);
+
+  lruc_free(cache);
+}
+
+int main(void)
+{
+  for (int i = 0; i < KEYS; i++) {
+    uint64_t r = bench_rng();
+    snprintf(keys[i], 18, "%02x:%02x:%02x:%02x:%02x:%02x",
+      (int)(r >> 40) & 0xff, (int)(r >> 32) & 0xff, (int)(r >> 24) & 0xff,
+      (int)(r >> 16) & 0xff, (int)(r >> 8) & 0xff, (int)r & 0xff);
+  }
+
+  // the cache holds MAC_CACHE_SIZE bytes of values
+  uint32_t capacity = MAC_CACHE_SIZE / sizeof(int64_t);
+  run("low_churn", capacity / 2, LRUC_LRU);
+  run("high_churn", KEYS, LRUC_LRU);
+  run("low_churn_tinylfu", capacity / 2, LRUC_TINYLFU);
+  run("high_churn_tinylfu", KEYS, LRUC_TINYLFU);
+
+  // lookups only, all hits
+  lruc *cache = lruc_new(MAC_CACHE_SIZE, 1, LRUC_LRU);
+  get_or_set(cache, capacity / 2, KEYS);
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < ITERATIONS; i++) {
+    void *value = NULL;
+    lruc_get(cache, keys[bench_rng() % (capacity / 2)], 18, &value);
+    bench_keep(value);
+  }
+  bench_report("lruc_get/hit", ITERATIONS, bench_now_ns() - start);
+  lruc_free(cache);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/*
+microbenchmark of lookup_oui() over a real manuf file, with macs of known
+vendors, unknown ones, and randomized (LAA) ones
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "manuf.h"
+#include "bench.h"
+
+#define ITERATIONS 100000
+#define MACS 4096
+
+static char macs[MACS][18];
+
+static void format_mac(char *mac, uint64_t addr)
+{
+  snprintf(mac, 18, "%02x:%02x:%02x:%02x:%02x:%02x",
+    (int)(addr >> 40) & 0xff, (int)(addr >> 32) & 0xff, (int)(addr >> 24) & 0xff,
+    (int)(addr >> 16) & 0xff, (int)(addr >> 8) & 0xff, (int)addr & 0xff);
+}
+
+static void run(const char *name, manuf_t *ouidb, size_t ouidb_size)
+{
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < ITERATIONS; i++) {
+    int indx = lookup_oui(macs[i % MACS], ouidb, ouidb_size);
+    bench_keep(indx);
+  }
+  bench_report(name, ITERATIONS, bench_now_ns() - start);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t ouidb_size;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: bench_manuf MANUF_FILE\n");
+    return EXIT_FAILURE;
+  }
+  manuf_t *ouidb = parse_manuf_file(argv[1], &ouidb_size);
+  if (ouidb == NULL) {
+    fprintf(stderr, "Error: can't parse manuf file %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  // vendors spread all over the table
+  for (int i = 0; i < MACS; i++) {
+    const manuf_t *m = &ouidb[bench_rng() % ouidb_size];
+    format_mac(macs[i], m->min + bench_rng() % (m->max - m->min + 1));
+  }
+  run("lookup_oui/known", ouidb, ouidb_size);
+
+  // locally administered: never in the table
+  for (int i = 0; i < MACS; i++) {
+    format_mac(macs[i], (bench_rng() & 0xfcffffffffffULL) | 0x020000000000ULL);
+  }
+  run("lookup_oui/laa", ouidb, ouidb_size);
+
+  for (int i = 0; i < ouidb_size; i++) {
+    free(ouidb[i].short_oui);
+    free(ouidb[i].long_oui);
+    free(ouidb[i].comment);
+  }
+  free(ouidb);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+/*
+microbenchmark of the parsing of a whole probe request: radiotap header, then
+802.11 header and Information Elements, for the radiotap layouts of common drivers
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parsers.h"
+#include "layouts.h"
+#include "bench.h"
+
+#define ITERATIONS 1000000
+
+int main(void)
+{
+  static const uint8_t mac[6] = { 0xf0, 0x18, 0x98, 0x12, 0x34, 0x56 };
+  static const uint8_t ssid[] = "home-network-5G";
+  uint8_t packet[512];
+  uint16_t freq, rx_flags;
+  uint8_t flags;
+  int8_t rssi;
+  char name[64];
+
+  for (int l = 0; l < driver_layouts_count; l++) {
+    const driver_layout_t *layout = &driver_layouts[l];
+    size_t len = build_probereq(packet, layout, 2437, -42, mac, 1234, ssid, sizeof(ssid) - 1);
+
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+      char pr_mac[18];
+      uint8_t pr_ssid[32], pr_ssid_len;
+      uint16_t pr_seq;
+      uint64_t fingerprint;
+
+      int8_t offset = parse_radiotap_header(packet, &freq, &rssi, &flags, &rx_flags);
+      if (parse_probereq_frame(packet, len, offset, pr_mac, &pr_seq, pr_ssid, &pr_ssid_len, &fingerprint) < 0) {
+        fprintf(stderr, "Error: %s: can't parse the probe request\n", layout->name);
+        return EXIT_FAILURE;
+      }
+      bench_keep(fingerprint + pr_seq);
+    }
+    snprintf(name, sizeof(name), "parse_probereq/%s", layout->name);
+    bench_report(name, ITERATIONS, bench_now_ns() - start);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/*
+replay a pcap file (see pcapgen) through the whole pipeline: radiotap and
+probe request parsing, the workers and the writer thread inserting in a sqlite
+db, then again with a writer that discards everything, to tell the cost of
+the capture and the enrichment from the cost of the db
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <pcap/pcap.h>
+#include <sqlite3.h>
+
+#include "logger_thread.h"
+#include "capture.h"
+#include "db.h"
+#include "manuf.h"
+#include "session.h"
+#include "uniques.h"
+#include "reject.h"
+#include "bench.h"
+#include "globals.h"
+#include "config.h"
+
+#define BENCH_DB "./bench_pipeline.db"
+
+static void count_packet(uint8_t *args, const struct pcap_pkthdr *header, const uint8_t *packet)
+{
+  (*(long *)args)++;
+  process_packet(NULL, header, packet);
+}
+
+static double cpu_time(void)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int replay(const char *name, const char *pcap_file, bool null_sink, int workers)
+{
+  char errbuf[PCAP_ERRBUF_SIZE];
+
+  if ((handle = pcap_open_offline(pcap_file, errbuf)) == NULL) {
+    fprintf(stderr, "Error: %s\n", errbuf);
+    return -1;
+  }
+  if (!null_sink) {
+    unlink(BENCH_DB);
+    if (init_probemon_db(BENCH_DB, &db) != SQLITE_OK) {
+      pcap_close(handle);
+      return -1;
+    }
+    begin_txn(db);
+    sessions = session_new(SESSION_TABLE_SIZE, SESSION_GAP);
+    uniques = uniques_new(UNIQUES_TABLE_SIZE, UNIQUES_MAX_SKETCHES);
+  }
+  for (int i = 0; i < REJECT_REASONS; i++) {
+    reject_counters[i] = 0;
+  }
+
+  double cpu_start = cpu_time();
+  uint64_t start = bench_now_ns();
+  if (start_workers(workers)) {
+    pcap_close(handle);
+    return -1;
+  }
+
+  long packets = 0;
+  pcap_loop(handle, -1, count_packet, (uint8_t *)&packets);
+
+  stop_workers();
+  if (db) {
+    commit_txn(db);
+  }
+  uint64_t elapsed = bench_now_ns() - start;
+  double cpu = cpu_time() - cpu_start;
+
+  uint64_t rejected = 0;
+  for (int i = REJECT_NONE + 1; i < REJECT_REASONS; i++) {
+    rejected += reject_counters[i];
+  }
+  printf("%-16s %10ld packets %10.0f packets/s %8.2f µs cpu/packet (%"PRIu64" dropped)\n",
+    name, packets, packets * 1e9 / elapsed, cpu * 1e6 / packets, rejected);
+
+  pcap_close(handle);
+  handle = NULL;
+  if (db) {
+    sqlite3_close(db);
+    db = NULL;
+    unlink(BENCH_DB);
+    session_free(sessions);
+    sessions = NULL;
+    uniques_free(uniques);
+    uniques = NULL;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3 && argc != 4) {
+    fprintf(stderr, "Usage: bench_pipeline PCAP_FILE MANUF_FILE [WORKERS]\n");
+    return EXIT_FAILURE;
+  }
+  int workers = argc == 4 ? (int)strtol(argv[3], NULL, 10) : 1;
+  if (workers < 1 || workers > MAX_WORKERS) {
+    fprintf(stderr, "Error: the number of workers must be between 1 and %d\n", MAX_WORKERS);
+    return EXIT_FAILURE;
+  }
+
+  ouidb = parse_manuf_file(argv[2], &ouidb_size);
+  if (ouidb == NULL) {
+    fprintf(stderr, "Error: can't parse manuf file\n");
+    return EXIT_FAILURE;
+  }
+
+  int ret = EXIT_SUCCESS;
+  if (replay("sqlite", argv[1], false, workers) || replay("null sink", argv[1], true, workers)) {
+    ret = EXIT_FAILURE;
+  }
+
+  for (int i = 0; i < ouidb_size; i++) {
+    free(ouidb[i].short_oui);
+    free(ouidb[i].long_oui);
+    free(ouidb[i].comment);
+  }
+  free(ouidb);
+
+  return ret;
+}
@@ -0,0 +1,66 @@
+/*
+microbenchmark of the queue, alone and as a channel between a producer and a
+consumer thread, like the capture thread and a worker
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "queue.h"
+#include "bench.h"
+#include "config.h"
+
+#define ITERATIONS 1000000
+
+static queue_t *queue;
+static channel_t channel;
+
+static void *consumer(void *args)
+{
+  while (channel_get(&channel) != NULL);
+
+  return NULL;
+}
+
+int main(void)
+{
+  static int item;
+  pthread_t thread;
+
+  queue = new_queue(MAX_QUEUE_SIZE);
+  uint64_t start = bench_now_ns();
+  for (int i = 0; i < ITERATIONS; i++) {
+    enqueue(queue, &item);
+    bench_keep(dequeue(queue));
+  }
+  bench_report("queue/enqueue_dequeue", ITERATIONS, bench_now_ns() - start);
+
+  // fill the queue half way, as when the logger lags behind
+  start = bench_now_ns();
+  for (int i = 0; i < ITERATIONS / MAX_QUEUE_SIZE; i++) {
+    for (int j = 0; j < MAX_QUEUE_SIZE / 2; j++) {
+      enqueue(queue, &item);
+    }
+    for (int j = 0; j < MAX_QUEUE_SIZE / 2; j++) {
+      bench_keep(dequeue(queue));
+    }
+  }
+  bench_report("queue/half_full", ITERATIONS / MAX_QUEUE_SIZE * (MAX_QUEUE_SIZE / 2),
+    bench_now_ns() - start);
+
+  free_queue(queue);
+
+  channel_init(&channel, MAX_QUEUE_SIZE);
+  start = bench_now_ns();
+  pthread_create(&thread, NULL, consumer, NULL);
+  for (int i = 0; i < ITERATIONS; i++) {
+    channel_put(&channel, &item);
+  }
+  channel_put(&channel, NULL);
+  pthread_join(thread, NULL);
+  bench_report("queue/threads", ITERATIONS, bench_now_ns() - start);
+  channel_destroy(&channel);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/*
+microbenchmark of parse_radiotap_header() against the plain radiotap iterator,
+for the radiotap layouts of common drivers
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "radiotap_iter.h"
+#include "parsers.h"
+#include "layouts.h"
+#include "bench.h"
+
+#define ITERATIONS 2000000
+
+// what parse_radiotap_header() did before caching the layouts
+static void iterate_radiotap(const uint8_t *packet, uint16_t *freq, int8_t *rssi)
+{
+  struct ieee80211_radiotap_iterator iter;
+  struct ieee80211_radiotap_header *rtaphdr = (struct ieee80211_radiotap_header *)packet;
+
+  ieee80211_radiotap_iterator_init(&iter, rtaphdr, rtaphdr->it_len, NULL);
+  *freq = 0;
+  *rssi = 0;
+  while (!ieee80211_radiotap_iterator_next(&iter)) {
+    if (iter.this_arg_index == IEEE80211_RADIOTAP_CHANNEL) {
+      *freq = iter.this_arg[0] + (iter.this_arg[1] << 8);
+    }
+    if (iter.this_arg_index == IEEE80211_RADIOTAP_DBM_ANTSIGNAL && *iter.this_arg) {
+      *rssi = (int8_t)*iter.this_arg;
+    }
+    if (*freq != 0 && *rssi != 0)
+      break;
+  }
+}
+
+int main(void)
+{
+  uint8_t packet[256];
+  uint16_t freq, rx_flags;
+  uint8_t flags;
+  int8_t rssi;
+  char name[64];
+
+  for (int l = 0; l < driver_layouts_count; l++) {
+    const driver_layout_t *layout = &driver_layouts[l];
+    build_radiotap(packet, layout, 2437, -42);
+
+    parse_radiotap_header(packet, &freq, &rssi, &flags, &rx_flags);
+    if (freq != 2437 || rssi != -42) {
+      fprintf(stderr, "Error: %s: got freq %u and rssi %d\n", layout->name, freq, rssi);
+      return EXIT_FAILURE;
+    }
+
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+      iterate_radiotap(packet, &freq, &rssi);
+      __asm__ volatile("" : : "r"(freq), "r"(rssi) : "memory");
+    }
+    snprintf(name, sizeof(name), "radiotap_iterator/%s", layout->name);
+    bench_report(name, ITERATIONS, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+      parse_radiotap_header(packet, &freq, &rssi, &flags, &rx_flags);
+      __asm__ volatile("" : : "r"(freq), "r"(rssi) : "memory");
+    }
+    snprintf(name, sizeof(name), "parse_radiotap_header/%s", layout->name);
+    bench_report(name, ITERATIONS, bench_now_ns() - start);
+    if (freq != 2437 || rssi != -42) {
+      fprintf(stderr, "Error: %s: cached layout gave freq %u and rssi %d\n", layout->name, freq, rssi);
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+/*
+benchmark of the sensor to collector mode, entirely over localhost: records
+are sent by an uplink to a collector running in a thread, with an in-memory
+db, then sent again while the collector is down, to go through the spool and
+be replayed once it is up, and last by two sensors hearing the same probe
+requests, to be merged. The rows in the db of the collector are counted at the
+end of each run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sqlite3.h>
+
+#include "uplink.h"
+#include "collector.h"
+#include "db.h"
+#include "metrics.h"
+#include "bench.h"
+#include "config.h"
+
+#define RECORDS 100000
+#define MACS 1000
+#define BENCH_SPOOL "./bench_uplink.spool"
+#define WAIT_TIME 120   // in s
+
+static pthread_t collector_thread;
+
+static void *run_collector(void *args)
+{
+  collector_run((collector_t *)args);
+  return NULL;
+}
+
+// listen on port, or on any free port if it is 0; the port is returned
+static collector_t *start_collector(sqlite3 *db, int *port)
+{
+  char address[32];
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  snprintf(address, sizeof(address), "127.0.0.1:%d", *port);
+  collector_t *c = collector_new(address, db, DEDUP_TOLERANCE, SESSION_GAP, LRUC_LRU);
+  if (c == NULL) {
+    return NULL;
+  }
+  getsockname(c->listen_fd, (struct sockaddr *)&addr, &len);
+  *port = ntohs(addr.sin_port);
+  pthread_create(&collector_thread, NULL, run_collector, c);
+  return c;
+}
+
+static void stop_collector(collector_t *c)
+{
+  collector_stop(c);
+  pthread_join(collector_thread, NULL);
+  fprintf(stderr, "%"PRIu64" batches, %.1f bytes per record on the wire, %"PRIu64" sent twice, %"PRIu64" merged\n",
+    c->batches, c->records_count ? (double)c->bytes / c->records_count : 0.0, c->duplicates, c->merged);
+  collector_free(c);
+}
+
+// until the collector has acknowledged everything
+static int wait_acked(uplink_t *up)
+{
+  for (int i = 0; i < WAIT_TIME * 100; i++) {
+    pthread_mutex_lock(&up->mutex);
+    bool done = up->records_count == 0 && up->frames == NULL && up->spool_size == 0;
+    pthread_mutex_unlock(&up->mutex);
+    if (done) {
+      return 0;
+    }
+    usleep(10000);
+  }
+  fprintf(stderr, "Error: the collector didn't acknowledge everything within %d s\n", WAIT_TIME);
+  return -1;
+}
+
+// the i-th probe request, 10 ms after the previous one; start is in µs
+static void add_record(uplink_t *up, int i, uint64_t r, uint64_t start, int rssi_offset)
+{
+  probereq_t pr;
+  probeburst_t burst;
+
+  memset(&pr, 0, sizeof(pr));
+  pr.vendor = "Apple, Inc.";
+  int mac = r % MACS;
+  snprintf(pr.mac, sizeof(pr.mac), "f0:18:98:%02x:%02x:%02x", mac >> 16, (mac >> 8) & 0xff, mac & 0xff);
+  pr.ssid_len = snprintf((char *)pr.ssid, sizeof(pr.ssid), "network-%d", (int)(r >> 16) % 100);
+  pr.rssi = -30 - (int)((r >> 32) % 60) + rssi_offset;
+  pr.seq = i & 0xfff;
+  pr.fingerprint = r >> 8 & 0xffff;
+  pr.tv.tv_sec = (start + i * 10000ULL) / 1000000;
+  pr.tv.tv_usec = (start + i * 10000ULL) % 1000000;
+
+  struct write_item item = { &pr, NULL };
+  if (i % 8 == 0) {
+    burst.pr = &pr;
+    burst.last = pr.tv;
+    burst.last.tv_sec += 1;
+    burst.count = 3;
+    burst.rssi_min = pr.rssi - 5;
+    burst.rssi_max = pr.rssi;
+    burst.rssi_sum = 3 * pr.rssi - 5;
+    item.pr = NULL;
+    item.burst = &burst;
+  }
+  uplink_add(up, &item);
+}
+
+// one probe request out of 8 is sent as a burst
+static void add_records(uplink_t *up, uint64_t start)
+{
+  for (int i = 0; i < RECORDS; i++) {
+    add_record(up, i, bench_rng(), start, 0);
+  }
+}
+
+static int count_rows(sqlite3 *db, const char *table)
+{
+  sqlite3_stmt *stmt;
+  char sql[160];
+  int count = -1;
+
+  snprintf(sql, sizeof(sql), "select count(*) from %s;", table);
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    count = sqlite3_column_int(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+static int check(const char *name, sqlite3 *db, const char *table, int expected)
+{
+  int rows = count_rows(db, table);
+  if (rows != expected) {
+    fprintf(stderr, "Error: %s: %d rows in the %s table of the collector instead of %d\n", name, rows, table, expected);
+    return -1;
+  }
+  return 0;
+}
+
+int main(void)
+{
+  sqlite3 *db;
+  int port = 0;
+
+  metrics_register("bench");
+  unlink(BENCH_SPOOL);
+  unlink(BENCH_SPOOL ".seq");
+  if (init_probemon_db(":memory:", &db) != SQLITE_OK) {
+    return EXIT_FAILURE;
+  }
+
+  // collector up: until the last batch is acked, at the commit of the collector
+  collector_t *c = start_collector(db, &port);
+  if (c == NULL) {
+    return EXIT_FAILURE;
+  }
+  char address[32];
+  snprintf(address, sizeof(address), "127.0.0.1:%d", port);
+  uplink_t *up = uplink_new(address, "bench", BENCH_SPOOL);
+  if (up == NULL) {
+    return EXIT_FAILURE;
+  }
+  uint64_t start = bench_now_ns();
+  add_records(up, 1600000000000000ULL);
+  bench_report("uplink/add", RECORDS, bench_now_ns() - start);
+  if (wait_acked(up)) {
+    return EXIT_FAILURE;
+  }
+  bench_report("uplink/acked", RECORDS, bench_now_ns() - start);
+  uplink_free(up);
+  stop_collector(c);
+  if (check("connected", db, "probemon", RECORDS - RECORDS / 8)
+    || check("connected", db, "probeburst", RECORDS / 8)) {
+    return EXIT_FAILURE;
+  }
+
+  // collector down: the batches pile up in memory then in the spool, and are sent once it is up
+  up = uplink_new(address, "bench", BENCH_SPOOL);
+  if (up == NULL) {
+    return EXIT_FAILURE;
+  }
+  add_records(up, 1600000000000000ULL);
+  start = bench_now_ns();
+  if ((c = start_collector(db, &port)) == NULL) {
+    return EXIT_FAILURE;
+  }
+  if (wait_acked(up)) {
+    return EXIT_FAILURE;
+  }
+  bench_report("uplink/spool_replay", RECORDS, bench_now_ns() - start);
+  uplink_free(up);
+  stop_collector(c);
+  if (check("spooled", db, "probemon", 2 * (RECORDS - RECORDS / 8))
+    || check("spooled", db, "probeburst", 2 * (RECORDS / 8))) {
+    return EXIT_FAILURE;
+  }
+
+  // two sensors in range of the same devices, the second one closer to half of them:
+  // a single row per probe request (not per burst), with the best rssi
+  if ((c = start_collector(db, &port)) == NULL) {
+    return EXIT_FAILURE;
+  }
+  uplink_t *up2;
+  if ((up = uplink_new(address, "bench-a", BENCH_SPOOL)) == NULL
+    || (up2 = uplink_new(address, "bench-b", BENCH_SPOOL "-b")) == NULL) {
+    return EXIT_FAILURE;
+  }
+  start = bench_now_ns();
+  for (int i = 0; i < RECORDS; i++) {
+    uint64_t r = bench_rng();
+    add_record(up, i, r, 1700000000000000ULL, 0);
+    // with the clock of the second sensor a bit late
+    add_record(up2, i, r, 1700000000000000ULL - 300000, i % 2 ? 5 : -5);
+  }
+  if (wait_acked(up) || wait_acked(up2)) {
+    return EXIT_FAILURE;
+  }
+  bench_report("uplink/two_sensors", 2 * RECORDS, bench_now_ns() - start);
+  uplink_free(up);
+  uplink_free(up2);
+  stop_collector(c);
+  // the table of the recent probe requests is bounded: a few copies may not be merged
+  int missed = count_rows(db, "probemon") - 3 * (RECORDS - RECORDS / 8);
+  fprintf(stderr, "%d probe requests not merged\n", missed);
+  if (missed < 0 || missed > RECORDS / 1000
+    || check("two sensors", db, "probeburst", 4 * (RECORDS / 8))
+    || check("two sensors", db, "heard_by", RECORDS - RECORDS / 8 - missed)
+    || check("best rssi", db, "heard_by h join probemon p on p.rowid = h.probemon where h.rssi > p.rssi", 0)) {
+    fprintf(stderr, "Error: two sensors: the probe requests heard by both aren't merged\n");
+    return EXIT_FAILURE;
+  }
+
+  sqlite3_close(db);
+  unlink(BENCH_SPOOL);
+  unlink(BENCH_SPOOL ".seq");
+  unlink(BENCH_SPOOL "-b");
+  unlink(BENCH_SPOOL "-b.seq");
+
+  return EXIT_SUCCESS;
+}
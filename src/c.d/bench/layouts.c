@@ -0,0 +1,95 @@
+/*
+build radiotap headers and probe request frames as emitted by common drivers
+*/
+
+#include <string.h>
+
+#include "layouts.h"
+
+const driver_layout_t driver_layouts[] = {
+  // tsft, flags, rate, channel, dbm_antsignal, rx_flags + one chain per antenna
+  { "ath9k",   { 0xa000402f, 0xa0000820, 0x00000820 }, 3 },
+  // flags, rate, channel, dbm_antsignal, antenna, rx_flags, vht
+  { "rtl88xx", { 0x0020482e }, 1 },
+  // tsft, flags, channel, dbm_antsignal, rx_flags, mcs + one chain per antenna
+  { "mt76",    { 0xa008402b, 0xa0000820, 0x00000820 }, 3 },
+};
+const int driver_layouts_count = sizeof(driver_layouts) / sizeof(driver_layouts[0]);
+
+// alignment and size of the radiotap fields, indexed by bit number
+static const struct { uint8_t align, size; } fields[] = {
+  [0] = { 8, 8 }, [1] = { 1, 1 }, [2] = { 1, 1 }, [3] = { 2, 4 },
+  [4] = { 2, 2 }, [5] = { 1, 1 }, [6] = { 1, 1 }, [7] = { 2, 2 },
+  [8] = { 2, 2 }, [9] = { 2, 2 }, [10] = { 1, 1 }, [11] = { 1, 1 },
+  [12] = { 1, 1 }, [13] = { 1, 1 }, [14] = { 2, 2 }, [15] = { 2, 2 },
+  [16] = { 1, 1 }, [17] = { 1, 1 }, [19] = { 1, 3 }, [20] = { 4, 8 },
+  [21] = { 2, 12 }, [22] = { 8, 12 },
+};
+
+size_t build_radiotap(uint8_t *buf, const driver_layout_t *layout, uint16_t freq, int8_t rssi)
+{
+  size_t len = 4 + 4 * layout->n_present;
+
+  memset(buf, 0, 256);
+  for (int i = 0; i < layout->n_present; i++) {
+    uint32_t w = layout->present[i];
+    buf[4 + 4*i] = w & 0xff;
+    buf[5 + 4*i] = (w >> 8) & 0xff;
+    buf[6 + 4*i] = (w >> 16) & 0xff;
+    buf[7 + 4*i] = (w >> 24) & 0xff;
+  }
+
+  for (int i = 0; i < layout->n_present; i++) {
+    for (int bit = 0; bit < 29; bit++) {
+      if (!(layout->present[i] & (1U << bit)) || fields[bit].size == 0) {
+        continue;
+      }
+      len = (len + fields[bit].align - 1) & ~(size_t)(fields[bit].align - 1);
+      if (bit == 3) {
+        buf[len] = freq & 0xff;
+        buf[len+1] = freq >> 8;
+        buf[len+2] = 0xa0;      // 2GHz, CCK
+      } else if (bit == 5) {
+        buf[len] = (uint8_t)rssi;
+      }
+      len += fields[bit].size;
+    }
+  }
+  buf[2] = len & 0xff;
+  buf[3] = len >> 8;
+
+  return len;
+}
+
+size_t build_probereq(uint8_t *buf, const driver_layout_t *layout, uint16_t freq, int8_t rssi,
+  const uint8_t mac[6], uint16_t seq, const uint8_t *ssid, uint8_t ssid_len)
+{
+  size_t len = build_radiotap(buf, layout, freq, rssi);
+  uint8_t *f = buf + len;
+
+  f[0] = 0x40;  // management, probe request
+  f[1] = 0x00;
+  f[2] = f[3] = 0;
+  memset(f + 4, 0xff, 6);   // DA
+  memcpy(f + 10, mac, 6);   // SA
+  memset(f + 16, 0xff, 6);  // BSSID
+  f[22] = (seq << 4) & 0xff;
+  f[23] = (seq >> 4) & 0xff;
+  len += 24;
+
+  // ssid
+  buf[len++] = 0;
+  buf[len++] = ssid_len;
+  memcpy(buf + len, ssid, ssid_len);
+  len += ssid_len;
+  // supported rates
+  static const uint8_t rates[] = { 0x01, 0x08, 0x02, 0x04, 0x0b, 0x16, 0x0c, 0x12, 0x18, 0x24 };
+  memcpy(buf + len, rates, sizeof(rates));
+  len += sizeof(rates);
+  // extended supported rates
+  static const uint8_t xrates[] = { 0x32, 0x04, 0x30, 0x48, 0x60, 0x6c };
+  memcpy(buf + len, xrates, sizeof(xrates));
+  len += sizeof(xrates);
+
+  return len;
+}
@@ -0,0 +1,22 @@
+#ifndef LAYOUTS_H
+#define LAYOUTS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// radiotap layout (chain of present words) emitted by a given driver
+struct driver_layout {
+  const char *name;
+  uint32_t present[4];
+  int n_present;
+};
+typedef struct driver_layout driver_layout_t;
+
+extern const driver_layout_t driver_layouts[];
+extern const int driver_layouts_count;
+
+size_t build_radiotap(uint8_t *buf, const driver_layout_t *layout, uint16_t freq, int8_t rssi);
+size_t build_probereq(uint8_t *buf, const driver_layout_t *layout, uint16_t freq, int8_t rssi,
+  const uint8_t mac[6], uint16_t seq, const uint8_t *ssid, uint8_t ssid_len);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+generate a pcap file of radiotap + probe request frames from a simulated
+crowd of devices, to measure the ingest throughput without a radio.
+
+Each device has a radiotap layout (driver), an rssi, a preferred network list
+of 0 to 3 ssids, and scans at random intervals: a scan is a burst of probe
+requests, one or more per ssid plus the wildcard one, a few ms apart. Devices
+with a randomized (LAA) mac address use a new one for each scan. Some frames
+are sent again as link-layer retransmissions.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <pcap/pcap.h>
+
+#include "layouts.h"
+#include "config.h"
+
+#define MAX_SSIDS 3
+#define SCAN_INTERVAL 30.0     // mean time between two scans of a device, in s
+#define RETRY_RATE 0.03
+
+struct device {
+  uint8_t mac[6];
+  bool laa;
+  const driver_layout_t *layout;
+  uint16_t freq;
+  int8_t rssi;
+  int ssids_count;
+  uint8_t ssids[MAX_SSIDS][32];
+  uint8_t ssids_len[MAX_SSIDS];
+  uint16_t seq;
+  double next_scan;
+};
+
+// a few OUIs of common phone and laptop vendors
+static const uint8_t ouis[][3] = {
+  { 0x00, 0x03, 0x93 }, { 0xf0, 0x18, 0x98 }, { 0x00, 0x1a, 0x11 }, { 0x00, 0x16, 0x6c },
+  { 0x00, 0x24, 0xd7 }, { 0x3c, 0x5a, 0xb4 }, { 0xf8, 0xe0, 0x79 }, { 0x00, 0x1d, 0x0f },
+};
+
+static const char *utf8_words[] = { "café", "Wi-Fi ☕", "Gäste", "дом", "住宅", "Ünïcødé", "casa ñ" };
+
+static const uint16_t freqs[] = { 2412, 2437, 2462 };
+
+static uint64_t rng_state;
+
+// xorshift64*
+static uint64_t rng(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double rng_uniform(void)
+{
+  return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_range(int min, int max)
+{
+  return min + (int)(rng() % (uint64_t)(max - min + 1));
+}
+
+static void random_laa(uint8_t mac[6])
+{
+  for (int i = 0; i < 6; i++) {
+    mac[i] = rng() & 0xff;
+  }
+  // locally administered, unicast
+  mac[0] = (mac[0] & 0xfc) | 0x02;
+}
+
+static uint8_t random_ssid(uint8_t *ssid, double non_utf8)
+{
+  static const char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 -_";
+  // mostly between 4 and 16 bytes
+  int len = rng_range(4, 12) + (rng_uniform() < 0.2 ? rng_range(0, 16) : 0);
+  double kind = rng_uniform();
+
+  if (kind < non_utf8) {
+    for (int i = 0; i < len; i++) {
+      ssid[i] = rng() & 0xff;
+    }
+    ssid[rng_range(0, len - 1)] = 0xff;   // never valid utf-8
+  } else if (kind < non_utf8 + 0.1) {
+    const char *w = utf8_words[rng_range(0, sizeof(utf8_words) / sizeof(utf8_words[0]) - 1)];
+    len = strlen(w);
+    memcpy(ssid, w, len);
+  } else {
+    for (int i = 0; i < len; i++) {
+      ssid[i] = charset[rng_range(0, sizeof(charset) - 2)];
+    }
+  }
+  return len;
+}
+
+static void init_device(struct device *d, double laa_share, double non_utf8, double now)
+{
+  d->laa = rng_uniform() < laa_share;
+  if (d->laa) {
+    random_laa(d->mac);
+  } else {
+    memcpy(d->mac, ouis[rng_range(0, sizeof(ouis) / sizeof(ouis[0]) - 1)], 3);
+    for (int i = 3; i < 6; i++) {
+      d->mac[i] = rng() & 0xff;
+    }
+  }
+  d->layout = &driver_layouts[rng_range(0, driver_layouts_count - 1)];
+  d->freq = freqs[rng_range(0, 2)];
+  // close devices are rare
+  d->rssi = -90 + (int)(70 * pow(rng_uniform(), 2));
+  // randomized devices usually only send wildcard probe requests
+  d->ssids_count = d->laa ? (rng_uniform() < 0.2) : rng_range(0, MAX_SSIDS);
+  for (int i = 0; i < d->ssids_count; i++) {
+    d->ssids_len[i] = random_ssid(d->ssids[i], non_utf8);
+  }
+  d->seq = rng() & 0xfff;
+  d->next_scan = now + rng_uniform() * SCAN_INTERVAL;
+}
+
+static void usage(void)
+{
+  printf("Usage: pcapgen -o FILE [-n PACKETS] [-d DEVICES] [-l LAA_SHARE] [-u NON_UTF8_SHARE] [-s SEED]\n");
+  printf("  -o FILE           pcap file to write\n"
+         "  -n PACKETS        number of frames to write (default 100000)\n"
+         "  -d DEVICES        number of devices around (default 500)\n"
+         "  -l LAA_SHARE      share of devices with a randomized mac (default 0.6)\n"
+         "  -u NON_UTF8_SHARE share of ssids that are not valid utf-8 (default 0.02)\n"
+         "  -s SEED           seed of the random generator (default 1)\n"
+       );
+}
+
+int main(int argc, char *argv[])
+{
+  const char *output = NULL;
+  long packets = 100000;
+  int devices_count = 500;
+  double laa_share = 0.6, non_utf8 = 0.02;
+  int opt;
+
+  rng_state = 1;
+  while ((opt = getopt(argc, argv, "d:hl:n:o:s:u:")) != -1) {
+    switch (opt) {
+    case 'o':
+      output = optarg;
+      break;
+    case 'n':
+      packets = strtol(optarg, NULL, 10);
+      break;
+    case 'd':
+      devices_count = strtol(optarg, NULL, 10);
+      break;
+    case 'l':
+      laa_share = strtod(optarg, NULL);
+      break;
+    case 'u':
+      non_utf8 = strtod(optarg, NULL);
+      break;
+    case 's':
+      rng_state = strtoull(optarg, NULL, 10) | 1;
+      break;
+    case 'h':
+      usage();
+      exit(EXIT_SUCCESS);
+    default:
+      usage();
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (output == NULL || devices_count <= 0 || packets <= 0) {
+    usage();
+    exit(EXIT_FAILURE);
+  }
+
+  pcap_t *p = pcap_open_dead(DLT_IEEE802_11_RADIO, SNAP_LEN);
+  pcap_dumper_t *dumper = pcap_dump_open(p, output);
+  if (dumper == NULL) {
+    fprintf(stderr, "Error: %s\n", pcap_geterr(p));
+    pcap_close(p);
+    exit(EXIT_FAILURE);
+  }
+
+  double start = 1600000000.0, now = start;
+  struct device *devices = malloc(devices_count * sizeof(struct device));
+  for (int i = 0; i < devices_count; i++) {
+    init_device(&devices[i], laa_share, non_utf8, now);
+  }
+
+  uint8_t buf[512];
+  long written = 0, laa = 0, retries = 0;
+  while (written < packets) {
+    // next device to scan
+    struct device *d = &devices[0];
+    for (int i = 1; i < devices_count; i++) {
+      if (devices[i].next_scan < d->next_scan) {
+        d = &devices[i];
+      }
+    }
+    now = d->next_scan;
+    if (d->laa) {
+      random_laa(d->mac);
+    }
+
+    // the wildcard probe request, then one per ssid
+    double t = now;
+    for (int s = -1; s < d->ssids_count && written < packets; s++) {
+      int burst = rng_range(1, 3);
+      for (int b = 0; b < burst && written < packets; b++) {
+        int8_t rssi = d->rssi + rng_range(-4, 4);
+        size_t len = build_probereq(buf, d->layout, d->freq, rssi, d->mac, d->seq,
+          d->ssids[s < 0 ? 0 : s], s < 0 ? 0 : d->ssids_len[s]);
+        struct pcap_pkthdr hdr;
+        hdr.ts.tv_sec = (time_t)t;
+        hdr.ts.tv_usec = (suseconds_t)((t - (time_t)t) * 1e6);
+        hdr.caplen = hdr.len = len;
+        pcap_dump((u_char *)dumper, &hdr, buf);
+        written++;
+        laa += d->laa;
+
+        if (rng_uniform() < RETRY_RATE && written < packets) {
+          // same frame again with the retry bit set
+          size_t rt_len = buf[2] | buf[3] << 8;
+          buf[rt_len + 1] |= 0x08;
+          hdr.ts.tv_usec += hdr.ts.tv_usec < 999000 ? 1000 : 0;
+          pcap_dump((u_char *)dumper, &hdr, buf);
+          written++;
+          retries++;
+        }
+        d->seq = (d->seq + 1) & 0xfff;
+        t += rng_range(1, 20) / 1000.0;
+      }
+    }
+    d->next_scan = now + -log(1.0 - rng_uniform()) * SCAN_INTERVAL;
+  }
+
+  pcap_dump_close(dumper);
+  pcap_close(p);
+  free(devices);
+
+  fprintf(stderr, ":: Wrote %ld frames (%.0f%% from LAA macs, %ld retransmissions) over %.0f s to %s\n",
+    written, 100.0 * laa / written, retries, now - start, output);
+
+  return EXIT_SUCCESS;
+}
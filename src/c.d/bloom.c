@@ -0,0 +1,110 @@
+/*
+Bloom filter (Bloom, 1970) sized for a capacity and a false positive rate:
+-capacity * ln(fpr) / ln(2)^2 bits and ln(2) * bits / capacity hashes, derived
+from two halves of a 64-bit mix of the key (Kirsch and Mitzenmacher, 2006).
+The bits are addressed by byte, so that a saved filter reads the same on any
+cpu.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bloom.h"
+
+static inline uint64_t mix(uint64_t key)
+{
+  // finalizer of splitmix64
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  return key ^ (key >> 31);
+}
+
+static bloom_t *bloom_alloc(uint64_t capacity, uint64_t size, uint32_t hashes)
+{
+  bloom_t *b = calloc(1, sizeof(bloom_t));
+  if (b == NULL) {
+    return NULL;
+  }
+  // a whole number of bytes
+  b->size = (size + 7) & ~7ULL;
+  if ((b->bits = calloc(b->size / 8, 1)) == NULL) {
+    free(b);
+    return NULL;
+  }
+  b->hashes = hashes;
+  b->capacity = capacity;
+  return b;
+}
+
+bloom_t *bloom_new(uint64_t capacity, double fpr)
+{
+  if (capacity == 0) {
+    capacity = 1;
+  }
+  uint64_t size = ceil(-(double)capacity * log(fpr) / (M_LN2 * M_LN2));
+  uint32_t hashes = round(M_LN2 * size / capacity);
+  return bloom_alloc(capacity, size, hashes > 0 ? hashes : 1);
+}
+
+// a filter saved with its bits, of len bytes
+bloom_t *bloom_load(uint64_t capacity, uint64_t count, uint32_t hashes, const void *bits, size_t len)
+{
+  if (len == 0 || hashes == 0) {
+    return NULL;
+  }
+  bloom_t *b = bloom_alloc(capacity, len * 8, hashes);
+  if (b == NULL) {
+    return NULL;
+  }
+  memcpy(b->bits, bits, len);
+  b->count = count;
+  return b;
+}
+
+void bloom_add(bloom_t *b, uint64_t key)
+{
+  uint64_t h = mix(key);
+  uint64_t h1 = h & 0xffffffff, h2 = h >> 32 | 1;
+
+  for (uint32_t i = 0; i < b->hashes; i++) {
+    uint64_t bit = (h1 + i * h2) % b->size;
+    b->bits[bit >> 3] |= 1 << (bit & 7);
+  }
+  b->count++;
+}
+
+bool bloom_maybe(const bloom_t *b, uint64_t key)
+{
+  uint64_t h = mix(key);
+  uint64_t h1 = h & 0xffffffff, h2 = h >> 32 | 1;
+
+  for (uint32_t i = 0; i < b->hashes; i++) {
+    uint64_t bit = (h1 + i * h2) % b->size;
+    if ((b->bits[bit >> 3] & (1 << (bit & 7))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// expected false positive rate with the keys added so far
+double bloom_fpr(const bloom_t *b)
+{
+  return pow(1 - exp(-(double)b->hashes * b->count / b->size), b->hashes);
+}
+
+size_t bloom_memory(const bloom_t *b)
+{
+  return sizeof(bloom_t) + b->size / 8;
+}
+
+void bloom_free(bloom_t *b)
+{
+  if (b == NULL) return;
+
+  free(b->bits);
+  free(b);
+}
@@ -0,0 +1,25 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bloom filter of 64-bit keys: bloom_maybe() is false only for keys never added
+typedef struct bloom {
+  uint8_t *bits;
+  uint64_t size;        // in bits
+  uint32_t hashes;
+  uint64_t capacity;    // keys it was sized for
+  uint64_t count;       // keys added
+} bloom_t;
+
+bloom_t *bloom_new(uint64_t capacity, double fpr);
+bloom_t *bloom_load(uint64_t capacity, uint64_t count, uint32_t hashes, const void *bits, size_t len);
+void bloom_add(bloom_t *b, uint64_t key);
+bool bloom_maybe(const bloom_t *b, uint64_t key);
+double bloom_fpr(const bloom_t *b);
+size_t bloom_memory(const bloom_t *b);
+void bloom_free(bloom_t *b);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+global memory budget (-M): what the manuf file takes is set aside, the rest is
+split between the subsystems, that size their caches, queues and indexes from
+their share. Each reports what it uses, at each commit, so that the usage can
+be compared to the shares in the metrics.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "budget.h"
+#include "config.h"
+
+static const char *subsystem_names[BUDGET_SUBSYSTEMS] = {
+  "manuf", "queues", "caches", "sqlite", "mac_filter", "uniques", "series", "topk", "sessions"
+};
+
+// in % of the budget left once the manuf file is parsed
+static const int shares[BUDGET_SUBSYSTEMS] = {
+  [BUDGET_QUEUES] = 10,
+  [BUDGET_CACHES] = 10,
+  [BUDGET_SQLITE] = 40,
+  [BUDGET_MAC_FILTER] = 10,
+  [BUDGET_UNIQUES] = 10,
+  [BUDGET_SERIES] = 10,
+  [BUDGET_TOPK] = 5,
+  [BUDGET_SESSIONS] = 5,
+};
+
+static size_t total = 0;
+static size_t share_bytes[BUDGET_SUBSYSTEMS];
+static size_t usage[BUDGET_SUBSYSTEMS];
+
+// a size in bytes, or with a K, M or G suffix; returns -1 if invalid
+int budget_parse(const char *value, size_t *bytes)
+{
+  char *end;
+  unsigned long long v = strtoull(value, &end, 10);
+
+  if (end == value) {
+    return -1;
+  }
+  switch (*end) {
+  case 'G': case 'g':
+    v <<= 10;
+    // fall through
+  case 'M': case 'm':
+    v <<= 10;
+    // fall through
+  case 'K': case 'k':
+    v <<= 10;
+    end++;
+    break;
+  }
+  if (*end != '\0' || v == 0) {
+    return -1;
+  }
+  *bytes = v;
+  return 0;
+}
+
+// returns -1 if the manuf file doesn't leave enough for the rest
+int budget_init(size_t budget, size_t manuf)
+{
+  if (manuf + MEMORY_BUDGET_MIN > budget) {
+    return -1;
+  }
+  total = budget;
+  share_bytes[BUDGET_MANUF] = manuf;
+  usage[BUDGET_MANUF] = manuf;
+  for (int s = BUDGET_MANUF + 1; s < BUDGET_SUBSYSTEMS; s++) {
+    share_bytes[s] = (budget - manuf) / 100 * shares[s];
+  }
+  return 0;
+}
+
+// 0 without a budget
+size_t budget_total(void)
+{
+  return total;
+}
+
+// bytes the subsystem may use; 0 without a budget, for its default size
+size_t budget_share(enum budget_subsystem subsystem)
+{
+  return share_bytes[subsystem];
+}
+
+void budget_set_usage(enum budget_subsystem subsystem, size_t bytes)
+{
+  __atomic_store_n(&usage[subsystem], bytes, __ATOMIC_RELAXED);
+}
+
+// resident memory of the whole process
+size_t budget_rss(void)
+{
+  unsigned long size, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+
+  if (f == NULL) {
+    return 0;
+  }
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(f);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// in the Prometheus text format
+void budget_write(FILE *f)
+{
+  fprintf(f, "# HELP probemon_memory_rss_bytes Resident memory of the process\n"
+    "# TYPE probemon_memory_rss_bytes gauge\nprobemon_memory_rss_bytes %zu\n", budget_rss());
+  fprintf(f, "# HELP probemon_memory_bytes Memory used by each subsystem, as counted by itself\n"
+    "# TYPE probemon_memory_bytes gauge\n");
+  for (int s = 0; s < BUDGET_SUBSYSTEMS; s++) {
+    fprintf(f, "probemon_memory_bytes{subsystem=\"%s\"} %zu\n", subsystem_names[s],
+      __atomic_load_n(&usage[s], __ATOMIC_RELAXED));
+  }
+  if (total == 0) {
+    return;
+  }
+  fprintf(f, "# HELP probemon_memory_budget_bytes Share of the memory budget of each subsystem\n"
+    "# TYPE probemon_memory_budget_bytes gauge\nprobemon_memory_budget_bytes %zu\n", total);
+  for (int s = 0; s < BUDGET_SUBSYSTEMS; s++) {
+    fprintf(f, "probemon_memory_budget_bytes{subsystem=\"%s\"} %zu\n", subsystem_names[s], share_bytes[s]);
+  }
+}
+
+// a short summary, for humans
+void budget_dump(FILE *f)
+{
+  fprintf(f, ":: memory: rss=%zu KiB", budget_rss() / 1024);
+  if (total) {
+    fprintf(f, " budget=%zu KiB", total / 1024);
+  }
+  for (int s = 0; s < BUDGET_SUBSYSTEMS; s++) {
+    fprintf(f, " %s=%zu", subsystem_names[s], __atomic_load_n(&usage[s], __ATOMIC_RELAXED) / 1024);
+    if (total) {
+      fprintf(f, "/%zu", share_bytes[s] / 1024);
+    }
+  }
+  fprintf(f, " KiB\n");
+}
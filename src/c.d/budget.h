@@ -0,0 +1,31 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// what holds memory, each with a share of the budget (-M)
+enum budget_subsystem {
+  BUDGET_MANUF = 0,     // the parsed manuf file, taken off the budget first
+  BUDGET_QUEUES,        // the worker and writer queues, and the pools of their records
+  BUDGET_CACHES,        // the ids of the macs and ssids
+  BUDGET_SQLITE,        // page cache and mmap of sqlite
+  BUDGET_MAC_FILTER,
+  BUDGET_UNIQUES,
+  BUDGET_SERIES,
+  BUDGET_TOPK,
+  BUDGET_SESSIONS,
+  BUDGET_SUBSYSTEMS
+};
+
+int budget_parse(const char *value, size_t *bytes);
+int budget_init(size_t total, size_t manuf);
+size_t budget_total(void);
+size_t budget_share(enum budget_subsystem subsystem);
+void budget_set_usage(enum budget_subsystem subsystem, size_t bytes);
+size_t budget_rss(void);
+void budget_write(FILE *f);
+void budget_dump(FILE *f);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+capture side of the pipeline: parse the frames handed over by pcap and queue
+the probe requests for the enrichment workers
+*/
+
+#include <stdlib.h>
+#include <pcap/pcap.h>
+
+#include "capture.h"
+#include "logger_thread.h"
+#include "parsers.h"
+#include "reject.h"
+#include "metrics.h"
+#include "trace.h"
+#include "globals.h"
+#include "config.h"
+
+// pcap_stats is not thread safe: only call it from the capture thread
+void update_pcap_stats(void)
+{
+  struct pcap_stat ps;
+  if (pcap_stats(handle, &ps) == 0) {
+    metrics_set(GAUGE_PCAP_RECEIVED, ps.ps_recv);
+    metrics_set(GAUGE_PCAP_DROPPED, ps.ps_drop);
+    metrics_set(GAUGE_PCAP_IFDROPPED, ps.ps_ifdrop);
+  }
+}
+
+// hand a probe request over to its worker, waiting for room in its queue
+void enqueue_probereq(probereq_t *pr)
+{
+  uint64_t start = metrics_now();
+  TRACE_BEGIN(ENQUEUE_WAIT);
+  dispatch_probereq(pr);
+  TRACE_END(ENQUEUE_WAIT);
+  metrics_observe(HISTOGRAM_ENQUEUE_WAIT, metrics_now() - start);
+}
+
+// pcap callback: parse and queue the probe requests
+void process_packet(uint8_t * args, const struct pcap_pkthdr *header, const uint8_t *packet)
+{
+  uint16_t freq, rx_flags;
+  uint8_t flags;
+  int8_t rssi;
+  uint32_t frame_len;
+
+  metrics_add(METRIC_PACKETS, 1);
+
+  // parse radiotap header
+  TRACE_BEGIN(RADIOTAP);
+  int8_t offset = parse_radiotap_header(packet, &freq, &rssi, &flags, &rx_flags);
+  TRACE_END(RADIOTAP);
+
+  // drop corrupted frames and retransmissions early
+  enum reject_reason reason = reject_frame(packet, header->caplen, header->len, offset,
+    flags, rx_flags, header->ts, &frame_len);
+  if (reason != REJECT_NONE) {
+    __atomic_fetch_add(&reject_counters[reason], 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  // parsed straight into a record of the pool, given back if the frame is malformed
+  probereq_t *pr = new_probereq();
+  if (pr == NULL) {
+    metrics_add(METRIC_PROBES_DROPPED, 1);
+    return;
+  }
+  if (parse_probereq_frame(packet, frame_len, offset, pr->mac, &pr->seq, pr->ssid, &pr->ssid_len,
+      &pr->fingerprint) < 0) {
+    free_probereq(pr);
+    __atomic_fetch_add(&reject_counters[REJECT_MALFORMED], 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  pr->tv.tv_sec = header->ts.tv_sec;
+  pr->tv.tv_usec = header->ts.tv_usec;
+  pr->vendor = NULL;
+  pr->rssi = rssi;
+
+  enqueue_probereq(pr);
+  metrics_add(METRIC_PROBES_QUEUED, 1);
+}
+
+// event loop handler of the selectable fd of pcap, in non-blocking mode: the
+// frames already captured are processed, and the loop stopped on error
+void capture_ready(loop_t *loop, uint32_t events, void *data)
+{
+  if (pcap_dispatch(handle, -1, (pcap_handler) process_packet, NULL) == PCAP_ERROR) {
+    pcap_perror(handle, "Error: ");
+    loop_stop(loop);
+  }
+}
@@ -0,0 +1,15 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <pcap/pcap.h>
+
+#include "logger_thread.h"
+#include "loop.h"
+
+void update_pcap_stats(void);
+void enqueue_probereq(probereq_t *pr);
+void process_packet(uint8_t *args, const struct pcap_pkthdr *header, const uint8_t *packet);
+void capture_ready(loop_t *loop, uint32_t events, void *data);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+coalesce repeated probe requests (same mac and ssid) seen within a time window
+into a single burst, to cut the number of rows written to the db
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "coalesce.h"
+#include "pool.h"
+#include "config.h"
+
+static pool_t burst_pool = POOL_INITIALIZER("burst", probeburst_t);
+
+// FNV-1a over the mac string and the raw ssid bytes
+static uint32_t burst_hash(const probereq_t *pr, uint32_t size)
+{
+  uint32_t h = 2166136261u;
+  for (const char *p = pr->mac; *p; p++) {
+    h ^= (uint8_t)*p;
+    h *= 16777619u;
+  }
+  for (int i = 0; i < pr->ssid_len; i++) {
+    h ^= pr->ssid[i];
+    h *= 16777619u;
+  }
+  return h % size;
+}
+
+static bool burst_match(const probeburst_t *b, const probereq_t *pr)
+{
+  return b->pr->ssid_len == pr->ssid_len
+    && strcmp(b->pr->mac, pr->mac) == 0
+    && (pr->ssid_len == 0 || memcmp(b->pr->ssid, pr->ssid, pr->ssid_len) == 0);
+}
+
+// elapsed time in ms between two timeval
+static int64_t elapsed_ms(struct timeval from, struct timeval to)
+{
+  return (int64_t)(to.tv_sec - from.tv_sec) * 1000 + (to.tv_usec - from.tv_usec) / 1000;
+}
+
+static void burst_close(coalescer_t *c, probeburst_t *b)
+{
+  b->next = NULL;
+  c->emit(b, c->data);
+  c->count--;
+}
+
+void free_probeburst(probeburst_t *b)
+{
+  if (b == NULL) return;
+
+  free_probereq(b->pr);
+  pool_free(&burst_pool, b);
+}
+
+coalescer_t *coalesce_new(uint32_t window, burst_handler emit, void *data)
+{
+  coalescer_t *c = malloc(sizeof(coalescer_t));
+  if (c == NULL) {
+    return NULL;
+  }
+  c->size = COALESCE_TABLE_SIZE;
+  c->buckets = calloc(c->size, sizeof(probeburst_t *));
+  if (c->buckets == NULL) {
+    free(c);
+    return NULL;
+  }
+  c->window = window;
+  c->count = 0;
+  c->last_sweep.tv_sec = 0;
+  c->last_sweep.tv_usec = 0;
+  c->emit = emit;
+  c->data = data;
+
+  return c;
+}
+
+// add a probe request to its burst; the coalescer takes ownership of pr
+void coalesce_add(coalescer_t *c, probereq_t *pr)
+{
+  coalesce_expire(c, pr->tv);
+
+  uint32_t indx = burst_hash(pr, c->size);
+  probeburst_t *b = c->buckets[indx], *prev = NULL;
+  while (b && !burst_match(b, pr)) {
+    prev = b;
+    b = b->next;
+  }
+
+  if (b != NULL && elapsed_ms(b->last, pr->tv) > c->window) {
+    // the previous burst is over: emit it and start a new one in its place
+    if (prev) {
+      prev->next = b->next;
+    } else {
+      c->buckets[indx] = b->next;
+    }
+    burst_close(c, b);
+    b = NULL;
+  }
+
+  if (b == NULL) {
+    b = pool_alloc(&burst_pool);
+    if (b == NULL) {
+      free_probereq(pr);
+      return;
+    }
+    b->pr = pr;
+    b->last = pr->tv;
+    b->count = 1;
+    b->rssi_min = pr->rssi;
+    b->rssi_max = pr->rssi;
+    b->rssi_sum = pr->rssi;
+    b->next = c->buckets[indx];
+    c->buckets[indx] = b;
+    c->count++;
+    return;
+  }
+
+  b->last = pr->tv;
+  b->count++;
+  if (pr->rssi < b->rssi_min) b->rssi_min = pr->rssi;
+  if (pr->rssi > b->rssi_max) b->rssi_max = pr->rssi;
+  b->rssi_sum += pr->rssi;
+  free_probereq(pr);
+}
+
+// emit all the bursts that did not see any probe request for a whole window
+void coalesce_expire(coalescer_t *c, struct timeval now)
+{
+  // no need to sweep more often than once per window
+  if (elapsed_ms(c->last_sweep, now) < c->window) {
+    return;
+  }
+  c->last_sweep = now;
+
+  for (uint32_t i = 0; i < c->size; i++) {
+    probeburst_t *b = c->buckets[i], *prev = NULL;
+    while (b) {
+      probeburst_t *next = b->next;
+      if (elapsed_ms(b->last, now) > c->window) {
+        if (prev) {
+          prev->next = next;
+        } else {
+          c->buckets[i] = next;
+        }
+        burst_close(c, b);
+      } else {
+        prev = b;
+      }
+      b = next;
+    }
+  }
+}
+
+// emit all the opened bursts
+void coalesce_flush(coalescer_t *c)
+{
+  for (uint32_t i = 0; i < c->size; i++) {
+    probeburst_t *b = c->buckets[i];
+    while (b) {
+      probeburst_t *next = b->next;
+      burst_close(c, b);
+      b = next;
+    }
+    c->buckets[i] = NULL;
+  }
+}
+
+void coalesce_free(coalescer_t *c)
+{
+  if (c == NULL) return;
+
+  for (uint32_t i = 0; i < c->size; i++) {
+    probeburst_t *b = c->buckets[i];
+    while (b) {
+      probeburst_t *next = b->next;
+      free_probereq(b->pr);
+      free(b);
+      b = next;
+    }
+  }
+  free(c->buckets);
+  free(c);
+}
@@ -0,0 +1,41 @@
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "logger_thread.h"
+
+// a burst of probe requests with the same mac and ssid, seen within a window
+struct probeburst {
+  probereq_t *pr;         // first probe request of the burst (owned)
+  struct timeval last;
+  uint32_t count;
+  int rssi_min;
+  int rssi_max;
+  int64_t rssi_sum;
+  struct probeburst *next;
+};
+typedef struct probeburst probeburst_t;
+
+// the handler takes ownership of the burst
+typedef void (*burst_handler)(probeburst_t *burst, void *data);
+
+typedef struct coalescer {
+  probeburst_t **buckets;
+  uint32_t size;
+  uint32_t window;        // in ms
+  uint32_t count;         // number of opened bursts
+  struct timeval last_sweep;
+  burst_handler emit;
+  void *data;
+} coalescer_t;
+
+coalescer_t *coalesce_new(uint32_t window, burst_handler emit, void *data);
+void coalesce_add(coalescer_t *c, probereq_t *pr);
+void coalesce_expire(coalescer_t *c, struct timeval now);
+void coalesce_flush(coalescer_t *c);
+void coalesce_free(coalescer_t *c);
+void free_probeburst(probeburst_t *b);
+
+#endif
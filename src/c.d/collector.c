@@ -0,0 +1,493 @@
+/*
+collector side of the sensor to collector mode (see uplink.c): a single thread
+polls the connections of the sensors, decompresses their batches and inserts
+the records in the db, tagged with the id of the sensor. Every
+COLLECTOR_COMMIT_TIME s, the transaction is committed, then each sensor gets
+the seq of its last batch committed, so that it can forget about it. The seq
+of the last batch of each sensor is kept in the db, in the same transaction as
+its rows: a batch sent again after a reconnection is dropped.
+A probe request heard by several sensors is written once (see dedup.c), with
+the rssi and sensor of the best copy; the others go to the heard_by table.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <zlib.h>
+
+#include "collector.h"
+#include "manuf.h"
+#include "db.h"
+
+// largest payload of a batch: its header, then the records once compressed
+#define MAX_PAYLOAD (16 + UPLINK_BATCH_SIZE + UPLINK_BATCH_SIZE / 1024 + 64)
+
+static void close_conn(collector_t *c, struct sensor_conn *conn)
+{
+  if (conn->sensor >= 0) {
+    c->sensors[conn->sensor].conn = -1;
+  }
+  close(conn->fd);
+  free(conn->in);
+  conn->fd = -1;
+  conn->sensor = -1;
+  conn->in = NULL;
+  conn->in_len = 0;
+  conn->out_len = 0;
+  conn->out_sent = 0;
+  conn->ack_pending = false;
+}
+
+// tell the sensor the last of its batches that is committed
+static void queue_ack(struct sensor_conn *conn, uint64_t seq)
+{
+  if (conn->out_sent < conn->out_len) {
+    // the previous ack is not fully sent: send the current one after it
+    conn->ack_pending = true;
+    return;
+  }
+  conn->out[0] = UPLINK_ACK;
+  uplink_put_u32(conn->out + 1, 8);
+  uplink_put_u64(conn->out + UPLINK_HEADER_SIZE, seq);
+  conn->out_len = UPLINK_HEADER_SIZE + 8;
+  conn->out_sent = 0;
+  conn->ack_pending = false;
+}
+
+static void commit(collector_t *c, bool last)
+{
+  if (c->sessions) {
+    session_flush(c->sessions, c->db, last);
+  }
+  if (c->uniques) {
+    uniques_flush(c->uniques, c->db);
+  }
+  c->mac_filter = update_mac_filter(c->mac_filter, c->db);
+  if (last && c->mac_filter) {
+    save_mac_filter(c->mac_filter, c->db);
+  }
+  commit_txn(c->db);
+  begin_txn(c->db);
+  clock_gettime(CLOCK_MONOTONIC, &c->last_commit);
+
+  for (int i = 0; i < c->sensors_count; i++) {
+    struct sensor_state *s = &c->sensors[i];
+    if (s->committed != s->seq) {
+      s->committed = s->seq;
+      if (s->conn >= 0) {
+        queue_ack(&c->conns[s->conn], s->committed);
+      }
+    }
+  }
+}
+
+static int hello(collector_t *c, int conn_idx, const uint8_t *payload, uint32_t len)
+{
+  struct sensor_conn *conn = &c->conns[conn_idx];
+  char name[UPLINK_MAX_NAME + 1];
+
+  if (len < 2 || len > UPLINK_MAX_NAME + 1 || conn->sensor >= 0) {
+    fprintf(stderr, "Warning: unexpected hello from a sensor\n");
+    return -1;
+  }
+  if (payload[0] != UPLINK_VERSION) {
+    fprintf(stderr, "Warning: sensor speaking version %u of the protocol instead of %u\n",
+      payload[0], UPLINK_VERSION);
+    return -1;
+  }
+  memcpy(name, payload + 1, len - 1);
+  name[len - 1] = '\0';
+
+  int i = 0;
+  while (i < c->sensors_count && strcmp(c->sensors[i].name, name)) i++;
+  if (i == c->sensors_count) {
+    if (c->sensors_count == COLLECTOR_MAX_SENSORS) {
+      fprintf(stderr, "Warning: too many sensors, %s rejected\n", name);
+      return -1;
+    }
+    uint64_t last_seq;
+    int64_t id = insert_sensor(name, c->db, &last_seq);
+    if (id < 0) {
+      return -1;
+    }
+    struct sensor_state *s = &c->sensors[c->sensors_count++];
+    strcpy(s->name, name);
+    s->id = id;
+    s->seq = last_seq;
+    s->committed = last_seq;
+    s->conn = -1;
+  }
+
+  struct sensor_state *s = &c->sensors[i];
+  if (s->conn >= 0) {
+    // the sensor reconnected before we noticed it was gone
+    close_conn(c, &c->conns[s->conn]);
+  }
+  s->conn = conn_idx;
+  conn->sensor = i;
+  printf(":: Sensor %s connected\n", s->name);
+  fflush(stdout);
+  queue_ack(conn, s->committed);
+
+  return 0;
+}
+
+// the sessions and the counts of distinct macs, over all the sensors
+static void add_to_session(collector_t *c, const probereq_t *pr, const probeburst_t *burst)
+{
+  if (c->sessions) {
+    session_add(c->sessions, pr->mac, lookup_mac_id(pr->mac, c->mac_pk_cache, c->db), pr->tv,
+      burst ? burst->last : pr->tv, burst ? burst->count : 1, burst ? burst->rssi_max : pr->rssi, c->db);
+  }
+  if (c->uniques) {
+    uniques_add(c->uniques, pr->mac, pr->ssid_str, pr->vendor, pr->tv);
+  }
+}
+
+// write a probe request, unless another sensor already sent it: then only keep its rssi
+static void insert_record(collector_t *c, int sensor, probereq_t *pr)
+{
+  struct sensor_state *s = &c->sensors[sensor];
+
+  if (c->dedup == NULL) {
+    if (insert_probereq(*pr, c->db, c->mac_pk_cache, c->ssid_pk_cache, c->mac_filter, s->id) == 0) {
+      add_to_session(c, pr, NULL);
+    }
+    return;
+  }
+
+  bool found;
+  uint64_t mac = mac_to_uint64(pr->mac);
+  uint64_t time = (uint64_t)pr->tv.tv_sec * 1000000 + pr->tv.tv_usec;
+  struct dedup_entry *e = dedup_find(c->dedup, mac, pr->seq, time, &found);
+  if (found && e->sensor != sensor) {
+    if (pr->rssi > e->rssi) {
+      insert_heard_by(e->row, c->sensors[e->sensor].id, e->rssi, c->db);
+      update_probereq_sensor(e->row, s->id, pr->rssi, c->db);
+      e->sensor = sensor;
+      e->rssi = pr->rssi;
+    } else {
+      insert_heard_by(e->row, s->id, pr->rssi, c->db);
+    }
+    c->merged++;
+    return;
+  }
+
+  // a new probe request, or a retransmission of the same sensor: its own row
+  if (insert_probereq(*pr, c->db, c->mac_pk_cache, c->ssid_pk_cache, c->mac_filter, s->id) == 0) {
+    e->mac = mac;
+    e->seq = pr->seq;
+    e->time = time;
+    e->row = sqlite3_last_insert_rowid(c->db);
+    e->sensor = sensor;
+    e->rssi = pr->rssi;
+    add_to_session(c, pr, NULL);
+  }
+}
+
+static int batch(collector_t *c, struct sensor_conn *conn, const uint8_t *payload, uint32_t len)
+{
+  if (conn->sensor < 0 || len < 16) {
+    fprintf(stderr, "Warning: unexpected batch from a sensor\n");
+    return -1;
+  }
+  struct sensor_state *s = &c->sensors[conn->sensor];
+  uint64_t seq = uplink_get_u64(payload);
+  uint32_t count = uplink_get_u32(payload + 8);
+  uLongf raw_len = uplink_get_u32(payload + 12);
+
+  c->bytes += UPLINK_HEADER_SIZE + len;
+  if (seq <= s->seq) {
+    // sent again after a reconnection
+    c->duplicates++;
+    return 0;
+  }
+  if (raw_len > sizeof(c->records)
+    || uncompress(c->records, &raw_len, payload + 16, len - 16) != Z_OK) {
+    fprintf(stderr, "Warning: can't uncompress a batch of sensor %s\n", s->name);
+    return -1;
+  }
+
+  size_t offset = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    probereq_t pr;
+    probeburst_t burst;
+    bool is_burst;
+    size_t n = uplink_decode(c->records + offset, raw_len - offset, &pr, &burst, &is_burst);
+    if (n == 0) {
+      fprintf(stderr, "Warning: malformed record in a batch of sensor %s\n", s->name);
+      break;
+    }
+    offset += n;
+    if (is_burst) {
+      if (insert_probeburst(&burst, c->db, c->mac_pk_cache, c->ssid_pk_cache, c->mac_filter, s->id) == 0) {
+        add_to_session(c, &pr, &burst);
+      }
+    } else {
+      insert_record(c, conn->sensor, &pr);
+    }
+    c->records_count++;
+  }
+  update_sensor_seq(s->id, seq, c->db);
+  s->seq = seq;
+  c->batches++;
+
+  return 0;
+}
+
+// handle the complete frames in the input buffer
+static int read_frames(collector_t *c, int conn_idx)
+{
+  struct sensor_conn *conn = &c->conns[conn_idx];
+
+  ssize_t r = recv(conn->fd, conn->in + conn->in_len, UPLINK_HEADER_SIZE + MAX_PAYLOAD - conn->in_len, 0);
+  if (r <= 0) {
+    return (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? 0 : -1;
+  }
+  conn->in_len += r;
+
+  size_t offset = 0;
+  while (conn->in_len - offset >= UPLINK_HEADER_SIZE) {
+    const uint8_t *frame = conn->in + offset;
+    uint32_t len = uplink_get_u32(frame + 1);
+    if (len > MAX_PAYLOAD) {
+      fprintf(stderr, "Warning: frame too large from a sensor\n");
+      return -1;
+    }
+    if (conn->in_len - offset < UPLINK_HEADER_SIZE + len) {
+      break;
+    }
+    int ret;
+    switch (frame[0]) {
+      case UPLINK_HELLO:
+        ret = hello(c, conn_idx, frame + UPLINK_HEADER_SIZE, len);
+        break;
+      case UPLINK_BATCH:
+        ret = batch(c, conn, frame + UPLINK_HEADER_SIZE, len);
+        break;
+      default:
+        fprintf(stderr, "Warning: unknown frame from a sensor\n");
+        ret = -1;
+    }
+    if (ret) {
+      return -1;
+    }
+    offset += UPLINK_HEADER_SIZE + len;
+  }
+  memmove(conn->in, conn->in + offset, conn->in_len - offset);
+  conn->in_len -= offset;
+
+  return 0;
+}
+
+static int write_ack(collector_t *c, struct sensor_conn *conn)
+{
+  ssize_t w = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+  if (w < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  conn->out_sent += w;
+  if (conn->out_sent == conn->out_len && conn->ack_pending) {
+    queue_ack(conn, c->sensors[conn->sensor].committed);
+  }
+  return 0;
+}
+
+static void accept_conn(collector_t *c)
+{
+  int fd = accept(c->listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  int i = 0;
+  while (i < COLLECTOR_MAX_CONNECTIONS && c->conns[i].fd >= 0) i++;
+  if (i == COLLECTOR_MAX_CONNECTIONS || (c->conns[i].in = malloc(UPLINK_HEADER_SIZE + MAX_PAYLOAD)) == NULL) {
+    fprintf(stderr, "Warning: too many sensors connected\n");
+    close(fd);
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  c->conns[i].fd = fd;
+}
+
+// run the poll loop until collector_stop() is called
+int collector_run(collector_t *c)
+{
+  struct pollfd fds[COLLECTOR_MAX_CONNECTIONS + 2];
+  int idx[COLLECTOR_MAX_CONNECTIONS + 2];
+
+  begin_txn(c->db);
+  clock_gettime(CLOCK_MONOTONIC, &c->last_commit);
+
+  while (true) {
+    int n = 0;
+    fds[n].fd = c->wake_fd[0];
+    fds[n++].events = POLLIN;
+    fds[n].fd = c->listen_fd;
+    fds[n++].events = POLLIN;
+    for (int i = 0; i < COLLECTOR_MAX_CONNECTIONS; i++) {
+      if (c->conns[i].fd >= 0) {
+        idx[n] = i;
+        fds[n].fd = c->conns[i].fd;
+        fds[n++].events = POLLIN | (c->conns[i].out_sent < c->conns[i].out_len ? POLLOUT : 0);
+      }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t timeout = (c->last_commit.tv_sec + COLLECTOR_COMMIT_TIME - now.tv_sec) * 1000
+      + (c->last_commit.tv_nsec - now.tv_nsec) / 1000000;
+    if (poll(fds, n, timeout > 0 ? timeout : 0) < 0) {
+      if (errno == EINTR) continue;
+      perror("Error: poll");
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      accept_conn(c);
+    }
+
+    for (int k = 2; k < n; k++) {
+      struct sensor_conn *conn = &c->conns[idx[k]];
+      if (conn->fd < 0) {
+        // closed when its sensor reconnected
+        continue;
+      }
+      if (fds[k].revents & (POLLERR | POLLNVAL)
+        || (fds[k].revents & (POLLIN | POLLHUP) && read_frames(c, idx[k]) < 0)
+        || (fds[k].revents & POLLOUT && write_ack(c, conn) < 0)) {
+        if (conn->sensor >= 0) {
+          printf(":: Sensor %s disconnected\n", c->sensors[conn->sensor].name);
+          fflush(stdout);
+        }
+        close_conn(c, conn);
+      }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - c->last_commit.tv_sec >= COLLECTOR_COMMIT_TIME) {
+      commit(c, false);
+    }
+  }
+
+  // last commit, and a last chance for the sensors to hear about it
+  commit(c, true);
+  commit_txn(c->db);
+  for (int i = 0; i < COLLECTOR_MAX_CONNECTIONS; i++) {
+    struct sensor_conn *conn = &c->conns[i];
+    if (conn->fd >= 0 && conn->out_sent < conn->out_len) {
+      write_ack(c, conn);
+    }
+  }
+
+  return 0;
+}
+
+// safe to call from a signal handler
+void collector_stop(collector_t *c)
+{
+  char q = 'q';
+  if (write(c->wake_fd[1], &q, 1) < 0) {
+    // ignore
+  }
+}
+
+// address is [HOST:]PORT; HOST defaults to localhost. The copies of a probe request
+// heard by several sensors are merged if their timestamps are at most tolerance ms
+// apart; 0 keeps them all. The sessions of the macs are closed after gap s of
+// silence; 0 doesn't track them. cache_policy is the replacement policy of the id caches
+collector_t *collector_new(const char *address, sqlite3 *db, uint32_t tolerance, int gap, lruc_policy cache_policy)
+{
+  char host[256] = "127.0.0.1";
+  const char *port = address;
+  const char *colon = strrchr(address, ':');
+  if (colon) {
+    size_t len = colon - address;
+    if (len >= sizeof(host)) {
+      fprintf(stderr, "Error: invalid address %s\n", address);
+      return NULL;
+    }
+    memcpy(host, address, len);
+    host[len] = '\0';
+    port = colon + 1;
+  }
+
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE }, *res;
+  int err;
+  if ((err = getaddrinfo(host, port, &hints, &res))) {
+    fprintf(stderr, "Error: invalid address %s: %s\n", address, gai_strerror(err));
+    return NULL;
+  }
+
+  collector_t *c = calloc(1, sizeof(collector_t));
+  for (int i = 0; i < COLLECTOR_MAX_CONNECTIONS; i++) {
+    c->conns[i].fd = -1;
+    c->conns[i].sensor = -1;
+  }
+  c->db = db;
+
+  c->listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  int on = 1;
+  if (c->listen_fd < 0
+    || setsockopt(c->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+    || bind(c->listen_fd, res->ai_addr, res->ai_addrlen) < 0
+    || listen(c->listen_fd, 16) < 0) {
+    fprintf(stderr, "Error: can't listen on %s: %s\n", address, strerror(errno));
+    if (c->listen_fd >= 0) close(c->listen_fd);
+    freeaddrinfo(res);
+    free(c);
+    return NULL;
+  }
+  freeaddrinfo(res);
+
+  if (pipe(c->wake_fd) < 0) {
+    perror("Error: can't create pipe");
+    close(c->listen_fd);
+    free(c);
+    return NULL;
+  }
+  fcntl(c->wake_fd[1], F_SETFL, fcntl(c->wake_fd[1], F_GETFL) | O_NONBLOCK);
+
+  c->mac_pk_cache = lruc_new(MAC_CACHE_SIZE, 1, cache_policy);
+  c->ssid_pk_cache = lruc_new(SSID_CACHE_SIZE, 1, cache_policy);
+  if (tolerance > 0 && (c->dedup = dedup_new(DEDUP_TABLE_SIZE, tolerance)) == NULL) {
+    fprintf(stderr, "Warning: can't allocate the table of the recent probe requests, nothing will be merged\n");
+  }
+  if (gap > 0) {
+    c->sessions = session_new(SESSION_TABLE_SIZE, gap);
+  }
+  c->uniques = uniques_new(UNIQUES_TABLE_SIZE, UNIQUES_MAX_SKETCHES);
+  c->mac_filter = update_mac_filter(load_mac_filter(db), db);
+
+  return c;
+}
+
+void collector_free(collector_t *c)
+{
+  if (c == NULL) return;
+
+  for (int i = 0; i < COLLECTOR_MAX_CONNECTIONS; i++) {
+    if (c->conns[i].fd >= 0) {
+      close_conn(c, &c->conns[i]);
+    }
+  }
+  lruc_free(c->mac_pk_cache);
+  lruc_free(c->ssid_pk_cache);
+  dedup_free(c->dedup);
+  session_free(c->sessions);
+  uniques_free(c->uniques);
+  bloom_free(c->mac_filter);
+  close(c->listen_fd);
+  close(c->wake_fd[0]);
+  close(c->wake_fd[1]);
+  free(c);
+}
@@ -0,0 +1,61 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sqlite3.h>
+
+#include "lruc.h"
+#include "uplink.h"
+#include "dedup.h"
+#include "session.h"
+#include "uniques.h"
+#include "bloom.h"
+#include "config.h"
+
+// a connection from a sensor
+struct sensor_conn {
+  int fd;
+  int sensor;             // index in sensors, once it said hello
+  uint8_t *in;
+  size_t in_len;
+  uint8_t out[UPLINK_HEADER_SIZE + 8];
+  size_t out_len, out_sent;
+  bool ack_pending;       // a newer ack is waiting for the previous one to be sent
+};
+
+struct sensor_state {
+  char name[UPLINK_MAX_NAME + 1];
+  int64_t id;             // in the sensor table
+  uint64_t seq;           // of the last batch inserted
+  uint64_t committed;     // of the last batch committed and acked
+  int conn;               // -1 if not connected
+};
+
+// receives the batches of the sensors on a single threaded poll loop, and writes them
+// to a single db, each row tagged with its sensor
+typedef struct collector {
+  int listen_fd;
+  int wake_fd[2];
+  sqlite3 *db;
+  lruc *mac_pk_cache, *ssid_pk_cache;
+  dedup_t *dedup;         // NULL if the copies heard by several sensors are kept
+  session_store_t *sessions;
+  unique_store_t *uniques;
+  bloom_t *mac_filter;
+  struct sensor_conn conns[COLLECTOR_MAX_CONNECTIONS];
+  struct sensor_state sensors[COLLECTOR_MAX_SENSORS];
+  int sensors_count;
+  uint8_t records[UPLINK_BATCH_SIZE];
+  struct timespec last_commit;
+  uint64_t batches, records_count, duplicates, bytes, merged;
+} collector_t;
+
+collector_t *collector_new(const char *address, sqlite3 *db, uint32_t tolerance, int gap, lruc_policy cache_policy);
+int collector_run(collector_t *c);
+void collector_stop(collector_t *c);
+void collector_free(collector_t *c);
+
+#endif
@@ -0,0 +1,345 @@
+/*
+recent history of the probe requests, served over http to answer the hot
+queries of the web dashboard (latest probes, stats of the last hours) from memory.
+Queries reaching before the history answer 404 so that the caller falls back
+on the db.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#include "dashboard.h"
+#include "parsers.h"
+
+#define MAX_MACS_FILTER 64
+
+dashboard_t *dashboard_new(void)
+{
+  dashboard_t *dash = calloc(1, sizeof(dashboard_t));
+  if (dash == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&dash->lock, NULL);
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  dash->since = now.tv_sec + now.tv_usec / 1e6;
+  dash->last_commit = now.tv_sec;
+
+  return dash;
+}
+
+void dashboard_free(dashboard_t *dash)
+{
+  if (dash == NULL) return;
+
+  pthread_mutex_destroy(&dash->lock);
+  free(dash);
+}
+
+void dashboard_add(dashboard_t *dash, const probereq_t *pr, const char *vendor)
+{
+  pthread_mutex_lock(&dash->lock);
+  struct dashboard_probe *p = &dash->probes[dash->head];
+  if (dash->count == DASHBOARD_HISTORY) {
+    // the oldest probe is overwritten: the history now starts after it
+    dash->since = p->date;
+  } else {
+    dash->count++;
+  }
+  p->date = pr->tv.tv_sec + pr->tv.tv_usec / 1e6;
+  memcpy(p->mac, pr->mac, sizeof(p->mac) - 1);
+  p->mac[sizeof(p->mac) - 1] = '\0';
+  p->rssi = pr->rssi;
+  p->vendor = vendor;
+  strcpy(p->ssid, pr->ssid_str);
+  dash->head = (dash->head + 1) % DASHBOARD_HISTORY;
+  pthread_mutex_unlock(&dash->lock);
+}
+
+void dashboard_commit(dashboard_t *dash)
+{
+  pthread_mutex_lock(&dash->lock);
+  dash->last_commit = time(NULL);
+  pthread_mutex_unlock(&dash->lock);
+}
+
+// i-th probe of the history, from the oldest
+static inline const struct dashboard_probe *history(const dashboard_t *dash, uint32_t i)
+{
+  return &dash->probes[(dash->head + DASHBOARD_HISTORY - dash->count + i) % DASHBOARD_HISTORY];
+}
+
+static void format_date(double date, char *buf, size_t size)
+{
+  struct tm tm;
+  time_t sec = (time_t)date;
+  strftime(buf, size, "%Y-%m-%dT%H:%M:%S", localtime_r(&sec, &tm));
+}
+
+// ------------------------------------------
+// /api/stats/timestamp
+// ------------------------------------------
+static void get_timestamp(const char *query, http_response_t *resp, void *data)
+{
+  dashboard_t *dash = (dashboard_t *)data;
+  char buf[32];
+  struct tm tm;
+
+  pthread_mutex_lock(&dash->lock);
+  time_t ts = dash->last_commit;
+  pthread_mutex_unlock(&dash->lock);
+
+  strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime_r(&ts, &tm));
+  http_printf(resp, "{\"timestamp\": \"%s\"}", buf);
+}
+
+// ------------------------------------------
+// /api/probes/latest
+// ------------------------------------------
+static void get_latest(const char *query, http_response_t *resp, void *data)
+{
+  dashboard_t *dash = (dashboard_t *)data;
+  char buf[32];
+
+  pthread_mutex_lock(&dash->lock);
+  if (dash->count < DASHBOARD_LATEST) {
+    // the older ones are only in the db
+    pthread_mutex_unlock(&dash->lock);
+    resp->status = 404;
+    return;
+  }
+  resp->content_type = "text/plain";
+  for (uint32_t i = dash->count - DASHBOARD_LATEST; i < dash->count; i++) {
+    const struct dashboard_probe *p = history(dash, i);
+    format_date(p->date, buf, sizeof(buf));
+    http_printf(resp, "%s%s\t%s%s\t%d\t%s", i > dash->count - DASHBOARD_LATEST ? "\n" : "",
+      buf, p->mac, is_laa(p->mac) ? " (LAA)" : "", p->rssi, p->vendor);
+  }
+  pthread_mutex_unlock(&dash->lock);
+}
+
+// ------------------------------------------
+// /api/stats
+// ------------------------------------------
+struct row {
+  const struct dashboard_probe *p;
+  const char *key;        // mac, or LAA for all the locally administered ones
+  uint32_t seq;
+};
+
+struct group {
+  uint32_t start;         // first row of the group
+  uint32_t len;
+  uint32_t count;         // non zero rssi
+  uint32_t seq;           // of its first probe
+};
+
+static int cmp_row(const void *a, const void *b)
+{
+  const struct row *ra = a, *rb = b;
+  int c = strcmp(ra->key, rb->key);
+  return c ? c : (ra->seq > rb->seq) - (ra->seq < rb->seq);
+}
+
+static int cmp_group(const void *a, const void *b)
+{
+  const struct group *ga = a, *gb = b;
+  // most seen first, and among those the last appeared first
+  if (ga->count != gb->count) {
+    return ga->count < gb->count ? 1 : -1;
+  }
+  return ga->seq < gb->seq ? 1 : -1;
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static int cmp_int8(const void *a, const void *b)
+{
+  return *(const int8_t *)a - *(const int8_t *)b;
+}
+
+static bool match_macs(const char *mac, char macs[][18], int macs_count)
+{
+  if (macs_count == 0) {
+    return true;
+  }
+  for (int i = 0; i < macs_count; i++) {
+    if (mac_matches(mac, macs[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void write_group(http_response_t *resp, const struct row *rows, const struct group *g)
+{
+  char first[32], last[32];
+  const char *ssids[g->len];
+  int8_t rssi[g->len];
+  int ssids_count = 0;
+  uint32_t n = 0;
+  double date_first = rows[g->start].p->date, date_last = date_first;
+  int64_t sum = 0;
+
+  for (uint32_t i = g->start; i < g->start + g->len; i++) {
+    const struct dashboard_probe *p = rows[i].p;
+    if (p->date < date_first) date_first = p->date;
+    if (p->date > date_last) date_last = p->date;
+    if (p->ssid[0] != '\0') {
+      ssids[ssids_count++] = p->ssid;
+    }
+    if (p->rssi != 0) {
+      rssi[n++] = p->rssi;
+      sum += p->rssi;
+    }
+  }
+
+  format_date(date_first, first, sizeof(first));
+  format_date(date_last, last, sizeof(last));
+  http_printf(resp, "{\"first\": \"%s\", \"last\": \"%s\", \"mac\": ", first, last);
+  http_append_json_str(resp, rows[g->start].key);
+
+  if (n > 0) {
+    qsort(rssi, n, sizeof(int8_t), cmp_int8);
+    int median = rssi[n / 2];
+    if (n % 2 == 0) {
+      // floor of the mean of the two middle values, like the python stats
+      int s = rssi[n / 2 - 1] + rssi[n / 2];
+      median = s >= 0 ? s / 2 : -((-s + 1) / 2);
+    }
+    char avg[32];
+    snprintf(avg, sizeof(avg), "%.15g", (double)sum / n);
+    if (strpbrk(avg, ".e") == NULL) {
+      strcat(avg, ".0");
+    }
+    http_printf(resp, ", \"rssi\": {\"avg\": %s, \"count\": %u, \"max\": %d, \"median\": %d, \"min\": %d}",
+      avg, n, rssi[n - 1], median, rssi[0]);
+  }
+
+  http_append(resp, ", \"ssids\": [", 12);
+  qsort(ssids, ssids_count, sizeof(char *), cmp_str);
+  for (int i = 0; i < ssids_count; i++) {
+    if (i > 0 && strcmp(ssids[i], ssids[i - 1]) == 0) {
+      continue;
+    }
+    if (i > 0) {
+      http_append(resp, ", ", 2);
+    }
+    http_append_json_str(resp, ssids[i]);
+  }
+  http_append(resp, "], \"vendor\": ", 13);
+  http_append_json_str(resp, rows[g->start].p->vendor);
+  http_append(resp, "}", 1);
+}
+
+static void get_stats(const char *query, http_response_t *resp, void *data)
+{
+  dashboard_t *dash = (dashboard_t *)data;
+  char value[64];
+  char macs[MAX_MACS_FILTER][18];
+  int macs_count = 0;
+  double after, before = -1;
+
+  if (http_query_next(query, "after", value, sizeof(value)) == NULL) {
+    // the whole history is only in the db
+    resp->status = 404;
+    return;
+  }
+  if (http_parse_date(value, &after)) {
+    resp->status = 400;
+    http_printf(resp, "{\"message\": \"Invalid after parameter\"}");
+    return;
+  }
+  if (http_query_next(query, "before", value, sizeof(value)) != NULL && http_parse_date(value, &before)) {
+    resp->status = 400;
+    http_printf(resp, "{\"message\": \"Invalid before parameter\"}");
+    return;
+  }
+  const char *q = query;
+  while ((q = http_query_next(q, "macs", value, sizeof(value))) != NULL) {
+    if (macs_count == MAX_MACS_FILTER) {
+      resp->status = 404;
+      return;
+    }
+    value[17] = '\0';
+    strcpy(macs[macs_count++], value);
+  }
+
+  pthread_mutex_lock(&dash->lock);
+  if (after < dash->since) {
+    pthread_mutex_unlock(&dash->lock);
+    resp->status = 404;
+    return;
+  }
+
+  // the matching probes are copied, to sort and format them without holding the
+  // workers back in dashboard_add()
+  struct dashboard_probe *probes = malloc(dash->count * sizeof(struct dashboard_probe) + 1);
+  struct row *rows = malloc(dash->count * sizeof(struct row) + 1);
+  struct group *groups = malloc(dash->count * sizeof(struct group) + 1);
+  uint32_t rows_count = 0, groups_count = 0;
+  if (probes == NULL || rows == NULL || groups == NULL) {
+    pthread_mutex_unlock(&dash->lock);
+    free(probes);
+    free(rows);
+    free(groups);
+    resp->status = 500;
+    return;
+  }
+  for (uint32_t i = 0; i < dash->count; i++) {
+    const struct dashboard_probe *p = history(dash, i);
+    if (p->date > after && (before < 0 || p->date < before) && match_macs(p->mac, macs, macs_count)) {
+      probes[rows_count] = *p;
+      rows[rows_count].seq = i;
+      rows_count++;
+    }
+  }
+  pthread_mutex_unlock(&dash->lock);
+
+  for (uint32_t i = 0; i < rows_count; i++) {
+    rows[i].p = &probes[i];
+    rows[i].key = is_laa(probes[i].mac) ? "LAA" : probes[i].mac;
+  }
+
+  qsort(rows, rows_count, sizeof(struct row), cmp_row);
+  for (uint32_t i = 0; i < rows_count; i++) {
+    if (i == 0 || strcmp(rows[i].key, rows[i - 1].key)) {
+      groups[groups_count].start = i;
+      groups[groups_count].len = 0;
+      groups[groups_count].count = 0;
+      groups[groups_count].seq = rows[i].seq;
+      groups_count++;
+    }
+    groups[groups_count - 1].len++;
+    if (rows[i].p->rssi != 0) {
+      groups[groups_count - 1].count++;
+    }
+  }
+  qsort(groups, groups_count, sizeof(struct group), cmp_group);
+
+  http_append(resp, "[", 1);
+  for (uint32_t i = 0; i < groups_count; i++) {
+    if (i > 0) {
+      http_append(resp, ", ", 2);
+    }
+    write_group(resp, rows, &groups[i]);
+  }
+  http_append(resp, "]", 1);
+
+  free(probes);
+  free(rows);
+  free(groups);
+}
+
+void dashboard_routes(dashboard_t *dash, http_server_t *server)
+{
+  http_route(server, "/api/stats/timestamp", get_timestamp, dash);
+  http_route(server, "/api/probes/latest", get_latest, dash);
+  http_route(server, "/api/stats", get_stats, dash);
+}
@@ -0,0 +1,38 @@
+#ifndef DASHBOARD_H
+#define DASHBOARD_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logger_thread.h"
+#include "http.h"
+#include "config.h"
+
+// a probe request as kept in memory for the dashboard
+struct dashboard_probe {
+  double date;
+  char mac[18];
+  int8_t rssi;
+  const char *vendor;     // points into the manuf table
+  char ssid[64];
+};
+
+// recent history of the probe requests, to answer the hot queries of the web
+// dashboard without going through the db
+typedef struct dashboard {
+  pthread_mutex_t lock;
+  struct dashboard_probe probes[DASHBOARD_HISTORY];
+  uint32_t head;          // next slot to write
+  uint32_t count;
+  double since;           // the history holds every probe request after that date
+  time_t last_commit;
+} dashboard_t;
+
+dashboard_t *dashboard_new(void);
+void dashboard_add(dashboard_t *dash, const probereq_t *pr, const char *vendor);
+void dashboard_commit(dashboard_t *dash);
+void dashboard_routes(dashboard_t *dash, http_server_t *server);
+void dashboard_free(dashboard_t *dash);
+
+#endif
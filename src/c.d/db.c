@@ -4,12 +4,38 @@
 #include <string.h>
 #include <libgen.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include "logger_thread.h"
 #include "manuf.h"
 #include "parsers.h"
 #include "base64.h"
 #include "lruc.h"
+#include "coalesce.h"
+#include "db.h"
+#include "metrics.h"
+#include "budget.h"
+#include "trace.h"
+
+// add a column to an existing table if it is not already there
+static int add_missing_column(sqlite3 *db, const char *table, const char *column, const char *type)
+{
+  int ret;
+  char sql[128];
+  sqlite3_stmt *stmt;
+
+  snprintf(sql, 128, "select %s from %s limit 0;", column, table);
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return SQLITE_OK;
+  }
+
+  snprintf(sql, 128, "alter table %s add column %s %s;", table, column, type);
+  if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+  }
+  return ret;
+}
 
 int init_probemon_db(const char *db_file, sqlite3 **db)
 {
@@ -34,6 +60,7 @@ int init_probemon_db(const char *db_file, sqlite3 **db)
     "id integer not null primary key,"
     "address text,"
     "vendor integer,"
+    "fingerprint integer,"
     "foreign key(vendor) references vendor(id)"
     ");";
   if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
@@ -41,6 +68,24 @@ int init_probemon_db(const char *db_file, sqlite3 **db)
     sqlite3_close(*db);
     return ret;
   }
+  // db created before the fingerprint was introduced
+  if ((ret = add_missing_column(*db, "mac", "fingerprint", "integer")) != SQLITE_OK) {
+    sqlite3_close(*db);
+    return ret;
+  }
+  sql = "create index if not exists idx_mac_fingerprint on mac(fingerprint);";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  // a mac missing from the cache is looked up by its address
+  sql = "create index if not exists idx_mac_address on mac(address);";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
   sql = "create table if not exists ssid("
     "id integer not null primary key,"
     "name text"
@@ -69,6 +114,140 @@ int init_probemon_db(const char *db_file, sqlite3 **db)
     sqlite3_close(*db);
     return ret;
   }
+  sql = "create table if not exists probeburst("
+    "first float,"
+    "last float,"
+    "mac integer,"
+    "ssid integer,"
+    "count integer,"
+    "rssi_min integer,"
+    "rssi_max integer,"
+    "rssi_mean float,"
+    "foreign key(mac) references mac(id),"
+    "foreign key(ssid) references ssid(id)"
+    ");";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  sql = "create index if not exists idx_probeburst_first on probeburst(first);";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  // sensors sending to a collector, and the seq of the last batch of each in the db
+  sql = "create table if not exists sensor("
+    "id integer not null primary key,"
+    "name text unique,"
+    "last_seq integer"
+    ");";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  // null when written by probemon itself
+  if ((ret = add_missing_column(*db, "probemon", "sensor", "integer references sensor(id)")) != SQLITE_OK
+    || (ret = add_missing_column(*db, "probeburst", "sensor", "integer references sensor(id)")) != SQLITE_OK) {
+    sqlite3_close(*db);
+    return ret;
+  }
+  // the other sensors that heard a probe request: its row has the one with the best rssi
+  sql = "create table if not exists heard_by("
+    "probemon integer,"   // rowid of the probe request
+    "sensor integer,"
+    "rssi integer,"
+    "foreign key(sensor) references sensor(id)"
+    ");";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  sql = "create index if not exists idx_heard_by_probemon on heard_by(probemon);";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  // presence of each mac, from its first to its last probe request (see session.c)
+  sql = "create table if not exists sessions("
+    "mac integer,"
+    "start float,"
+    "end float,"
+    "count integer,"
+    "rssi_max integer,"
+    "foreign key(mac) references mac(id)"
+    ");";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  sql = "create index if not exists idx_sessions_mac on sessions(mac, start);";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  sql = "create index if not exists idx_sessions_start on sessions(start);";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  // HyperLogLog sketches of the distinct macs of each period (see uniques.c)
+  sql = "create table if not exists uniques("
+    "granularity integer,"  // in s
+    "start integer,"
+    "dimension integer,"    // 0: all the macs, 1: those of the ssid value, 2: of the vendor value
+    "value text,"
+    "sketch blob,"
+    "primary key(granularity, start, dimension, value)"
+    ");";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  // the probe requests of the randomized macs, kept for a while without a row in the mac
+  // table (with -e)
+  sql = "create table if not exists ephemeral("
+    "first float,"
+    "last float,"
+    "mac integer,"          // the 48 bits of the address
+    "ssid integer,"
+    "count integer,"
+    "rssi integer,"         // the max of a burst
+    "fingerprint integer,"
+    "foreign key(ssid) references ssid(id)"
+    ");";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  sql = "create index if not exists idx_ephemeral_last on ephemeral(last);";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
+  // the filter of the macs of the mac table, as saved on exit (see load_mac_filter)
+  sql = "create table if not exists mac_filter("
+    "last_mac integer,"   // id of the newest mac when saved
+    "capacity integer,"
+    "count integer,"
+    "hashes integer,"
+    "bits blob"
+    ");";
+  if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+    sqlite3_close(*db);
+    return ret;
+  }
   sql = "pragma synchronous = normal;";
   if ((ret = sqlite3_exec(*db, sql, NULL, 0, NULL)) != SQLITE_OK) {
     fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
@@ -93,6 +272,25 @@ int init_probemon_db(const char *db_file, sqlite3 **db)
     sqlite3_close(*db);
     return ret;
   }
+  // within the share of the memory budget (-M): 3/4 for the page cache, 1/4 mapped,
+  // and the pages are recycled rather than allocated past it
+  size_t share = budget_share(BUDGET_SQLITE);
+  if (share) {
+    char pragma[64];
+    snprintf(pragma, sizeof(pragma), "pragma cache_size = -%zu;", share / 4 * 3 / 1024);
+    if ((ret = sqlite3_exec(*db, pragma, NULL, 0, NULL)) != SQLITE_OK) {
+      fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+      sqlite3_close(*db);
+      return ret;
+    }
+    snprintf(pragma, sizeof(pragma), "pragma mmap_size = %zu;", share / 4);
+    if ((ret = sqlite3_exec(*db, pragma, NULL, 0, NULL)) != SQLITE_OK) {
+      fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(*db), basename(__FILE__), __LINE__, __func__);
+      sqlite3_close(*db);
+      return ret;
+    }
+    sqlite3_soft_heap_limit64(share);
+  }
 
   return 0;
 }
@@ -240,69 +438,116 @@ int64_t search_mac(const char *mac, sqlite3 *db)
   return mac_id;
 }
 
-int64_t insert_mac(const char *mac, int64_t vendor_id, sqlite3 *db)
+int64_t insert_mac(const char *mac, int64_t vendor_id, uint64_t fingerprint, bloom_t *mac_filter, sqlite3 *db)
 {
     // insert the mac into the db
   int64_t ret, mac_id = 0;
-  char sql[128];
+  char sql[160];
+  uint64_t key = mac_to_uint64(mac);
 
-  mac_id = search_mac(mac, db);
+  // a mac unknown to the filter is not in the table: most new macs skip the search
+  if (mac_filter == NULL || bloom_maybe(mac_filter, key)) {
+    mac_id = search_mac(mac, db);
+    if (mac_filter && mac_id == 0) {
+      metrics_add(METRIC_MAC_FILTER_FALSE_POSITIVES, 1);
+    }
+  } else {
+    metrics_add(METRIC_MAC_FILTER_SKIPPED, 1);
+  }
   if (!mac_id) {
-    snprintf(sql, 128, "insert into mac (address, vendor) values ('%s', '%"PRId64"');", mac, vendor_id);
+    // sqlite integers are signed 64 bits
+    snprintf(sql, 160, "insert into mac (address, vendor, fingerprint) values ('%s', '%"PRId64"', '%"PRId64"');",
+      mac, vendor_id, (int64_t)fingerprint);
     if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
       fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
       return ret * -1;
     }
-    mac_id = search_mac(mac, db);
+    mac_id = sqlite3_last_insert_rowid(db);
+    if (mac_filter) {
+      bloom_add(mac_filter, key);
+    }
   }
 
   return mac_id;
 }
 
-int insert_probereq(probereq_t pr, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_pk_cache)
+// look up (or insert) an ssid (as encoded by the logger thread) and return its id
+static int64_t lookup_ssid_id(const char *ssid, sqlite3 *db, lruc *ssid_pk_cache)
 {
-  int64_t vendor_id, ssid_id, mac_id;
-  int ret;
-
-  // is ssid a valid utf-8 string
-  char tmp[64];
-  memcpy(tmp, pr.ssid, pr.ssid_len);
-  tmp[pr.ssid_len] = '\0';
-
-  if (!is_utf8(tmp)) {
-    // base64 encode the ssid
-    size_t length;
-    char *b64tmp = base64_encode((unsigned char *)tmp, pr.ssid_len, &length);
-    snprintf(tmp, length+4+1, "b64_%s", b64tmp);
-    free(b64tmp);
-  }
-
+  int64_t ssid_id;
   void *value = NULL;
-  // look up ssid (tmp) in ssid_pk_cache
-  lruc_get(ssid_pk_cache, tmp, strlen(tmp)+1, &value);
+
+  TRACE_BEGIN(CACHE_LOOKUP);
+  lruc_get(ssid_pk_cache, (void *)ssid, strlen(ssid)+1, &value);
+  TRACE_END(CACHE_LOOKUP);
+  metrics_add(value ? METRIC_SSID_CACHE_HITS : METRIC_SSID_CACHE_MISSES, 1);
   if (value == NULL) {
-    ssid_id = insert_ssid(tmp, db);
+    ssid_id = insert_ssid(ssid, db);
     // add the ssid_id to the cache
     int64_t *new_value = malloc(sizeof(int64_t));
     *new_value = ssid_id;
-    lruc_set(ssid_pk_cache, strdup(tmp), strlen(tmp)+1, new_value, sizeof(int64_t));
+    lruc_set(ssid_pk_cache, strdup(ssid), strlen(ssid)+1, new_value, sizeof(int64_t));
   } else {
     ssid_id = *(int64_t *)value;
   }
 
+  return ssid_id;
+}
+
+// look up (or insert) the ssid and mac of a probe request and return their ids
+static void lookup_probereq_ids(probereq_t pr, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_pk_cache,
+  bloom_t *mac_filter, int64_t *mac_id, int64_t *ssid_id)
+{
+  int64_t vendor_id;
+
+  // ssid_str was computed once by the logger thread
+  *ssid_id = lookup_ssid_id(pr.ssid_str, db, ssid_pk_cache);
+
   // look up mac in mac_pk_cache
-  value = NULL;
+  void *value = NULL;
+  TRACE_BEGIN(CACHE_LOOKUP);
   lruc_get(mac_pk_cache, pr.mac, 18, &value);
+  TRACE_END(CACHE_LOOKUP);
+  metrics_add(value ? METRIC_MAC_CACHE_HITS : METRIC_MAC_CACHE_MISSES, 1);
   if (value == NULL) {
     vendor_id = insert_vendor(pr.vendor, db);
-    mac_id = insert_mac(pr.mac, vendor_id, db);
+    *mac_id = insert_mac(pr.mac, vendor_id, pr.fingerprint, mac_filter, db);
     // add the mac_id to the cache
     int64_t *new_value = malloc(sizeof(int64_t));
-    *new_value = mac_id;
+    *new_value = *mac_id;
     lruc_set(mac_pk_cache, strdup(pr.mac), 18, new_value, sizeof(int64_t));
   } else {
-    mac_id = *(int64_t *)value;
+    *mac_id = *(int64_t *)value;
   }
+}
+
+// id of a mac that was just written, from the cache most of the time
+int64_t lookup_mac_id(const char *mac, lruc *mac_pk_cache, sqlite3 *db)
+{
+  void *value = NULL;
+
+  lruc_get(mac_pk_cache, (void *)mac, 18, &value);
+  return value ? *(int64_t *)value : search_mac(mac, db);
+}
+
+// the sensor column of the rows, null for the local captures
+static void sensor_value(int64_t sensor_id, char *value, size_t size)
+{
+  if (sensor_id > 0) {
+    snprintf(value, size, "'%"PRId64"'", sensor_id);
+  } else {
+    snprintf(value, size, "null");
+  }
+}
+
+int insert_probereq(probereq_t pr, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_pk_cache, bloom_t *mac_filter,
+  int64_t sensor_id)
+{
+  int64_t ssid_id, mac_id;
+  int ret;
+  char sensor[24];
+
+  lookup_probereq_ids(pr, db, mac_pk_cache, ssid_pk_cache, mac_filter, &mac_id, &ssid_id);
 
   // convert timeval to double
   double ts;
@@ -310,17 +555,421 @@ int insert_probereq(probereq_t pr, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_p
   sprintf(tstmp, "%lu.%06lu", pr.tv.tv_sec, pr.tv.tv_usec);
   ts = strtod(tstmp, NULL);
 
+  sensor_value(sensor_id, sensor, sizeof(sensor));
+  char sql[256];
+  snprintf(sql, 256, "insert into probemon (date, mac, ssid, rssi, sensor)"
+    "values ('%f', '%"PRId64"', '%"PRId64"', '%d', %s);", ts, mac_id, ssid_id, pr.rssi, sensor);
+  TRACE_BEGIN(SQL_INSERT);
+  ret = sqlite3_exec(db, sql, NULL, 0, NULL);
+  TRACE_END(SQL_INSERT);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+
+  return 0;
+}
+
+int insert_probeburst(const probeburst_t *burst, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_pk_cache,
+  bloom_t *mac_filter, int64_t sensor_id)
+{
+  int64_t ssid_id, mac_id;
+  int ret;
+  char sensor[24];
+
+  lookup_probereq_ids(*burst->pr, db, mac_pk_cache, ssid_pk_cache, mac_filter, &mac_id, &ssid_id);
+
+  double first = burst->pr->tv.tv_sec + burst->pr->tv.tv_usec / 1e6;
+  double last = burst->last.tv_sec + burst->last.tv_usec / 1e6;
+  double rssi_mean = (double)burst->rssi_sum / burst->count;
+
+  sensor_value(sensor_id, sensor, sizeof(sensor));
+  char sql[384];
+  snprintf(sql, 384, "insert into probeburst (first, last, mac, ssid, count, rssi_min, rssi_max, rssi_mean, sensor)"
+    "values ('%f', '%f', '%"PRId64"', '%"PRId64"', '%u', '%d', '%d', '%.2f', %s);",
+    first, last, mac_id, ssid_id, burst->count, burst->rssi_min, burst->rssi_max, rssi_mean, sensor);
+  if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+
+  return 0;
+}
+
+// a probe request, or a burst of count of them from pr->tv to last, of a randomized mac,
+// with the mac inline: no mac nor vendor row, and no cache slot
+int insert_ephemeral(const probereq_t *pr, struct timeval last, uint32_t count, int rssi, lruc *ssid_pk_cache,
+  sqlite3 *db)
+{
+  int ret;
+
+  int64_t ssid_id = lookup_ssid_id(pr->ssid_str, db, ssid_pk_cache);
+  double first_ts = pr->tv.tv_sec + pr->tv.tv_usec / 1e6;
+  double last_ts = last.tv_sec + last.tv_usec / 1e6;
+
   char sql[256];
-  snprintf(sql, 256, "insert into probemon (date, mac, ssid, rssi)"
-    "values ('%f', '%"PRId64"', '%"PRId64"', '%d');", ts, mac_id, ssid_id, pr.rssi);
+  snprintf(sql, 256, "insert into ephemeral (first, last, mac, ssid, count, rssi, fingerprint)"
+    "values ('%f', '%f', '%"PRId64"', '%"PRId64"', '%u', '%d', '%"PRId64"');",
+    first_ts, last_ts, (int64_t)mac_to_uint64(pr->mac), ssid_id, count, rssi, (int64_t)pr->fingerprint);
+  TRACE_BEGIN(SQL_INSERT);
+  ret = sqlite3_exec(db, sql, NULL, 0, NULL);
+  TRACE_END(SQL_INSERT);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+  metrics_add(METRIC_EPHEMERAL_PROBES, 1);
+
+  return 0;
+}
+
+// delete the rows of the ephemeral table last seen before before (in s)
+// returns the number of rows deleted, or a negative error
+int64_t purge_ephemeral(int64_t before, sqlite3 *db)
+{
+  int ret;
+  char sql[128];
+
+  snprintf(sql, 128, "delete from ephemeral where last < %"PRId64";", before);
+  if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+
+  return sqlite3_changes(db);
+}
+
+// id of a sensor, added if it is new, and the seq of its last batch in the db
+// the name comes from the network: it is bound, never formatted into the sql
+int64_t insert_sensor(const char *name, sqlite3 *db, uint64_t *last_seq)
+{
+  sqlite3_stmt *stmt;
+  int64_t sensor_id = 0;
+  int ret;
+
+  *last_seq = 0;
+  if (sqlite3_prepare_v2(db, "insert or ignore into sensor (name, last_seq) values (?, 0);", -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    return -1;
+  }
+  sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+  ret = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (ret != SQLITE_DONE) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return -1;
+  }
+
+  if (sqlite3_prepare_v2(db, "select id, last_seq from sensor where name=?;", -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    return -1;
+  }
+  sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    sensor_id = sqlite3_column_int64(stmt, 0);
+    *last_seq = (uint64_t)sqlite3_column_int64(stmt, 1);
+  } else {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    sensor_id = -1;
+  }
+  sqlite3_finalize(stmt);
+
+  return sensor_id;
+}
+
+// in the same transaction as the rows of the batch
+int update_sensor_seq(int64_t sensor_id, uint64_t seq, sqlite3 *db)
+{
+  int ret;
+  char sql[128];
+
+  // sqlite integers are signed 64 bits
+  snprintf(sql, 128, "update sensor set last_seq='%"PRId64"' where id='%"PRId64"';", (int64_t)seq, sensor_id);
+  if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+
+  return 0;
+}
+
+// a sensor heard the probe request of row too, with a weaker rssi
+int insert_heard_by(int64_t row, int64_t sensor_id, int rssi, sqlite3 *db)
+{
+  int ret;
+  char sql[128];
+
+  snprintf(sql, 128, "insert into heard_by (probemon, sensor, rssi) values ('%"PRId64"', '%"PRId64"', '%d');",
+    row, sensor_id, rssi);
+  if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+
+  return 0;
+}
+
+// a sensor heard the probe request of row with a better rssi
+int update_probereq_sensor(int64_t row, int64_t sensor_id, int rssi, sqlite3 *db)
+{
+  int ret;
+  char sql[128];
+
+  snprintf(sql, 128, "update probemon set sensor='%"PRId64"', rssi='%d' where rowid='%"PRId64"';",
+    sensor_id, rssi, row);
+  if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+
+  return 0;
+}
+
+// start and end are in µs; returns the rowid of the session
+int64_t insert_session(int64_t mac_id, int64_t start, int64_t end, uint32_t count, int rssi_max, sqlite3 *db)
+{
+  int ret;
+  char sql[192];
+
+  snprintf(sql, 192, "insert into sessions (mac, start, end, count, rssi_max)"
+    "values ('%"PRId64"', '%"PRId64".%06"PRId64"', '%"PRId64".%06"PRId64"', '%u', '%d');",
+    mac_id, start / 1000000, start % 1000000, end / 1000000, end % 1000000, count, rssi_max);
+  if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return ret * -1;
+  }
+
+  return sqlite3_last_insert_rowid(db);
+}
+
+int update_session(int64_t row, int64_t start, int64_t end, uint32_t count, int rssi_max, sqlite3 *db)
+{
+  int ret;
+  char sql[192];
+
+  snprintf(sql, 192, "update sessions set start='%"PRId64".%06"PRId64"', end='%"PRId64".%06"PRId64"', "
+    "count='%u', rssi_max='%d' where rowid='%"PRId64"';",
+    start / 1000000, start % 1000000, end / 1000000, end % 1000000, count, rssi_max, row);
   if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
     fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
     return ret * -1;
   }
 
   return 0;
 }
 
+// merge the sketch of the db, if any, into h
+int load_unique_sketch(int32_t granularity, int64_t start, int dimension, const char *value, hll_t *h, sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  int ret = 0;
+
+  if (sqlite3_prepare_v2(db, "select sketch from uniques where granularity=? and start=? and dimension=? and value=?;",
+      -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    return -1;
+  }
+  sqlite3_bind_int(stmt, 1, granularity);
+  sqlite3_bind_int64(stmt, 2, start);
+  sqlite3_bind_int(stmt, 3, dimension);
+  sqlite3_bind_text(stmt, 4, value, -1, SQLITE_STATIC);
+  switch (sqlite3_step(stmt)) {
+    case SQLITE_ROW:
+      if (hll_deserialize(h, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0))) {
+        // overwritten by the sketch in memory
+        fprintf(stderr, "Warning: malformed sketch in the uniques table\n");
+      }
+      break;
+    case SQLITE_DONE:
+      break;
+    default:
+      fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+      metrics_add(METRIC_DB_ERRORS, 1);
+      ret = -1;
+  }
+  sqlite3_finalize(stmt);
+
+  return ret;
+}
+
+int save_unique_sketch(int32_t granularity, int64_t start, int dimension, const char *value, const hll_t *h, sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  uint8_t buf[HLL_MAX_SERIALIZED];
+  int ret;
+
+  size_t len = hll_serialize(h, buf);
+  if (sqlite3_prepare_v2(db, "insert or replace into uniques (granularity, start, dimension, value, sketch) "
+      "values (?, ?, ?, ?, ?);", -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    return -1;
+  }
+  sqlite3_bind_int(stmt, 1, granularity);
+  sqlite3_bind_int64(stmt, 2, start);
+  sqlite3_bind_int(stmt, 3, dimension);
+  sqlite3_bind_text(stmt, 4, value, -1, SQLITE_STATIC);
+  sqlite3_bind_blob(stmt, 5, buf, len, SQLITE_STATIC);
+  ret = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (ret != SQLITE_DONE) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return -1;
+  }
+
+  return 0;
+}
+
+// id of the newest mac, or -1
+static int64_t last_mac_id(sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  int64_t id = -1;
+
+  if (sqlite3_prepare_v2(db, "select coalesce(max(id), 0) from mac;", -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    return -1;
+  }
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    id = sqlite3_column_int64(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+  return id;
+}
+
+// a filter of every mac of the mac table, sized for twice as many
+bloom_t *build_mac_filter(sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  int64_t count = 0;
+
+  if (sqlite3_prepare_v2(db, "select count(*) from mac;", -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    return NULL;
+  }
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    count = sqlite3_column_int64(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+
+  uint64_t capacity = count * 2 > MAC_FILTER_MIN_CAPACITY ? count * 2 : MAC_FILTER_MIN_CAPACITY;
+  double fpr = MAC_FILTER_FPR;
+  size_t share = budget_share(BUDGET_MAC_FILTER);
+  if (share) {
+    // within its share of the memory budget, more false positives
+    double fpr_min = exp(-(double)share * 8 / capacity * M_LN2 * M_LN2);
+    if (fpr_min > MAC_FILTER_MAX_FPR) {
+      fprintf(stderr, "Warning: the filter of the known macs doesn't fit in %zu KiB, it is disabled\n", share / 1024);
+      return NULL;
+    }
+    if (fpr_min > fpr) {
+      fpr = fpr_min;
+    }
+  }
+  bloom_t *filter = bloom_new(capacity, fpr);
+  if (filter == NULL) {
+    return NULL;
+  }
+  if (sqlite3_prepare_v2(db, "select address from mac;", -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    bloom_free(filter);
+    return NULL;
+  }
+  int ret;
+  while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *address = (const char *)sqlite3_column_text(stmt, 0);
+    if (address) {
+      bloom_add(filter, mac_to_uint64(address));
+    }
+  }
+  sqlite3_finalize(stmt);
+  if (ret != SQLITE_DONE) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    bloom_free(filter);
+    return NULL;
+  }
+
+  return filter;
+}
+
+// the filter saved on exit, if no mac was added since, or else a new one
+bloom_t *load_mac_filter(sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  bloom_t *filter = NULL;
+
+  if (sqlite3_prepare_v2(db, "select last_mac, capacity, count, hashes, bits from mac_filter;",
+      -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    return NULL;
+  }
+  size_t share = budget_share(BUDGET_MAC_FILTER);
+  if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int64(stmt, 0) == last_mac_id(db)
+    && sqlite3_column_int64(stmt, 2) <= sqlite3_column_int64(stmt, 1)
+    && (share == 0 || (size_t)sqlite3_column_bytes(stmt, 4) <= share)) {
+    filter = bloom_load(sqlite3_column_int64(stmt, 1), sqlite3_column_int64(stmt, 2), sqlite3_column_int(stmt, 3),
+      sqlite3_column_blob(stmt, 4), sqlite3_column_bytes(stmt, 4));
+  }
+  sqlite3_finalize(stmt);
+
+  return filter ? filter : build_mac_filter(db);
+}
+
+// past its capacity, the false positive rate of the filter climbs: it is rebuilt
+// twice as big; returns the filter to use from then on
+bloom_t *update_mac_filter(bloom_t *filter, sqlite3 *db)
+{
+  if (filter && filter->count > filter->capacity) {
+    bloom_free(filter);
+    filter = build_mac_filter(db);
+  }
+  if (filter) {
+    metrics_set(GAUGE_MAC_FILTER_BYTES, bloom_memory(filter));
+    metrics_set(GAUGE_MAC_FILTER_FPR, bloom_fpr(filter) * 1e6);
+  }
+  return filter;
+}
+
+// with the transaction opened
+int save_mac_filter(const bloom_t *filter, sqlite3 *db)
+{
+  sqlite3_stmt *stmt;
+  int ret;
+
+  if (sqlite3_exec(db, "delete from mac_filter;", NULL, 0, NULL) != SQLITE_OK
+    || sqlite3_prepare_v2(db, "insert into mac_filter (last_mac, capacity, count, hashes, bits) values (?, ?, ?, ?, ?);",
+      -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return -1;
+  }
+  sqlite3_bind_int64(stmt, 1, last_mac_id(db));
+  sqlite3_bind_int64(stmt, 2, filter->capacity);
+  sqlite3_bind_int64(stmt, 3, filter->count);
+  sqlite3_bind_int(stmt, 4, filter->hashes);
+  sqlite3_bind_blob64(stmt, 5, filter->bits, filter->size / 8, SQLITE_STATIC);
+  ret = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (ret != SQLITE_DONE) {
+    fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
+    return -1;
+  }
+
+  return 0;
+}
+
 int begin_txn(sqlite3 *db)
 {
   int ret;
@@ -329,6 +978,7 @@ int begin_txn(sqlite3 *db)
   snprintf(sql, 32, "begin transaction;");
   if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
     fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
     return ret * -1;
   }
 
@@ -341,10 +991,13 @@ int commit_txn(sqlite3 *db)
   char sql[32];
 
   snprintf(sql, 32, "commit transaction;");
+  uint64_t start = metrics_now();
   if ((ret = sqlite3_exec(db, sql, NULL, 0, NULL)) != SQLITE_OK) {
     fprintf(stderr, "Error: %s (%s:%d in %s)\n", sqlite3_errmsg(db), basename(__FILE__), __LINE__, __func__);
+    metrics_add(METRIC_DB_ERRORS, 1);
     return ret * -1;
   }
+  metrics_observe(HISTOGRAM_COMMIT, metrics_now() - start);
 
   return 0;
 }
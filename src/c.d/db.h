@@ -3,18 +3,41 @@
 
 #include <sqlite3.h>
 #include "lruc.h"
+#include "logger_thread.h"
+#include "coalesce.h"
+#include "hll.h"
+#include "bloom.h"
 
 // to avoid SD-card wear, we avoid writing to disk every seconds, setting a delay between each transactions
 #define DB_CACHE_TIME 60    // time in second between transaction
 
 int init_probemon_db(const char *db_file, sqlite3 **db);
-int search_ssid(const char *ssid, sqlite3 *db);
-int insert_ssid(const char *ssid, sqlite3 *db);
-int search_vendor(const char *vendor, sqlite3 *db);
-int insert_vendor(const char *vendor, sqlite3 *db);
-int search_mac(const char *mac, sqlite3 *db);
-int insert_mac(const char *mac, int vendor_id, sqlite3 *db);
-int insert_probereq(probereq_t pr, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_pk_cache);
+int64_t search_ssid(const char *ssid, sqlite3 *db);
+int64_t insert_ssid(const char *ssid, sqlite3 *db);
+int64_t search_vendor(const char *vendor, sqlite3 *db);
+int64_t insert_vendor(const char *vendor, sqlite3 *db);
+int64_t search_mac(const char *mac, sqlite3 *db);
+int64_t insert_mac(const char *mac, int64_t vendor_id, uint64_t fingerprint, bloom_t *mac_filter, sqlite3 *db);
+int64_t lookup_mac_id(const char *mac, lruc *mac_pk_cache, sqlite3 *db);
+int insert_probereq(probereq_t pr, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_pk_cache, bloom_t *mac_filter,
+  int64_t sensor_id);
+int insert_probeburst(const probeburst_t *burst, sqlite3 *db, lruc *mac_pk_cache, lruc *ssid_pk_cache,
+  bloom_t *mac_filter, int64_t sensor_id);
+int insert_ephemeral(const probereq_t *pr, struct timeval last, uint32_t count, int rssi, lruc *ssid_pk_cache,
+  sqlite3 *db);
+int64_t purge_ephemeral(int64_t before, sqlite3 *db);
+int64_t insert_sensor(const char *name, sqlite3 *db, uint64_t *last_seq);
+int update_sensor_seq(int64_t sensor_id, uint64_t seq, sqlite3 *db);
+int insert_heard_by(int64_t row, int64_t sensor_id, int rssi, sqlite3 *db);
+int update_probereq_sensor(int64_t row, int64_t sensor_id, int rssi, sqlite3 *db);
+int64_t insert_session(int64_t mac_id, int64_t start, int64_t end, uint32_t count, int rssi_max, sqlite3 *db);
+int update_session(int64_t row, int64_t start, int64_t end, uint32_t count, int rssi_max, sqlite3 *db);
+int load_unique_sketch(int32_t granularity, int64_t start, int dimension, const char *value, hll_t *h, sqlite3 *db);
+int save_unique_sketch(int32_t granularity, int64_t start, int dimension, const char *value, const hll_t *h, sqlite3 *db);
+bloom_t *build_mac_filter(sqlite3 *db);
+bloom_t *load_mac_filter(sqlite3 *db);
+bloom_t *update_mac_filter(bloom_t *filter, sqlite3 *db);
+int save_mac_filter(const bloom_t *filter, sqlite3 *db);
 int begin_txn(sqlite3 *db);
 int commit_txn(sqlite3 *db);
 
@@ -0,0 +1,65 @@
+/*
+a probe request is heard by every sensor in range: the same frame, with the
+same mac and 802.11 sequence number, reaches the collector once per sensor,
+with timestamps apart by the offset between their clocks. The collector keeps
+the probe requests of the last few seconds here, to merge the copies into the
+row of the first one.
+*/
+
+#include <stdlib.h>
+
+#include "dedup.h"
+#include "config.h"
+
+// size is rounded down to a multiple of DEDUP_WAYS, tolerance is in ms
+dedup_t *dedup_new(uint32_t size, uint32_t tolerance)
+{
+  dedup_t *d = malloc(sizeof(dedup_t));
+  if (d == NULL) {
+    return NULL;
+  }
+  d->sets = size / DEDUP_WAYS;
+  d->tolerance = (uint64_t)tolerance * 1000;
+  if (d->sets == 0 || (d->entries = calloc((size_t)d->sets * DEDUP_WAYS, sizeof(struct dedup_entry))) == NULL) {
+    free(d);
+    return NULL;
+  }
+  return d;
+}
+
+// the entry of the probe request with this mac and seq, heard within the tolerance of
+// time; if there is none, found is false and the entry returned is the one to replace
+struct dedup_entry *dedup_find(dedup_t *d, uint64_t mac, uint16_t seq, uint64_t time, bool *found)
+{
+  // the 48 bits of the mac and the 12 of the seq fit in the key: the high bits of the
+  // product depend on all of them
+  uint64_t h = (mac << 12 | (seq & 0xfff)) * 0x9e3779b97f4a7c15ULL;
+  struct dedup_entry *set = d->entries + (h >> 32) % d->sets * DEDUP_WAYS;
+  struct dedup_entry *oldest = set;
+
+  for (int i = 0; i < DEDUP_WAYS; i++) {
+    struct dedup_entry *e = set + i;
+    if (e->row && e->mac == mac && e->seq == seq
+      && (e->time > time ? e->time - time : time - e->time) <= d->tolerance) {
+      *found = true;
+      return e;
+    }
+    if (e->row == 0) {
+      // never used: nothing older
+      oldest = e;
+      break;
+    }
+    if (e->time < oldest->time) {
+      oldest = e;
+    }
+  }
+  *found = false;
+  return oldest;
+}
+
+void dedup_free(dedup_t *d)
+{
+  if (d == NULL) return;
+  free(d->entries);
+  free(d);
+}
@@ -0,0 +1,29 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a probe request already inserted by the collector
+struct dedup_entry {
+  uint64_t mac;
+  uint64_t time;      // in µs
+  int64_t row;        // rowid in the probemon table
+  int32_t sensor;     // index of the sensor with the best rssi so far
+  int16_t rssi;
+  uint16_t seq;
+};
+
+// the probe requests inserted lately, in a fixed size set associative table: when
+// a set is full, the oldest probe request is forgotten
+typedef struct dedup {
+  struct dedup_entry *entries;
+  uint32_t sets;
+  uint64_t tolerance;   // in µs
+} dedup_t;
+
+dedup_t *dedup_new(uint32_t size, uint32_t tolerance);
+struct dedup_entry *dedup_find(dedup_t *d, uint64_t mac, uint16_t seq, uint64_t time, bool *found);
+void dedup_free(dedup_t *d);
+
+#endif
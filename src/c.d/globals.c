@@ -0,0 +1,30 @@
+/*
+state of the pipeline shared by the capture, the workers and the writer, in
+the library so that probemon.c and the benchmarks set it up rather than define it
+*/
+
+#include "globals.h"
+
+pcap_t *handle;
+sqlite3 *db = NULL;
+
+bool option_stdout = false;
+enum output_format option_format = OUTPUT_TEXT;
+uint32_t option_coalesce = 0;
+int option_ephemeral = 0;
+lruc_policy option_cache_policy = LRUC_LRU;
+
+size_t ouidb_size;
+manuf_t *ouidb;
+uint64_t *ignored = NULL;
+int ignored_count = 0;
+uint64_t *known = NULL;
+int known_count = 0;
+
+stream_t *stream = NULL;
+dashboard_t *dashboard = NULL;
+series_store_t *series = NULL;
+session_store_t *sessions = NULL;
+unique_store_t *uniques = NULL;
+topk_store_t *topk = NULL;
+uplink_t *uplink = NULL;
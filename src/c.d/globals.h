@@ -0,0 +1,46 @@
+#ifndef GLOBALS_H
+#define GLOBALS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pcap/pcap.h>
+#include <sqlite3.h>
+
+#include "manuf.h"
+#include "output.h"
+#include "lruc.h"
+#include "stream.h"
+#include "dashboard.h"
+#include "series.h"
+#include "session.h"
+#include "uniques.h"
+#include "topk.h"
+#include "uplink.h"
+
+// set up by main() (or a benchmark), read by the capture, the workers and the writer
+extern pcap_t *handle;
+extern sqlite3 *db;
+
+extern bool option_stdout;
+extern enum output_format option_format;
+extern uint32_t option_coalesce;
+extern int option_ephemeral;
+extern lruc_policy option_cache_policy;
+
+extern manuf_t *ouidb;
+extern size_t ouidb_size;
+extern uint64_t *ignored;
+extern int ignored_count;
+extern uint64_t *known;
+extern int known_count;
+
+extern stream_t *stream;
+extern dashboard_t *dashboard;
+extern series_store_t *series;
+extern session_store_t *sessions;
+extern unique_store_t *uniques;
+extern topk_store_t *topk;
+extern uplink_t *uplink;
+
+#endif
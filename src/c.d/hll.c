@@ -0,0 +1,200 @@
+/*
+HyperLogLog (Flajolet et al., 2007) to count the distinct macs of a period
+with bounded memory: the first HLL_PRECISION bits of the hash of a mac choose
+a register, that keeps the longest run of leading zeros seen in the rest.
+Most sketches (an ssid, a vendor) hold a few macs: they start sparse, with
+only the registers set, and turn dense past HLL_SPARSE_MAX of them.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hll.h"
+#include "config.h"
+
+void hll_init(hll_t *h)
+{
+  memset(h, 0, sizeof(hll_t));
+}
+
+static int to_dense(hll_t *h)
+{
+  if ((h->dense = calloc(HLL_REGISTERS, 1)) == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < h->sparse_count; i++) {
+    h->dense[h->sparse[i] >> 8] = h->sparse[i] & 0xff;
+  }
+  free(h->sparse);
+  h->sparse = NULL;
+  h->sparse_count = 0;
+  h->sparse_size = 0;
+  return 0;
+}
+
+// keep the max of the register and value
+static int set_register(hll_t *h, uint32_t indx, uint8_t value)
+{
+  if (h->dense) {
+    if (value > h->dense[indx]) {
+      h->dense[indx] = value;
+    }
+    return 0;
+  }
+
+  for (int i = 0; i < h->sparse_count; i++) {
+    if (h->sparse[i] >> 8 == indx) {
+      if (value > (h->sparse[i] & 0xff)) {
+        h->sparse[i] = indx << 8 | value;
+      }
+      return 0;
+    }
+  }
+  if (h->sparse_count == HLL_SPARSE_MAX) {
+    if (to_dense(h)) {
+      return -1;
+    }
+    h->dense[indx] = value;
+    return 0;
+  }
+  if (h->sparse_count == h->sparse_size) {
+    uint16_t size = h->sparse_size ? h->sparse_size * 2 : 8;
+    uint32_t *sparse = realloc(h->sparse, size * sizeof(uint32_t));
+    if (sparse == NULL) {
+      return -1;
+    }
+    h->sparse = sparse;
+    h->sparse_size = size;
+  }
+  h->sparse[h->sparse_count++] = indx << 8 | value;
+  return 0;
+}
+
+int hll_add(hll_t *h, uint64_t hash)
+{
+  uint32_t indx = hash >> (64 - HLL_PRECISION);
+  uint64_t rest = hash << HLL_PRECISION;
+  // position of the first 1 in the 64 - HLL_PRECISION bits left
+  uint8_t value = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_PRECISION + 1;
+  return set_register(h, indx, value);
+}
+
+int hll_merge(hll_t *dst, const hll_t *src)
+{
+  if (src->dense) {
+    if (dst->dense == NULL && to_dense(dst)) {
+      return -1;
+    }
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+      if (src->dense[i] > dst->dense[i]) {
+        dst->dense[i] = src->dense[i];
+      }
+    }
+    return 0;
+  }
+  for (int i = 0; i < src->sparse_count; i++) {
+    if (set_register(dst, src->sparse[i] >> 8, src->sparse[i] & 0xff)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+double hll_count(const hll_t *h)
+{
+  double m = HLL_REGISTERS, sum = 0;
+  int zeros = 0;
+
+  if (h->dense) {
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+      sum += ldexp(1.0, -h->dense[i]);
+      zeros += h->dense[i] == 0;
+    }
+  } else {
+    zeros = HLL_REGISTERS - h->sparse_count;
+    sum = zeros;
+    for (int i = 0; i < h->sparse_count; i++) {
+      sum += ldexp(1.0, -(int)(h->sparse[i] & 0xff));
+    }
+  }
+
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (estimate <= 2.5 * m && zeros > 0) {
+    // linear counting is more accurate for the small sets
+    estimate = m * log(m / zeros);
+  }
+  return estimate;
+}
+
+size_t hll_memory(const hll_t *h)
+{
+  return h->dense ? HLL_REGISTERS : h->sparse_size * sizeof(uint32_t);
+}
+
+// buf holds HLL_MAX_SERIALIZED bytes; returns the length written
+size_t hll_serialize(const hll_t *h, uint8_t *buf)
+{
+  size_t n = 0;
+
+  if (h->dense == NULL && 4 + 3 * h->sparse_count < 2 + HLL_REGISTERS) {
+    buf[n++] = HLL_SPARSE;
+    buf[n++] = HLL_PRECISION;
+    buf[n++] = h->sparse_count;
+    buf[n++] = h->sparse_count >> 8;
+    for (int i = 0; i < h->sparse_count; i++) {
+      uint32_t indx = h->sparse[i] >> 8;
+      buf[n++] = indx;
+      buf[n++] = indx >> 8;
+      buf[n++] = h->sparse[i] & 0xff;
+    }
+    return n;
+  }
+
+  buf[n++] = HLL_DENSE;
+  buf[n++] = HLL_PRECISION;
+  if (h->dense) {
+    memcpy(buf + n, h->dense, HLL_REGISTERS);
+  } else {
+    memset(buf + n, 0, HLL_REGISTERS);
+    for (int i = 0; i < h->sparse_count; i++) {
+      buf[n + (h->sparse[i] >> 8)] = h->sparse[i] & 0xff;
+    }
+  }
+  return n + HLL_REGISTERS;
+}
+
+// merge a serialized sketch into h
+// returns 0 on success, -1 if it is malformed
+int hll_deserialize(hll_t *h, const uint8_t *buf, size_t len)
+{
+  if (len < 2 || buf[1] != HLL_PRECISION) {
+    return -1;
+  }
+  if (buf[0] == HLL_DENSE && len == 2 + HLL_REGISTERS) {
+    hll_t src = { .dense = (uint8_t *)buf + 2 };
+    return hll_merge(h, &src);
+  }
+  if (buf[0] != HLL_SPARSE || len < 4) {
+    return -1;
+  }
+  size_t count = buf[2] | buf[3] << 8;
+  if (len != 4 + 3 * count) {
+    return -1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *r = buf + 4 + 3 * i;
+    uint32_t indx = r[0] | r[1] << 8;
+    if (indx >= HLL_REGISTERS || set_register(h, indx, r[2])) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void hll_clear(hll_t *h)
+{
+  free(h->dense);
+  free(h->sparse);
+  hll_init(h);
+}
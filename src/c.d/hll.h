@@ -0,0 +1,47 @@
+#ifndef HLL_H
+#define HLL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HLL_PRECISION 12
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+// serialized: format (u8), precision (u8), then for a sparse sketch the number of
+// registers set (u16) and each as index (u16) and value (u8), or for a dense one
+// the HLL_REGISTERS registers
+#define HLL_SPARSE 1
+#define HLL_DENSE 2
+#define HLL_MAX_SERIALIZED (2 + HLL_REGISTERS)
+
+// HyperLogLog sketch of a set of macs: kept as a list of the registers set while
+// there are few of them, then as the full array of registers. Two sketches of the
+// same period, or of two periods, merge into the sketch of their union.
+typedef struct hll {
+  uint8_t *dense;       // NULL while sparse
+  uint32_t *sparse;     // index << 8 | value
+  uint16_t sparse_count;
+  uint16_t sparse_size;
+} hll_t;
+
+void hll_init(hll_t *h);
+int hll_add(hll_t *h, uint64_t hash);
+int hll_merge(hll_t *dst, const hll_t *src);
+double hll_count(const hll_t *h);
+size_t hll_memory(const hll_t *h);
+size_t hll_serialize(const hll_t *h, uint8_t *buf);
+int hll_deserialize(hll_t *h, const uint8_t *buf, size_t len);
+void hll_clear(hll_t *h);
+
+// the hash of a mac (as returned by mac_to_uint64), the same for every sensor
+static inline uint64_t hll_hash(uint64_t mac)
+{
+  // finalizer of splitmix64
+  mac ^= mac >> 30;
+  mac *= 0xbf58476d1ce4e5b9ULL;
+  mac ^= mac >> 27;
+  mac *= 0x94d049bb133111ebULL;
+  return mac ^ (mac >> 31);
+}
+
+#endif
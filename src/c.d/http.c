@@ -0,0 +1,373 @@
+/*
+minimal HTTP/1.0 server, bound to localhost by default, serving GET requests
+from handlers registered for fixed paths. It runs its own poll loop in a
+dedicated thread; each connection is closed once its response is sent.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "http.h"
+
+// ------------------------------------------
+// responses
+// ------------------------------------------
+void http_append(http_response_t *resp, const char *data, size_t len)
+{
+  if (resp->len + len + 1 > resp->size) {
+    size_t size = resp->size ? resp->size : 1024;
+    while (resp->len + len + 1 > size) {
+      size *= 2;
+    }
+    resp->body = realloc(resp->body, size);
+    resp->size = size;
+  }
+  memcpy(resp->body + resp->len, data, len);
+  resp->len += len;
+  resp->body[resp->len] = '\0';
+}
+
+void http_printf(http_response_t *resp, const char *fmt, ...)
+{
+  char tmp[512];
+  va_list ap;
+
+  va_start(ap, fmt);
+  int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    return;
+  }
+  if ((size_t)n < sizeof(tmp)) {
+    http_append(resp, tmp, n);
+    return;
+  }
+  char *big = malloc(n + 1);
+  va_start(ap, fmt);
+  vsnprintf(big, n + 1, fmt, ap);
+  va_end(ap);
+  http_append(resp, big, n);
+  free(big);
+}
+
+void http_append_json_str(http_response_t *resp, const char *s)
+{
+  http_append(resp, "\"", 1);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      char esc[2] = { '\\', c };
+      http_append(resp, esc, 2);
+    } else if (c < 0x20) {
+      http_printf(resp, "\\u%04x", c);
+    } else {
+      http_append(resp, (const char *)&c, 1);
+    }
+  }
+  http_append(resp, "\"", 1);
+}
+
+static int hexval(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// look for the next parameter name in query; its url-decoded value is copied in value
+// returns the position after it, to look for the next one, or NULL if not found
+const char *http_query_next(const char *query, const char *name, char *value, size_t size)
+{
+  size_t name_len = strlen(name);
+  const char *p = query;
+
+  while (p && *p) {
+    const char *end = strchr(p, '&');
+    if (end == NULL) {
+      end = p + strlen(p);
+    }
+    if (strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+      size_t n = 0;
+      for (const char *v = p + name_len + 1; v < end && n + 1 < size; v++) {
+        if (*v == '+') {
+          value[n++] = ' ';
+        } else if (*v == '%' && v + 2 < end + 1 && hexval(v[1]) >= 0 && hexval(v[2]) >= 0) {
+          value[n++] = hexval(v[1]) << 4 | hexval(v[2]);
+          v += 2;
+        } else {
+          value[n++] = *v;
+        }
+      }
+      value[n] = '\0';
+      return *end ? end + 1 : end;
+    }
+    p = *end ? end + 1 : NULL;
+  }
+  return NULL;
+}
+
+// local date of the query parameters, in the same format as the flask app
+int http_parse_date(const char *s, double *date)
+{
+  struct tm tm;
+  int end = 0;
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+      &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &end) != 6 || s[end] != '\0') {
+    return -1;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  *date = mktime(&tm);
+  return 0;
+}
+
+static const char *status_text(int status)
+{
+  switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    default: return "Internal Server Error";
+  }
+}
+
+// ------------------------------------------
+// server
+// ------------------------------------------
+static void close_conn(struct http_conn *c)
+{
+  close(c->fd);
+  free(c->resp);
+  c->fd = -1;
+  c->resp = NULL;
+  c->req_len = 0;
+}
+
+static void handle_request(http_server_t *server, struct http_conn *c)
+{
+  http_response_t resp = { .status = 200, .content_type = "application/json" };
+  char method[8], target[1024];
+
+  c->req[c->req_len] = '\0';
+  if (sscanf(c->req, "%7s %1023s", method, target) != 2) {
+    resp.status = 400;
+  } else if (strcmp(method, "GET")) {
+    resp.status = 405;
+  } else {
+    char *query = strchr(target, '?');
+    if (query) {
+      *query++ = '\0';
+    } else {
+      query = "";
+    }
+    resp.status = 404;
+    for (int i = 0; i < server->routes_count; i++) {
+      if (strcmp(server->routes[i].path, target) == 0) {
+        resp.status = 200;
+        server->routes[i].handler(query, &resp, server->routes[i].data);
+        break;
+      }
+    }
+  }
+  if (resp.status != 200 && resp.len == 0) {
+    resp.content_type = "application/json";
+    http_printf(&resp, "{\"status\": \"error\", \"message\": \"%s\"}", status_text(resp.status));
+  }
+
+  char head[256];
+  int n = snprintf(head, sizeof(head), "HTTP/1.0 %d %s\r\nContent-Type: %s\r\n"
+    "Content-Length: %zu\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+    resp.status, status_text(resp.status), resp.content_type, resp.len);
+  c->resp = malloc(n + resp.len);
+  memcpy(c->resp, head, n);
+  if (resp.len) {
+    memcpy(c->resp + n, resp.body, resp.len);
+  }
+  c->resp_len = n + resp.len;
+  c->resp_sent = 0;
+  free(resp.body);
+}
+
+static void *run_server(void *args)
+{
+  http_server_t *server = (http_server_t *)args;
+  struct pollfd fds[HTTP_MAX_CONNECTIONS + 2];
+  int idx[HTTP_MAX_CONNECTIONS + 2];
+
+  while (true) {
+    int n = 0;
+    fds[n].fd = server->wake_fd[0];
+    fds[n++].events = POLLIN;
+    fds[n].fd = server->listen_fd;
+    fds[n++].events = POLLIN;
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+      if (server->conns[i].fd >= 0) {
+        idx[n] = i;
+        fds[n].fd = server->conns[i].fd;
+        fds[n++].events = server->conns[i].resp ? POLLOUT : POLLIN;
+      }
+    }
+
+    if (poll(fds, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      int fd = accept(server->listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        int i = 0;
+        while (i < HTTP_MAX_CONNECTIONS && server->conns[i].fd >= 0) i++;
+        if (i == HTTP_MAX_CONNECTIONS) {
+          close(fd);
+        } else {
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+          server->conns[i].fd = fd;
+        }
+      }
+    }
+
+    for (int k = 2; k < n; k++) {
+      struct http_conn *c = &server->conns[idx[k]];
+      if (fds[k].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        close_conn(c);
+      } else if (fds[k].revents & POLLIN) {
+        ssize_t r = recv(c->fd, c->req + c->req_len, HTTP_MAX_REQUEST - 1 - c->req_len, 0);
+        if (r <= 0) {
+          close_conn(c);
+          continue;
+        }
+        c->req_len += r;
+        c->req[c->req_len] = '\0';
+        // we only need the request line and wait for the end of the headers
+        if (strstr(c->req, "\r\n\r\n") || strstr(c->req, "\n\n") || c->req_len == HTTP_MAX_REQUEST - 1) {
+          handle_request(server, c);
+        }
+      } else if (fds[k].revents & POLLOUT) {
+        ssize_t w = send(c->fd, c->resp + c->resp_sent, c->resp_len - c->resp_sent, MSG_NOSIGNAL);
+        if (w < 0) {
+          if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_conn(c);
+          }
+          continue;
+        }
+        c->resp_sent += w;
+        if (c->resp_sent == c->resp_len) {
+          close_conn(c);
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+// address is [HOST:]PORT; HOST defaults to localhost
+http_server_t *http_new(const char *address)
+{
+  char host[256] = "127.0.0.1";
+  const char *port = address;
+  const char *colon = strrchr(address, ':');
+  if (colon) {
+    size_t len = colon - address;
+    if (len >= sizeof(host)) {
+      fprintf(stderr, "Error: invalid http address %s\n", address);
+      return NULL;
+    }
+    memcpy(host, address, len);
+    host[len] = '\0';
+    port = colon + 1;
+  }
+
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE }, *res;
+  int err;
+  if ((err = getaddrinfo(host, port, &hints, &res))) {
+    fprintf(stderr, "Error: invalid http address %s: %s\n", address, gai_strerror(err));
+    return NULL;
+  }
+
+  http_server_t *server = calloc(1, sizeof(http_server_t));
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+    server->conns[i].fd = -1;
+  }
+
+  server->listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  int on = 1;
+  if (server->listen_fd < 0
+    || setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0
+    || bind(server->listen_fd, res->ai_addr, res->ai_addrlen) < 0
+    || listen(server->listen_fd, 16) < 0) {
+    fprintf(stderr, "Error: can't listen on %s: %s\n", address, strerror(errno));
+    if (server->listen_fd >= 0) close(server->listen_fd);
+    freeaddrinfo(res);
+    free(server);
+    return NULL;
+  }
+  freeaddrinfo(res);
+
+  if (pipe(server->wake_fd) < 0) {
+    perror("Error: can't create pipe");
+    close(server->listen_fd);
+    free(server);
+    return NULL;
+  }
+
+  return server;
+}
+
+int http_route(http_server_t *server, const char *path, http_handler handler, void *data)
+{
+  if (server->routes_count == HTTP_MAX_ROUTES) {
+    return -1;
+  }
+  server->routes[server->routes_count].path = path;
+  server->routes[server->routes_count].handler = handler;
+  server->routes[server->routes_count].data = data;
+  server->routes_count++;
+  return 0;
+}
+
+int http_start(http_server_t *server)
+{
+  if (pthread_create(&server->thread, NULL, run_server, server)) {
+    fprintf(stderr, "Error creating http thread\n");
+    return -1;
+  }
+  return 0;
+}
+
+void http_free(http_server_t *server)
+{
+  if (server == NULL) return;
+
+  char c = 'q';
+  if (write(server->wake_fd[1], &c, 1) == 1) {
+    pthread_join(server->thread, NULL);
+  }
+  for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+    if (server->conns[i].fd >= 0) {
+      close_conn(&server->conns[i]);
+    }
+  }
+  close(server->listen_fd);
+  close(server->wake_fd[0]);
+  close(server->wake_fd[1]);
+  free(server);
+}
@@ -0,0 +1,57 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "config.h"
+
+typedef struct http_response {
+  int status;
+  const char *content_type;
+  char *body;
+  size_t len;
+  size_t size;
+} http_response_t;
+
+// handler of a GET request on a path; query is the part after '?' (or "")
+typedef void (*http_handler)(const char *query, http_response_t *resp, void *data);
+
+struct http_route {
+  const char *path;
+  http_handler handler;
+  void *data;
+};
+
+struct http_conn {
+  int fd;
+  char req[HTTP_MAX_REQUEST];
+  size_t req_len;
+  char *resp;
+  size_t resp_len;
+  size_t resp_sent;
+};
+
+// minimal HTTP/1.0 server running its own poll loop, for local dashboards and metrics
+typedef struct http_server {
+  int listen_fd;
+  int wake_fd[2];
+  pthread_t thread;
+  struct http_route routes[HTTP_MAX_ROUTES];
+  int routes_count;
+  struct http_conn conns[HTTP_MAX_CONNECTIONS];
+} http_server_t;
+
+http_server_t *http_new(const char *address);
+int http_route(http_server_t *server, const char *path, http_handler handler, void *data);
+int http_start(http_server_t *server);
+void http_free(http_server_t *server);
+
+void http_append(http_response_t *resp, const char *data, size_t len);
+void http_printf(http_response_t *resp, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void http_append_json_str(http_response_t *resp, const char *s);
+int http_parse_date(const char *s, double *date);
+const char *http_query_next(const char *query, const char *name, char *value, size_t size);
+
+#endif
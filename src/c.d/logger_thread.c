@@ -1,5 +1,9 @@
 /*
-worker thread that will process the queue filled by process_packet()
+enrichment workers that process the probe requests queued by process_packet():
+vendor lookup, ignore check, ssid encoding, stdout, stream and dashboard. The
+probe requests are sharded by mac, so that the probe requests of a mac are
+processed in order by the same worker, with its own coalescer, and each worker
+hands batches of them over to the db writer.
 */
 
 #include <pthread.h>
@@ -7,107 +11,289 @@ worker thread that will process the queue filled by process_packet()
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
-#include <sqlite3.h>
 #include <time.h>
 #include <stdbool.h>
 #include <unistd.h>
-#include <semaphore.h>
 
 #include "parsers.h"
 #include "queue.h"
 #include "logger_thread.h"
+#include "writer.h"
 #include "db.h"
 #include "manuf.h"
 #include "config_yaml.h"
-#include "lruc.h"
+#include "coalesce.h"
+#include "output.h"
+#include "stream.h"
+#include "dashboard.h"
+#include "series.h"
+#include "metrics.h"
+#include "pool.h"
+#include "budget.h"
+#include "trace.h"
+#include "globals.h"
 #include "config.h"
 
-extern pthread_mutex_t mutex_queue;
-extern queue_t *queue;
-extern sem_t queue_empty;
-extern sem_t queue_full;
-extern sqlite3 *db;
-struct timespec start_ts_cache;
-extern bool option_stdout;
+typedef struct worker {
+  char name[20];
+  pthread_t thread;
+  channel_t input;
+  write_batch_t *batch;     // being filled
+  coalescer_t *coalescer;
+  output_t output;
+} worker_t;
 
-extern manuf_t *ouidb;
-extern size_t ouidb_size;
+static worker_t workers[MAX_WORKERS];
+static int workers_count = 0;
+// queued instead of a probe request by flush_workers()
+static probereq_t flush_request;
+// workers yet to flush: the last one asks the writer to commit
+static int flushes_pending = 0;
+// probe requests in all the queues, for GAUGE_QUEUE_DEPTH
+static uint64_t queued = 0;
 
-extern uint64_t *ignored;
-extern int ignored_count;
+// the probe requests are allocated for each packet, and freed by the writer
+static pool_t probereq_pool = POOL_INITIALIZER("probereq", probereq_t);
 
-lruc *ssid_pk_cache = NULL, *mac_pk_cache = NULL;
+probereq_t *new_probereq(void)
+{
+  return pool_alloc(&probereq_pool);
+}
 
 void free_probereq(probereq_t *pr)
 {
-    if (pr == NULL) return;
-
-    free(pr->mac);
-    pr->mac = NULL;
-    free(pr->ssid);
-    pr->ssid = NULL;
-    if (pr->vendor) free(pr->vendor);
-    pr->vendor = NULL;
-    free(pr);
-    pr = NULL;
-    return;
+  pool_free(&probereq_pool, pr);
+}
+
+// hand the pending batch over to the writer
+static void submit_batch(worker_t *w)
+{
+  if (w->batch) {
+    writer_submit(w->batch);
+    w->batch = NULL;
+  }
+}
+
+static void add_item(worker_t *w, probereq_t *pr, probeburst_t *burst)
+{
+  if (w->batch == NULL) {
+    w->batch = new_write_batch();
+    if (w->batch == NULL) {
+      free_probeburst(burst);
+      free_probereq(pr);
+      return;
+    }
+  }
+  w->batch->items[w->batch->count].pr = pr;
+  w->batch->items[w->batch->count].burst = burst;
+  if (++w->batch->count == WRITER_BATCH_SIZE) {
+    submit_batch(w);
+  }
+}
+
+static void write_burst(probeburst_t *burst, void *data)
+{
+  add_item((worker_t *)data, NULL, burst);
 }
 
-void *process_queue(void *args)
+static void *process_queue(void *args)
 {
+  worker_t *w = (worker_t *)args;
   probereq_t *pr;
-  struct timespec now;
 
-  mac_pk_cache = lruc_new(MAC_CACHE_SIZE, 1);
-  ssid_pk_cache = lruc_new(SSID_CACHE_SIZE, 1);
+  if (option_stdout) {
+    output_init(&w->output, option_format, stdout);
+  }
+  if (option_coalesce) {
+    w->coalescer = coalesce_new(option_coalesce, write_burst, w);
+  }
 
-  clock_gettime(CLOCK_MONOTONIC, &start_ts_cache);
+  metrics_register(w->name);
+  TRACE_THREAD_START(w->name);
 
   while (true) {
-    sem_wait(&queue_empty);
-    pthread_mutex_lock(&mutex_queue);
-    pr = (probereq_t *) dequeue(queue);
-    pthread_mutex_unlock(&mutex_queue);
-    sem_post(&queue_full);
+    if (!channel_try_get(&w->input, (void **)&pr)) {
+      // nothing else to do for now: don't hold the pending batch back
+      submit_batch(w);
+      pr = (probereq_t *) channel_get(&w->input);
+    }
+
+    if (pr == NULL) {
+      // end of capture: write the pending bursts and stop
+      break;
+    }
+    if (pr == &flush_request) {
+      // even without new probe requests, the bursts over end and stdout is written
+      if (w->coalescer) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        coalesce_expire(w->coalescer, now);
+      }
+      submit_batch(w);
+      if (option_stdout) {
+        output_flush(&w->output);
+      }
+      // queued after the batches of every worker
+      if (__atomic_sub_fetch(&flushes_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        writer_commit();
+      }
+      continue;
+    }
+    metrics_set(GAUGE_QUEUE_DEPTH, __atomic_sub_fetch(&queued, 1, __ATOMIC_RELAXED));
+
+    // printable ssid, shared by the db and stdout
+    ssid_to_str(pr->ssid, pr->ssid_len, pr->ssid_str);
 
     // look for vendor string in manuf
+    TRACE_BEGIN(OUI_LOOKUP);
     int indx = lookup_oui(pr->mac, ouidb, ouidb_size);
+    TRACE_END(OUI_LOOKUP);
+    const char *vendor = "UNKNOWN";
     if (indx >= 0 && ouidb[indx].long_oui) {
-      pr->vendor = strdup(ouidb[indx].long_oui);
-    } else {
-      pr->vendor = strdup("UNKNOWN");
+      vendor = ouidb[indx].long_oui;
     }
+    pr->vendor = vendor;
     // check if mac is not in ignored list
+    TRACE_BEGIN(IGNORE_CHECK);
     uint64_t *res = NULL;
+    uint64_t mac_number = 0;
+    if (ignored != NULL || known != NULL) {
+      mac_number = mac_to_uint64(pr->mac);
+    }
     if (ignored != NULL) {
-      char *tmp = str_replace(pr->mac, ":", "");
-      uint64_t mac_number = strtoll(tmp, NULL, 16);
-      free(tmp);
       res = bsearch(&mac_number, ignored, ignored_count, sizeof(uint64_t), cmp_uint64_t);
     }
+    TRACE_END(IGNORE_CHECK);
     if (res == NULL) {
-      insert_probereq(*pr, db, mac_pk_cache, ssid_pk_cache);
+      metrics_add(METRIC_PROBES_LOGGED, 1);
       if (option_stdout) {
-        char *pr_str = probereq_to_str(*pr);
-        printf("%s\n", pr_str);
-        free(pr_str);
+        TRACE_BEGIN(STDOUT);
+        output_probereq(&w->output, pr);
+        TRACE_END(STDOUT);
+      }
+      if (stream) {
+        bool is_known = known != NULL
+          && bsearch(&mac_number, known, known_count, sizeof(uint64_t), cmp_uint64_t) != NULL;
+        stream_publish(stream, pr, is_known);
+      }
+      if (dashboard) {
+        dashboard_add(dashboard, pr, vendor);
+      }
+      if (series) {
+        series_add(series, pr->mac, pr->tv, pr->rssi);
       }
+      if (w->coalescer) {
+        // the coalescer takes ownership of pr
+        coalesce_add(w->coalescer, pr);
+      } else {
+        // and so does the writer
+        add_item(w, pr, NULL);
+      }
+      pr = NULL;
+    } else {
+      metrics_add(METRIC_PROBES_IGNORED, 1);
     }
     free_probereq(pr);
-    if (option_stdout) {
-      fflush(stdout);
+  }
+
+  if (w->coalescer) {
+    coalesce_flush(w->coalescer);
+    coalesce_free(w->coalescer);
+    w->coalescer = NULL;
+  }
+  submit_batch(w);
+  // tell the writer this worker is done
+  writer_submit(NULL);
+  if (option_stdout) {
+    output_flush(&w->output);
+  }
+  TRACE_THREAD_STOP();
+
+  return NULL;
+}
+
+// start count workers and the db writer they feed
+int start_workers(int count)
+{
+  if (writer_start(count)) {
+    fprintf(stderr, "Error creating db writer thread\n");
+    return -1;
+  }
+  // with a memory budget, the other half of the share of the queues for the workers
+  int capacity = MAX_QUEUE_SIZE;
+  size_t share = budget_share(BUDGET_QUEUES);
+  if (share) {
+    size_t fit = share / 2 / count / sizeof(probereq_t);
+    if (fit > QUEUE_MAX_ITEMS) {
+      fit = QUEUE_MAX_ITEMS;
     }
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    if (now.tv_sec - start_ts_cache.tv_sec >= DB_CACHE_TIME) {
-      // commit to db
-      commit_txn(db);
-      begin_txn(db);
-      start_ts_cache = now;
+    capacity = fit < 16 ? 16 : fit;
+  }
+  for (int i = 0; i < count; i++) {
+    worker_t *w = &workers[i];
+    snprintf(w->name, sizeof(w->name), "worker%d", i);
+    w->batch = NULL;
+    w->coalescer = NULL;
+    if (channel_init(&w->input, capacity) || pthread_create(&w->thread, NULL, process_queue, w)) {
+      fprintf(stderr, "Error creating worker thread\n");
+      // let the writer and the workers already started stop
+      for (int j = i; j < count; j++) {
+        writer_submit(NULL);
+      }
+      workers_count = i;
+      stop_workers();
+      return -1;
     }
   }
+  workers_count = count;
 
-  lruc_free(mac_pk_cache);
-  lruc_free(ssid_pk_cache);
+  return 0;
+}
 
-  return NULL;
+// FNV-1a of the mac address
+static uint32_t mac_hash(const char *mac)
+{
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < 17 && mac[i]; i++) {
+    h = (h ^ (uint8_t)mac[i]) * 16777619u;
+  }
+  return h;
+}
+
+// queue a probe request for the worker in charge of its mac, waiting for room
+void dispatch_probereq(probereq_t *pr)
+{
+  worker_t *w = &workers[mac_hash(pr->mac) % workers_count];
+  // counted before it is queued, so that the worker never takes it off first
+  metrics_set(GAUGE_QUEUE_DEPTH, __atomic_add_fetch(&queued, 1, __ATOMIC_RELAXED));
+  channel_put(&w->input, pr);
+}
+
+// from the event loop: each worker ends its bursts over, submits its pending batch
+// and flushes its output once the probe requests queued before are processed, then
+// the writer commits; skipped while the previous flush isn't over
+void flush_workers(void)
+{
+  int idle = 0;
+  if (!__atomic_compare_exchange_n(&flushes_pending, &idle, workers_count, false,
+      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    return;
+  }
+  for (int i = 0; i < workers_count; i++) {
+    channel_put(&workers[i].input, &flush_request);
+  }
+}
+
+// let the workers process their queue and stop, then the writer
+void stop_workers(void)
+{
+  for (int i = 0; i < workers_count; i++) {
+    channel_put(&workers[i].input, NULL);
+  }
+  for (int i = 0; i < workers_count; i++) {
+    pthread_join(workers[i].thread, NULL);
+    channel_destroy(&workers[i].input);
+  }
+  workers_count = 0;
+  writer_join();
 }
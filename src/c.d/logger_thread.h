@@ -3,18 +3,26 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <sys/time.h>
 
 struct probereq {
   struct timeval tv;
-  char *mac;
-  char *vendor;
-  uint8_t *ssid;
+  char mac[18];
+  const char *vendor;   // in the manuf db, or "UNKNOWN"
+  uint8_t ssid[32];
   uint8_t ssid_len;
+  char ssid_str[64];    // ssid as stored in the db: utf-8 or "b64_" + base64
   int rssi;
+  uint16_t seq;           // 802.11 sequence number
+  uint64_t fingerprint;   // hash of the Information Elements layout
 };
 typedef struct probereq probereq_t;
 
-void *process_queue(void *args);
+int start_workers(int count);
+void dispatch_probereq(probereq_t *pr);
+void flush_workers(void);
+void stop_workers(void);
+probereq_t *new_probereq(void);
 void free_probereq(probereq_t *pr);
 
 #endif
@@ -0,0 +1,202 @@
+/*
+event loop of the main thread, on epoll: the capture fd, the timers of the
+periodic work (timerfd) and the signals (signalfd) are all waited for at once,
+and each handled in turn by its handler. Listening sockets are added the same
+way as the capture fd.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "loop.h"
+
+loop_t *loop_new(void)
+{
+  loop_t *loop = calloc(1, sizeof(loop_t));
+  if (loop == NULL) {
+    return NULL;
+  }
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    perror("Error: can't create the event loop");
+    free(loop);
+    return NULL;
+  }
+  return loop;
+}
+
+static int add_source(loop_t *loop, enum loop_source_type type, int fd, uint32_t events,
+  loop_handler handler, void *data)
+{
+  // the epoll data points into the array: a source never moves, and a removed one leaves a hole
+  int i = 0;
+  while (i < loop->count && loop->sources[i].fd >= 0) {
+    i++;
+  }
+  if (i == LOOP_MAX_SOURCES) {
+    fprintf(stderr, "Error: more than %d sources in the event loop\n", LOOP_MAX_SOURCES);
+    return -1;
+  }
+  struct loop_source *s = &loop->sources[i];
+  s->type = type;
+  s->fd = fd;
+  s->handler = handler;
+  s->data = data;
+
+  struct epoll_event ev = { .events = events, .data.ptr = s };
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("Error: can't add to the event loop");
+    s->fd = -1;
+    return -1;
+  }
+  if (i == loop->count) {
+    loop->count++;
+  }
+  return 0;
+}
+
+// watch a fd of the caller, for the epoll events
+int loop_add_fd(loop_t *loop, int fd, uint32_t events, loop_handler handler, void *data)
+{
+  return add_source(loop, LOOP_FD, fd, events, handler, data);
+}
+
+// call handler every interval_ms, on the monotonic clock; returns the fd of the timer
+int loop_add_timer(loop_t *loop, int interval_ms, loop_handler handler, void *data)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    perror("Error: can't create a timer");
+    return -1;
+  }
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval_ms / 1000;
+  spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(fd, 0, &spec, NULL) < 0 || add_source(loop, LOOP_TIMER, fd, EPOLLIN, handler, data)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// receive the signals in the loop instead of in a signal handler; they are
+// blocked in the calling thread, and so in the threads it starts after it
+int loop_add_signals(loop_t *loop, const int *signals, int count, loop_handler handler, void *data)
+{
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (int i = 0; i < count; i++) {
+    sigaddset(&mask, signals[i]);
+  }
+  if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+    fprintf(stderr, "Error: can't block the signals\n");
+    return -1;
+  }
+  int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    perror("Error: can't create a signalfd");
+    return -1;
+  }
+  if (add_source(loop, LOOP_SIGNALS, fd, EPOLLIN, handler, data)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// stop watching fd; the timers and signalfd are closed, the fds of the caller are not
+int loop_remove(loop_t *loop, int fd)
+{
+  for (int i = 0; i < loop->count; i++) {
+    struct loop_source *s = &loop->sources[i];
+    if (s->fd != fd) {
+      continue;
+    }
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    if (s->type != LOOP_FD) {
+      close(fd);
+    }
+    s->fd = -1;
+    s->handler = NULL;
+    while (loop->count > 0 && loop->sources[loop->count - 1].fd < 0) {
+      loop->count--;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+static void dispatch(loop_t *loop, struct loop_source *s, uint32_t events)
+{
+  if (s->handler == NULL) {
+    return;
+  }
+  switch (s->type) {
+  case LOOP_FD:
+    s->handler(loop, events, s->data);
+    break;
+  case LOOP_TIMER: {
+    uint64_t expirations;
+    if (read(s->fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+      s->handler(loop, (uint32_t)expirations, s->data);
+    }
+    break;
+  }
+  case LOOP_SIGNALS: {
+    struct signalfd_siginfo info;
+    while (read(s->fd, &info, sizeof(info)) == sizeof(info)) {
+      s->handler(loop, info.ssi_signo, s->data);
+    }
+    break;
+  }
+  }
+}
+
+// wait for and handle the events until loop_stop() is called; returns -1 on error
+int loop_run(loop_t *loop)
+{
+  struct epoll_event events[LOOP_MAX_SOURCES];
+
+  loop->running = true;
+  while (loop->running) {
+    int n = epoll_wait(loop->epfd, events, LOOP_MAX_SOURCES, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Error: epoll_wait");
+      loop->running = false;
+      return -1;
+    }
+    for (int i = 0; i < n && loop->running; i++) {
+      dispatch(loop, events[i].data.ptr, events[i].events);
+    }
+  }
+  return 0;
+}
+
+// from a handler: return from loop_run() once the current handler returns
+void loop_stop(loop_t *loop)
+{
+  loop->running = false;
+}
+
+void loop_free(loop_t *loop)
+{
+  if (loop == NULL) return;
+
+  for (int i = 0; i < loop->count; i++) {
+    if (loop->sources[i].fd >= 0 && loop->sources[i].type != LOOP_FD) {
+      close(loop->sources[i].fd);
+    }
+  }
+  close(loop->epfd);
+  free(loop);
+}
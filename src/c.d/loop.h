@@ -0,0 +1,43 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+typedef struct loop loop_t;
+
+// called with the epoll events of a fd, the expirations of a timer, or the signal received
+typedef void (*loop_handler)(loop_t *loop, uint32_t value, void *data);
+
+enum loop_source_type {
+  LOOP_FD = 0,
+  LOOP_TIMER,
+  LOOP_SIGNALS
+};
+
+struct loop_source {
+  enum loop_source_type type;
+  int fd;
+  loop_handler handler;
+  void *data;
+};
+
+struct loop {
+  int epfd;
+  bool running;
+  int count;
+  struct loop_source sources[LOOP_MAX_SOURCES];
+};
+
+loop_t *loop_new(void);
+int loop_add_fd(loop_t *loop, int fd, uint32_t events, loop_handler handler, void *data);
+int loop_add_timer(loop_t *loop, int interval_ms, loop_handler handler, void *data);
+int loop_add_signals(loop_t *loop, const int *signals, int count, loop_handler handler, void *data);
+int loop_remove(loop_t *loop, int fd);
+int loop_run(loop_t *loop);
+void loop_stop(loop_t *loop);
+void loop_free(loop_t *loop);
+
+#endif
@@ -40,7 +40,7 @@ uint32_t lruc_hash(lruc *cache, void *key, uint32_t key_length)
   h ^= h >> 13;
   h *= m;
   h ^= h >> 15;
-  return h % cache->hash_table_size;
+  return h;
 }
 
 // compare a key against an existing item's key
@@ -52,9 +52,42 @@ int lruc_cmp_keys(lruc_item *item, void *key, uint32_t key_length)
     return memcmp(key, item->key, key_length);
 }
 
+// add an item as the most recent one of a segment
+void lruc_push_item(lruc *cache, lruc_item *item, int segment)
+{
+  lruc_segment *s = &cache->segments[segment];
+
+  item->segment = segment;
+  item->newer = NULL;
+  item->older = s->newest;
+  if (s->newest)
+    s->newest->newer = item;
+  else
+    s->oldest = item;
+  s->newest = item;
+  s->size += item->value_length;
+}
+
+// take an item out of the recency list of its segment
+void lruc_unlink_item(lruc *cache, lruc_item *item)
+{
+  lruc_segment *s = &cache->segments[item->segment];
+
+  if (item->newer)
+    ((lruc_item *)item->newer)->older = item->older;
+  else
+    s->newest = (lruc_item *) item->older;
+  if (item->older)
+    ((lruc_item *)item->older)->newer = item->newer;
+  else
+    s->oldest = (lruc_item *) item->newer;
+  s->size -= item->value_length;
+}
+
 // remove an item and push it to the free items queue
 void lruc_remove_item(lruc *cache, lruc_item *prev, lruc_item *item, uint32_t hash_index)
 {
+  lruc_unlink_item(cache, item);
   if (prev)
     prev->next = item->next;
   else
@@ -62,6 +95,8 @@ void lruc_remove_item(lruc *cache, lruc_item *prev, lruc_item *item, uint32_t ha
 
   // free memory and update the free memory counter
   cache->free_memory += item->value_length;
+  cache->key_memory -= item->key_length;
+  cache->count--;
   free(item->value);
   free(item->key);
 
@@ -71,33 +106,119 @@ void lruc_remove_item(lruc *cache, lruc_item *prev, lruc_item *item, uint32_t ha
   cache->free_items = item;
 }
 
-// remove the least recently used item
-// TODO: we can optimise this by finding the n lru items, where n = required_space / average_length
-void lruc_remove_lru_item(lruc *cache)
+// remove an item taken from the recency lists
+void lruc_evict_item(lruc *cache, lruc_item *item)
 {
-  lruc_item *min_item = NULL, *min_prev = NULL;
-  lruc_item *item = NULL, *prev = NULL;
-  uint32_t i = 0, min_index = -1;
-  uint64_t min_access_count = -1;
-
-   for (; i < cache->hash_table_size; i++) {
-    item = cache->items[i];
-    prev = NULL;
-
-    while (item) {
-      if (item->access_count < min_access_count || min_access_count == -1) {
-        min_access_count = item->access_count;
-        min_item  = item;
-        min_prev  = prev;
-        min_index = i;
-      }
-      prev = item;
-      item = item->next;
+  uint32_t hash_index = item->hash % cache->hash_table_size;
+  lruc_item *prev = NULL, *i = cache->items[hash_index];
+
+  while (i != item) {
+    prev = i;
+    i = (lruc_item *) i->next;
+  }
+  lruc_remove_item(cache, prev, item, hash_index);
+}
+
+uint64_t lruc_size(lruc *cache)
+{
+  return cache->segments[LRUC_WINDOW].size + cache->segments[LRUC_PROBATION].size
+    + cache->segments[LRUC_PROTECTED].size;
+}
+
+// the item to evict first: the least recently used of the main part, or of the window
+lruc_item *lruc_victim(lruc *cache)
+{
+  for (int s = LRUC_PROBATION; s < LRUC_SEGMENTS; s++) {
+    if (cache->segments[s].oldest)
+      return cache->segments[s].oldest;
+  }
+  return cache->segments[LRUC_WINDOW].oldest;
+}
+
+// a counter of each row of the sketch, by multiply-shift of the hash of the key
+static const uint32_t lruc_sketch_seeds[LRUC_SKETCH_ROWS] = { 0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f };
+
+uint8_t *lruc_counter(lruc *cache, uint32_t hash, int row)
+{
+  uint32_t i = (hash * lruc_sketch_seeds[row]) >> (32 - cache->sketch_bits);
+  return &cache->sketch[(row << cache->sketch_bits) + i];
+}
+
+// estimate of the number of recent lookups of a key
+uint32_t lruc_frequency(lruc *cache, uint32_t hash)
+{
+  uint32_t frequency = UINT8_MAX;
+
+  for (int row = 0; row < LRUC_SKETCH_ROWS; row++) {
+    uint8_t *counter = lruc_counter(cache, hash, row);
+    if (*counter < frequency)
+      frequency = *counter;
+  }
+  return frequency;
+}
+
+void lruc_count_lookup(lruc *cache, uint32_t hash)
+{
+  uint32_t frequency = lruc_frequency(cache, hash);
+
+  // only the smallest counters, that are the closest to the real count
+  if (frequency < 15) {
+    for (int row = 0; row < LRUC_SKETCH_ROWS; row++) {
+      uint8_t *counter = lruc_counter(cache, hash, row);
+      if (*counter == frequency)
+        (*counter)++;
     }
   }
 
-  if (min_item)
-    lruc_remove_item(cache, min_prev, min_item, min_index);
+  // halve all the counters from time to time, so that the keys no longer looked up
+  // are forgotten
+  if (++cache->sketch_additions == cache->sketch_sample) {
+    for (uint32_t i = 0; i < LRUC_SKETCH_ROWS << cache->sketch_bits; i++)
+      cache->sketch[i] >>= 1;
+    cache->sketch_additions /= 2;
+  }
+}
+
+// an item just looked up becomes the most recent of its segment; one of the probation
+// segment is protected from then on
+void lruc_touch_item(lruc *cache, lruc_item *item)
+{
+  int segment = item->segment == LRUC_PROBATION ? LRUC_PROTECTED : item->segment;
+  lruc_segment *protected = &cache->segments[LRUC_PROTECTED];
+
+  lruc_unlink_item(cache, item);
+  lruc_push_item(cache, item, segment);
+  while (segment == LRUC_PROTECTED && protected->size > protected->max && protected->oldest != item) {
+    lruc_item *oldest = protected->oldest;
+    lruc_unlink_item(cache, oldest);
+    lruc_push_item(cache, oldest, LRUC_PROBATION);
+  }
+}
+
+// with LRUC_TINYLFU, move the items in excess from the window to the main part, if
+// they were looked up more often than what they replace there, or evict them
+void lruc_admit_items(lruc *cache)
+{
+  lruc_segment *window = &cache->segments[LRUC_WINDOW];
+
+  // the item just set stays in the window
+  while ((window->size > window->max || lruc_size(cache) > cache->total_memory)
+    && window->oldest != window->newest) {
+    lruc_item *candidate = window->oldest, *victim;
+    uint32_t frequency = lruc_frequency(cache, candidate->hash);
+
+    while (lruc_size(cache) > cache->total_memory
+      && (victim = lruc_victim(cache)) != candidate
+      && lruc_frequency(cache, victim->hash) < frequency)
+      lruc_evict_item(cache, victim);
+
+    if (lruc_size(cache) > cache->total_memory) {
+      lruc_evict_item(cache, candidate);
+    } else {
+      lruc_unlink_item(cache, candidate);
+      lruc_push_item(cache, candidate, LRUC_PROBATION);
+    }
+  }
 }
 
 // pop an existing item off the free queue, or create a new one
@@ -108,6 +229,8 @@ lruc_item *lruc_pop_or_create_item(lruc *cache)
   if (cache->free_items) {
     item = cache->free_items;
     cache->free_items = item->next;
+    // it ends the chain it is appended to
+    item->next = NULL;
   } else {
     item = (lruc_item *) calloc(sizeof(lruc_item), 1);
   }
@@ -136,7 +259,7 @@ lruc_item *lruc_pop_or_create_item(lruc *cache)
 // ------------------------------------------
 // public API
 // ------------------------------------------
-lruc *lruc_new(uint64_t cache_size, uint32_t average_length)
+lruc *lruc_new(uint64_t cache_size, uint32_t average_length, lruc_policy policy)
 {
   // create the cache
   lruc *cache = (lruc *) calloc(sizeof(lruc), 1);
@@ -149,6 +272,7 @@ lruc *lruc_new(uint64_t cache_size, uint32_t average_length)
   cache->free_memory          = cache_size;
   cache->total_memory         = cache_size;
   cache->seed                 = time(NULL);
+  cache->policy               = policy;
 
   // size the hash table to a guestimate of the number of slots required (assuming a perfect hash)
   cache->items = (lruc_item **) calloc(sizeof(lruc_item *), cache->hash_table_size);
@@ -166,6 +290,28 @@ lruc *lruc_new(uint64_t cache_size, uint32_t average_length)
     free(cache);
     return NULL;
   }
+
+  if (policy == LRUC_TINYLFU) {
+    // 1% for the window, 80% of the rest for the protected items
+    cache->segments[LRUC_WINDOW].max = cache_size / 100;
+    cache->segments[LRUC_PROTECTED].max = (cache_size - cache_size / 100) * 4 / 5;
+    // at least a counter per slot of the hash table in each row
+    cache->sketch_bits = 4;
+    while ((1U << cache->sketch_bits) < cache->hash_table_size && cache->sketch_bits < 24)
+      cache->sketch_bits++;
+    cache->sketch_sample = 10 << cache->sketch_bits;
+    cache->sketch = (uint8_t *) calloc(LRUC_SKETCH_ROWS << cache->sketch_bits, 1);
+    if (!cache->sketch) {
+      perror("LRU Cache unable to create frequency sketch");
+      pthread_mutex_destroy(cache->mutex);
+      free(cache->mutex);
+      free(cache->items);
+      free(cache);
+      return NULL;
+    }
+  } else {
+    cache->segments[LRUC_WINDOW].max = cache_size;
+  }
   return cache;
 }
 
@@ -207,6 +353,7 @@ lruc_error lruc_free(lruc *cache)
     }
     free(cache->mutex);
   }
+  free(cache->sketch);
   free(cache);
 
   return LRUC_NO_ERROR;
@@ -221,7 +368,7 @@ lruc_error lruc_set(lruc *cache, void *key, uint32_t key_length, void *value, ui
   lock_cache();
 
   // see if the key already exists
-  uint32_t hash_index = lruc_hash(cache, key, key_length), required = 0;
+  uint32_t hash = lruc_hash(cache, key, key_length), hash_index = hash % cache->hash_table_size;
   lruc_item *item = NULL, *prev = NULL;
   item = cache->items[hash_index];
 
@@ -232,10 +379,11 @@ lruc_error lruc_set(lruc *cache, void *key, uint32_t key_length, void *value, ui
 
   if (item) {
     // update the value and value_lengths
-    required = value_length - item->value_length;
+    cache->segments[item->segment].size += value_length - item->value_length;
     free(item->value);
     item->value = value;
     item->value_length = value_length;
+    lruc_touch_item(cache, item);
 
   } else {
     // insert a new item
@@ -244,21 +392,23 @@ lruc_error lruc_set(lruc *cache, void *key, uint32_t key_length, void *value, ui
     item->key = key;
     item->value_length = value_length;
     item->key_length = key_length;
-    required = value_length;
+    item->hash = hash;
+    cache->key_memory += key_length;
+    cache->count++;
 
     if (prev)
       prev->next = item;
     else
       cache->items[hash_index] = item;
+    lruc_push_item(cache, item, LRUC_WINDOW);
   }
-  item->access_count = ++cache->access_count;
 
+  if (cache->policy == LRUC_TINYLFU)
+    lruc_admit_items(cache);
   // remove as many items as necessary to free enough space
-  if (required > 0 && required > cache->free_memory) {
-    while (cache->free_memory < required)
-      lruc_remove_lru_item(cache);
-  }
-  cache->free_memory -= required;
+  while (lruc_size(cache) > cache->total_memory)
+    lruc_evict_item(cache, lruc_victim(cache));
+  cache->free_memory = cache->total_memory - lruc_size(cache);
   unlock_cache();
   return LRUC_NO_ERROR;
 }
@@ -270,18 +420,20 @@ lruc_error lruc_get(lruc *cache, void *key, uint32_t key_length, void **value)
   lock_cache();
 
   // loop until we find the item, or hit the end of a chain
-  uint32_t hash_index = lruc_hash(cache, key, key_length);
-  lruc_item *item = cache->items[hash_index];
+  uint32_t hash = lruc_hash(cache, key, key_length);
+  lruc_item *item = cache->items[hash % cache->hash_table_size];
 
   while (item && lruc_cmp_keys(item, key, key_length))
     item = (lruc_item *) item->next;
 
   if (item) {
     *value = item->value;
-    item->access_count = ++cache->access_count;
+    lruc_touch_item(cache, item);
   } else {
     *value = NULL;
   }
+  if (cache->policy == LRUC_TINYLFU)
+    lruc_count_lookup(cache, hash);
 
   unlock_cache();
   return LRUC_NO_ERROR;
@@ -295,7 +447,7 @@ lruc_error lruc_delete(lruc *cache, void *key, uint32_t key_length)
 
   // loop until we find the item, or hit the end of a chain
   lruc_item *item = NULL, *prev = NULL;
-  uint32_t hash_index = lruc_hash(cache, key, key_length);
+  uint32_t hash_index = lruc_hash(cache, key, key_length) % cache->hash_table_size;
   item = cache->items[hash_index];
 
   while (item && lruc_cmp_keys(item, key, key_length)) {
@@ -339,3 +491,28 @@ lruc_error lruc_print(lruc *cache)
   unlock_cache();
   return LRUC_NO_ERROR;
 }
+
+int lruc_parse_policy(const char *name, lruc_policy *policy)
+{
+  if (strcmp(name, "lru") == 0) {
+    *policy = LRUC_LRU;
+  } else if (strcmp(name, "tinylfu") == 0) {
+    *policy = LRUC_TINYLFU;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+// memory held by the cache: its tables, and its items with their keys and values
+uint64_t lruc_memory(lruc *cache)
+{
+  uint64_t memory = sizeof(lruc) + cache->hash_table_size * sizeof(lruc_item *);
+
+  if (cache->sketch)
+    memory += LRUC_SKETCH_ROWS << cache->sketch_bits;
+  pthread_mutex_lock(cache->mutex);
+  memory += cache->count * sizeof(lruc_item) + cache->key_memory + cache->total_memory - cache->free_memory;
+  pthread_mutex_unlock(cache->mutex);
+  return memory;
+}
@@ -18,6 +18,29 @@ typedef enum {
   LRUC_VALUE_TOO_LARGE
 } lruc_error;
 
+// ------------------------------------------
+// replacement policies
+// ------------------------------------------
+// LRUC_LRU evicts the least recently used item. LRUC_TINYLFU (W-TinyLFU, Einziger
+// et al., 2017) keeps the new items in a small lru window, and only lets those
+// leaving it into the main part if they were looked up more often than the item
+// they would evict there: a scan of keys seen once doesn't flush the frequent ones
+typedef enum {
+  LRUC_LRU = 0,
+  LRUC_TINYLFU
+} lruc_policy;
+
+// the segments of the cache, each in order of recency; all the items are in
+// the window with LRUC_LRU
+enum {
+  LRUC_WINDOW = 0,
+  LRUC_PROBATION,
+  LRUC_PROTECTED,     // looked up again after their admission
+  LRUC_SEGMENTS
+};
+
+#define LRUC_SKETCH_ROWS 4
+
 // ------------------------------------------
 // types
 // ------------------------------------------
@@ -26,13 +49,22 @@ typedef struct {
   void      *key;
   uint32_t  value_length;
   uint32_t  key_length;
-  uint64_t  access_count;
+  uint32_t  hash;
+  uint8_t   segment;
   void      *next;
+  void      *newer;
+  void      *older;
 } lruc_item;
 
+typedef struct {
+  lruc_item *newest;
+  lruc_item *oldest;
+  uint64_t  size;
+  uint64_t  max;
+} lruc_segment;
+
 typedef struct {
   lruc_item **items;
-  uint64_t  access_count;
   uint64_t  free_memory;
   uint64_t  total_memory;
   uint64_t  average_item_length;
@@ -40,16 +72,27 @@ typedef struct {
   time_t    seed;
   lruc_item *free_items;
   pthread_mutex_t *mutex;
+  uint64_t  count;
+  uint64_t  key_memory;
+  lruc_policy policy;
+  lruc_segment segments[LRUC_SEGMENTS];
+  // count-min sketch of the lookups of the keys, with LRUC_TINYLFU
+  uint8_t   *sketch;
+  uint32_t  sketch_bits;
+  uint32_t  sketch_additions;
+  uint32_t  sketch_sample;
 } lruc;
 
 // ------------------------------------------
 // api
 // ------------------------------------------
-lruc *lruc_new(uint64_t cache_size, uint32_t average_length);
+lruc *lruc_new(uint64_t cache_size, uint32_t average_length, lruc_policy policy);
 lruc_error lruc_free(lruc *cache);
 lruc_error lruc_set(lruc *cache, void *key, uint32_t key_length, void *value, uint32_t value_length);
 lruc_error lruc_get(lruc *cache, void *key, uint32_t key_length, void **value);
 lruc_error lruc_delete(lruc *cache, void *key, uint32_t key_length);
 lruc_error lruc_print(lruc *cache);
+int lruc_parse_policy(const char *name, lruc_policy *policy);
+uint64_t lruc_memory(lruc *cache);
 
 #endif
@@ -174,11 +174,39 @@ manuf_t *parse_manuf_file(const char*path, size_t *ouidb_size)
   return ouidb;
 }
 
+// memory held by the parsed manuf file, the strings counted with the overhead of malloc
+size_t manuf_memory(const manuf_t *ouidb, size_t ouidb_size)
+{
+  size_t memory = ouidb_size * sizeof(manuf_t);
+  for (size_t i = 0; i < ouidb_size; i++) {
+    const char *strings[] = { ouidb[i].short_oui, ouidb[i].long_oui, ouidb[i].comment };
+    for (int j = 0; j < 3; j++) {
+      if (strings[j]) {
+        memory += (strlen(strings[j]) + 1 + 2 * sizeof(size_t) + 15) & ~(size_t)15;
+      }
+    }
+  }
+  return memory;
+}
+
+// mac address as a number, the separators skipped, without allocating a copy of it
+uint64_t mac_to_uint64(const char *mac)
+{
+  uint64_t n = 0;
+  for (const char *p = mac; *p; p++) {
+    char c = *p | 0x20;
+    if (*p >= '0' && *p <= '9') {
+      n = (n << 4) | (*p - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      n = (n << 4) | (c - 'a' + 10);
+    }
+  }
+  return n;
+}
+
 int lookup_oui(char *mac, manuf_t *ouidb, size_t ouidb_size)
 {
-  char *tmp = str_replace(mac, ":", "");
-  uint64_t mac_number = strtoll(tmp, NULL, 16);
-  free(tmp);
+  uint64_t mac_number = mac_to_uint64(mac);
 
   int count = 0;
   uint64_t val = ouidb[count].max;
@@ -2,6 +2,7 @@
 #define MANUF_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 struct manuf {
     uint64_t min;
@@ -14,7 +15,9 @@ typedef struct manuf manuf_t;
 
 void free_manuf_t(manuf_t *m);
 manuf_t *parse_manuf_file(const char*path, size_t *ouidb_size);
+size_t manuf_memory(const manuf_t *ouidb, size_t ouidb_size);
 int lookup_oui(char *mac, manuf_t *ouidb, size_t ouidb_size);
+uint64_t mac_to_uint64(const char *mac);
 
 char *str_replace(const char *orig, const char *rep, const char *with);
 
@@ -0,0 +1,260 @@
+/*
+counters, gauges and latency histograms of the capture and logging, kept per
+thread so that updating them needs no lock nor atomic read-modify-write.
+They are summed when read, in the Prometheus text format.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "metrics.h"
+#include "http.h"
+#include "reject.h"
+#include "pool.h"
+#include "budget.h"
+
+__thread metrics_thread_t *metrics_local = NULL;
+uint64_t metrics_gauges[GAUGES];
+
+static metrics_thread_t threads[METRICS_MAX_THREADS];
+static int threads_count = 0;
+static pthread_mutex_t mutex_threads = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *metric_names[METRICS] = {
+  "probemon_packets_total",
+  "probemon_probes_queued_total",
+  "probemon_probes_logged_total",
+  "probemon_probes_ignored_total",
+  "probemon_probes_dropped_total",
+  "probemon_mac_cache_hits_total",
+  "probemon_mac_cache_misses_total",
+  "probemon_ssid_cache_hits_total",
+  "probemon_ssid_cache_misses_total",
+  "probemon_db_errors_total",
+  "probemon_uplink_records_total",
+  "probemon_uplink_bytes_total",
+  "probemon_mac_filter_skipped_total",
+  "probemon_mac_filter_false_positives_total",
+  "probemon_ephemeral_probes_total",
+  "probemon_memory_releases_total"
+};
+
+static const char *metric_help[METRICS] = {
+  "Frames handed over by pcap",
+  "Probe requests queued for logging",
+  "Probe requests logged",
+  "Probe requests of ignored mac addresses",
+  "Probe requests dropped, no record being left in the pool",
+  "Lookups of mac ids found in the cache",
+  "Lookups of mac ids not found in the cache",
+  "Lookups of ssid ids found in the cache",
+  "Lookups of ssid ids not found in the cache",
+  "Failed db operations",
+  "Probe requests and bursts sent to the collector",
+  "Compressed bytes of the batches sent to the collector",
+  "New macs inserted without looking for them in the db, thanks to the filter",
+  "Macs looked for in the db because of a false positive of the filter",
+  "Probe requests and bursts of randomized macs written to the ephemeral table",
+  "Times the caches of sqlite and malloc were released, the process using more than the memory budget"
+};
+
+static const char *histogram_names[HISTOGRAMS] = {
+  "probemon_enqueue_wait_seconds",
+  "probemon_insert_seconds",
+  "probemon_commit_seconds"
+};
+
+static const char *histogram_help[HISTOGRAMS] = {
+  "Time waiting for room in the queue",
+  "Time to insert a probe request in the db",
+  "Time to commit a transaction"
+};
+
+static const char *gauge_names[GAUGES] = {
+  "probemon_queue_depth",
+  "probemon_writer_queue_depth",
+  "probemon_pcap_received_total",
+  "probemon_pcap_dropped_total",
+  "probemon_pcap_ifdropped_total",
+  "probemon_uplink_backlog",
+  "probemon_sessions_open",
+  "probemon_uniques_sketches",
+  "probemon_uniques_bytes",
+  "probemon_mac_filter_bytes",
+  "probemon_mac_filter_fpr_ppm"
+};
+
+static const char *gauge_help[GAUGES] = {
+  "Probe requests waiting in the queues of all the workers",
+  "Batches waiting for the db writer",
+  "Packets received by the kernel filter",
+  "Packets dropped by the kernel, the capture buffer being full",
+  "Packets dropped by the interface or its driver",
+  "Batches waiting for the ack of the collector, in memory or in the spool",
+  "Macs with a session not closed yet",
+  "Sketches of the distinct macs of the current periods in memory",
+  "Memory used by the sketches of the distinct macs",
+  "Memory used by the filter of the macs of the db",
+  "Expected false positive rate of the filter of the macs, in parts per million"
+};
+
+static const char *gauge_types[GAUGES] = { "gauge", "gauge", "counter", "counter", "counter", "gauge", "gauge", "gauge", "gauge", "gauge", "gauge" };
+
+// give the calling thread its own set of counters
+metrics_thread_t *metrics_register(const char *name)
+{
+  pthread_mutex_lock(&mutex_threads);
+  if (threads_count < METRICS_MAX_THREADS) {
+    metrics_local = &threads[threads_count++];
+    metrics_local->name = name;
+  }
+  pthread_mutex_unlock(&mutex_threads);
+  return metrics_local;
+}
+
+static inline uint64_t load(const uint64_t *v)
+{
+  return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+static uint64_t sum_counter(enum metric m)
+{
+  uint64_t v = 0;
+  int n = __atomic_load_n(&threads_count, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < n; i++) {
+    v += load(&threads[i].counters[m]);
+  }
+  return v;
+}
+
+static void sum_histogram(enum histogram h, struct histogram_data *d)
+{
+  int n = __atomic_load_n(&threads_count, __ATOMIC_ACQUIRE);
+  *d = (struct histogram_data){ 0 };
+  for (int i = 0; i < n; i++) {
+    const struct histogram_data *t = &threads[i].histograms[h];
+    for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+      d->buckets[b] += load(&t->buckets[b]);
+    }
+    d->count += load(&t->count);
+    d->sum += load(&t->sum);
+  }
+}
+
+// all the metrics, in the Prometheus text exposition format
+void metrics_write(FILE *f)
+{
+  for (int m = 0; m < METRICS; m++) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n",
+      metric_names[m], metric_help[m], metric_names[m], metric_names[m], sum_counter(m));
+  }
+
+  fprintf(f, "# HELP probemon_frames_rejected_total Frames dropped before parsing\n"
+    "# TYPE probemon_frames_rejected_total counter\n");
+  for (int i = REJECT_NONE + 1; i < REJECT_REASONS; i++) {
+    fprintf(f, "probemon_frames_rejected_total{reason=\"%s\"} %" PRIu64 "\n",
+      reject_names[i], load(&reject_counters[i]));
+  }
+
+  for (int g = 0; g < GAUGES; g++) {
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n%s %" PRIu64 "\n",
+      gauge_names[g], gauge_help[g], gauge_names[g], gauge_types[g], gauge_names[g], load(&metrics_gauges[g]));
+  }
+
+  struct pool_stats pools[POOL_MAX_COUNT];
+  int pools_count = pool_stats(pools, POOL_MAX_COUNT);
+  fprintf(f, "# HELP probemon_pool_items Objects in the slabs of each pool\n"
+    "# TYPE probemon_pool_items gauge\n");
+  for (int i = 0; i < pools_count; i++) {
+    fprintf(f, "probemon_pool_items{pool=\"%s\",state=\"in_use\"} %" PRIu64 "\n"
+      "probemon_pool_items{pool=\"%s\",state=\"free\"} %" PRIu64 "\n",
+      pools[i].name, pools[i].in_use, pools[i].name, pools[i].capacity - pools[i].in_use);
+  }
+  fprintf(f, "# HELP probemon_pool_peak_items Most objects of each pool in use at once\n"
+    "# TYPE probemon_pool_peak_items gauge\n");
+  for (int i = 0; i < pools_count; i++) {
+    fprintf(f, "probemon_pool_peak_items{pool=\"%s\"} %" PRIu64 "\n", pools[i].name, pools[i].peak);
+  }
+  fprintf(f, "# HELP probemon_pool_allocs_total Objects allocated from each pool\n"
+    "# TYPE probemon_pool_allocs_total counter\n");
+  for (int i = 0; i < pools_count; i++) {
+    fprintf(f, "probemon_pool_allocs_total{pool=\"%s\"} %" PRIu64 "\n", pools[i].name, pools[i].allocs);
+  }
+  fprintf(f, "# HELP probemon_pool_bytes Memory held by the slabs of each pool\n"
+    "# TYPE probemon_pool_bytes gauge\n");
+  for (int i = 0; i < pools_count; i++) {
+    fprintf(f, "probemon_pool_bytes{pool=\"%s\"} %" PRIu64 "\n", pools[i].name, pools[i].bytes);
+  }
+  budget_write(f);
+
+  for (int h = 0; h < HISTOGRAMS; h++) {
+    struct histogram_data d;
+    uint64_t cumulative = 0;
+    sum_histogram(h, &d);
+    fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", histogram_names[h], histogram_help[h], histogram_names[h]);
+    for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS - 1; b++) {
+      cumulative += d.buckets[b];
+      fprintf(f, "%s_bucket{le=\"%.9g\"} %" PRIu64 "\n", histogram_names[h], (double)(1ULL << (10 + b)) / 1e9, cumulative);
+    }
+    fprintf(f, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", histogram_names[h], d.count);
+    fprintf(f, "%s_sum %.9f\n%s_count %" PRIu64 "\n", histogram_names[h], d.sum / 1e9, histogram_names[h], d.count);
+  }
+}
+
+// a short summary, for humans
+void metrics_dump(FILE *f)
+{
+  uint64_t hits = sum_counter(METRIC_MAC_CACHE_HITS), misses = sum_counter(METRIC_MAC_CACHE_MISSES);
+  uint64_t ssid_hits = sum_counter(METRIC_SSID_CACHE_HITS), ssid_misses = sum_counter(METRIC_SSID_CACHE_MISSES);
+  struct histogram_data commit;
+  sum_histogram(HISTOGRAM_COMMIT, &commit);
+
+  fprintf(f, ":: Stats: packets=%" PRIu64 " queued=%" PRIu64 " logged=%" PRIu64 " ignored=%" PRIu64
+    " queue=%" PRIu64 " writer queue=%" PRIu64 "\n", sum_counter(METRIC_PACKETS), sum_counter(METRIC_PROBES_QUEUED),
+    sum_counter(METRIC_PROBES_LOGGED), sum_counter(METRIC_PROBES_IGNORED), load(&metrics_gauges[GAUGE_QUEUE_DEPTH]),
+    load(&metrics_gauges[GAUGE_WRITER_QUEUE_DEPTH]));
+  fprintf(f, ":: pcap: received=%" PRIu64 " dropped=%" PRIu64 " ifdropped=%" PRIu64 "\n",
+    load(&metrics_gauges[GAUGE_PCAP_RECEIVED]), load(&metrics_gauges[GAUGE_PCAP_DROPPED]),
+    load(&metrics_gauges[GAUGE_PCAP_IFDROPPED]));
+  fprintf(f, ":: cache hit rate: mac=%.1f%% ssid=%.1f%%\n",
+    hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+    ssid_hits + ssid_misses ? 100.0 * ssid_hits / (ssid_hits + ssid_misses) : 0.0);
+  fprintf(f, ":: db: commits=%" PRIu64 " mean commit time=%.3f ms errors=%" PRIu64 "\n",
+    commit.count, commit.count ? commit.sum / 1e6 / commit.count : 0.0, sum_counter(METRIC_DB_ERRORS));
+  struct pool_stats pools[POOL_MAX_COUNT];
+  int pools_count = pool_stats(pools, POOL_MAX_COUNT);
+  fprintf(f, ":: pools:");
+  for (int i = 0; i < pools_count; i++) {
+    fprintf(f, " %s=%" PRIu64 "/%" PRIu64 " (peak %" PRIu64 ", %" PRIu64 " KiB)", pools[i].name,
+      pools[i].in_use, pools[i].capacity, pools[i].peak, pools[i].bytes / 1024);
+  }
+  fprintf(f, "\n");
+  budget_dump(f);
+  fflush(f);
+}
+
+// ------------------------------------------
+// /metrics
+// ------------------------------------------
+static void get_metrics(const char *query, http_response_t *resp, void *data)
+{
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f = open_memstream(&buf, &len);
+  if (f == NULL) {
+    resp->status = 500;
+    return;
+  }
+  metrics_write(f);
+  fclose(f);
+  resp->content_type = "text/plain; version=0.0.4";
+  http_append(resp, buf, len);
+  free(buf);
+}
+
+void metrics_routes(http_server_t *server)
+{
+  http_route(server, "/metrics", get_metrics, NULL);
+}
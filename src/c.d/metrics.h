@@ -0,0 +1,113 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "http.h"
+#include "config.h"
+
+enum metric {
+  METRIC_PACKETS = 0,       // frames handed over by pcap
+  METRIC_PROBES_QUEUED,
+  METRIC_PROBES_LOGGED,
+  METRIC_PROBES_IGNORED,
+  METRIC_PROBES_DROPPED,    // no record left in the pool
+  METRIC_MAC_CACHE_HITS,
+  METRIC_MAC_CACHE_MISSES,
+  METRIC_SSID_CACHE_HITS,
+  METRIC_SSID_CACHE_MISSES,
+  METRIC_DB_ERRORS,
+  METRIC_UPLINK_RECORDS,    // sent to the collector
+  METRIC_UPLINK_BYTES,
+  METRIC_MAC_FILTER_SKIPPED,          // searches of a new mac avoided by the filter
+  METRIC_MAC_FILTER_FALSE_POSITIVES,
+  METRIC_EPHEMERAL_PROBES,            // of randomized macs, in the ephemeral table (-e)
+  METRIC_MEMORY_RELEASES,             // the process was above the memory budget (-M)
+  METRICS
+};
+
+enum histogram {
+  HISTOGRAM_ENQUEUE_WAIT = 0, // time spent waiting for room in the queue
+  HISTOGRAM_INSERT,           // insert_probereq/insert_probeburst
+  HISTOGRAM_COMMIT,           // commit_txn
+  HISTOGRAMS
+};
+
+enum gauge {
+  GAUGE_QUEUE_DEPTH = 0,
+  GAUGE_WRITER_QUEUE_DEPTH,
+  GAUGE_PCAP_RECEIVED,
+  GAUGE_PCAP_DROPPED,       // by the kernel, the buffer being full
+  GAUGE_PCAP_IFDROPPED,     // by the interface or its driver
+  GAUGE_UPLINK_BACKLOG,     // batches not acknowledged by the collector
+  GAUGE_SESSIONS_OPEN,
+  GAUGE_UNIQUES_SKETCHES,   // HyperLogLog sketches of the current periods
+  GAUGE_UNIQUES_BYTES,
+  GAUGE_MAC_FILTER_BYTES,
+  GAUGE_MAC_FILTER_FPR,     // expected false positive rate, in ppm
+  GAUGES
+};
+
+struct histogram_data {
+  uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];  // by power of 2 of ns, from 1 µs
+  uint64_t count;
+  uint64_t sum;             // in ns
+};
+
+// counters and histograms written by a single thread, read by anyone
+typedef struct metrics_thread {
+  const char *name;
+  uint64_t counters[METRICS];
+  struct histogram_data histograms[HISTOGRAMS];
+} metrics_thread_t;
+
+extern __thread metrics_thread_t *metrics_local;
+extern uint64_t metrics_gauges[GAUGES];
+
+metrics_thread_t *metrics_register(const char *name);
+void metrics_write(FILE *f);
+void metrics_dump(FILE *f);
+void metrics_routes(http_server_t *server);
+
+// the owner thread is the only writer, so relaxed stores are enough for the
+// readers to never see torn values
+static inline void metrics_add(enum metric m, uint64_t v)
+{
+  metrics_thread_t *t = metrics_local;
+  if (t) {
+    __atomic_store_n(&t->counters[m], t->counters[m] + v, __ATOMIC_RELAXED);
+  }
+}
+
+static inline void metrics_set(enum gauge g, uint64_t v)
+{
+  __atomic_store_n(&metrics_gauges[g], v, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t metrics_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void metrics_observe(enum histogram h, uint64_t ns)
+{
+  metrics_thread_t *t = metrics_local;
+  if (t == NULL) {
+    return;
+  }
+  struct histogram_data *d = &t->histograms[h];
+  // bucket i holds the durations up to 2^(10+i) ns
+  int i = ns <= 1024 ? 0 : 64 - __builtin_clzll(ns - 1) - 10;
+  if (i >= METRICS_HISTOGRAM_BUCKETS) {
+    i = METRICS_HISTOGRAM_BUCKETS - 1;
+  }
+  __atomic_store_n(&d->buckets[i], d->buckets[i] + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->count, d->count + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->sum, d->sum + ns, __ATOMIC_RELAXED);
+}
+
+#endif
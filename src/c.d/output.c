@@ -0,0 +1,237 @@
+/*
+format the probe requests logged to stdout into a reusable buffer, written out
+in batches, as text, JSON Lines or CSV
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "output.h"
+#include "parsers.h"
+
+// the longest record we can append (a JSON line with every character escaped)
+#define MAX_RECORD_LENGTH 1024
+
+static inline void put_char(output_t *out, char c)
+{
+  out->buf[out->len++] = c;
+}
+
+static inline void put_str(output_t *out, const char *s, size_t len)
+{
+  memcpy(out->buf + out->len, s, len);
+  out->len += len;
+}
+
+// put s, cut with trailing dots or padded with spaces to exactly width characters
+static void put_fixed(output_t *out, const char *s, size_t width, size_t keep)
+{
+  size_t len = strlen(s);
+  if (len >= width) {
+    put_str(out, s, keep);
+    for (size_t i = keep; i < width; i++) {
+      put_char(out, '.');
+    }
+  } else {
+    put_str(out, s, len);
+    for (size_t i = len; i < width; i++) {
+      put_char(out, ' ');
+    }
+  }
+}
+
+static void put_json_str(output_t *out, const char *s)
+{
+  static const char hex[] = "0123456789abcdef";
+  put_char(out, '"');
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      put_char(out, '\\');
+      put_char(out, c);
+    } else if (c < 0x20) {
+      put_str(out, "\\u00", 4);
+      put_char(out, hex[c >> 4]);
+      put_char(out, hex[c & 0xf]);
+    } else {
+      put_char(out, c);
+    }
+  }
+  put_char(out, '"');
+}
+
+static void put_csv_str(output_t *out, const char *s)
+{
+  if (strpbrk(s, ",\"\r\n") == NULL) {
+    put_str(out, s, strlen(s));
+    return;
+  }
+  put_char(out, '"');
+  for (; *s; s++) {
+    if (*s == '"') {
+      put_char(out, '"');
+    }
+    put_char(out, *s);
+  }
+  put_char(out, '"');
+}
+
+static void put_int(output_t *out, int64_t v)
+{
+  char tmp[24];
+  int i = sizeof(tmp);
+  bool neg = v < 0;
+  uint64_t u = neg ? -(uint64_t)v : (uint64_t)v;
+  do {
+    tmp[--i] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (neg) {
+    tmp[--i] = '-';
+  }
+  put_str(out, tmp + i, sizeof(tmp) - i);
+}
+
+static void put_timestamp(output_t *out, struct timeval tv)
+{
+  put_int(out, tv.tv_sec);
+  put_char(out, '.');
+  char usec[6];
+  long u = tv.tv_usec;
+  for (int i = 5; i >= 0; i--) {
+    usec[i] = '0' + u % 10;
+    u /= 10;
+  }
+  put_str(out, usec, 6);
+}
+
+static void put_hex64(output_t *out, uint64_t v)
+{
+  static const char hex[] = "0123456789abcdef";
+  for (int i = 60; i >= 0; i -= 4) {
+    put_char(out, hex[(v >> i) & 0xf]);
+  }
+}
+
+int parse_output_format(const char *name, enum output_format *format)
+{
+  if (strcmp(name, "text") == 0) {
+    *format = OUTPUT_TEXT;
+  } else if (strcmp(name, "json") == 0) {
+    *format = OUTPUT_JSON;
+  } else if (strcmp(name, "csv") == 0) {
+    *format = OUTPUT_CSV;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+void output_init(output_t *out, enum output_format format, FILE *stream)
+{
+  out->format = format;
+  out->stream = stream;
+  out->len = 0;
+  out->date_sec = -1;
+  clock_gettime(CLOCK_MONOTONIC, &out->last_flush);
+}
+
+// once, before the workers start: each has its own output_t on the same stream
+void output_header(enum output_format format, FILE *stream)
+{
+  if (format == OUTPUT_CSV) {
+    fputs("date,timestamp,mac,laa,vendor,ssid,rssi,fingerprint\n", stream);
+    fflush(stream);
+  }
+}
+
+void output_probereq(output_t *out, const probereq_t *pr)
+{
+  // only format the date once per second
+  if (pr->tv.tv_sec != out->date_sec) {
+    struct tm tm;
+    time_t sec = pr->tv.tv_sec;
+    strftime(out->date, sizeof(out->date), "%Y-%m-%d %H:%M:%S", localtime_r(&sec, &tm));
+    out->date_sec = pr->tv.tv_sec;
+  }
+  bool laa = is_laa(pr->mac);
+
+  switch (out->format) {
+    case OUTPUT_TEXT:
+      put_str(out, out->date, 19);
+      put_char(out, '\t');
+      put_str(out, pr->mac, 17);
+      if (laa) {
+        put_str(out, " (LAA)", 6);
+      }
+      put_char(out, '\t');
+      put_fixed(out, pr->vendor, MAX_VENDOR_LENGTH, MAX_VENDOR_LENGTH-3);
+      put_char(out, '\t');
+      put_fixed(out, pr->ssid_str, MAX_SSID_LENGTH, MAX_SSID_LENGTH-3);
+      put_char(out, '\t');
+      {
+        // rssi is left aligned on 3 characters
+        size_t start = out->len;
+        put_int(out, pr->rssi);
+        while (out->len - start < 3) {
+          put_char(out, ' ');
+        }
+      }
+      break;
+    case OUTPUT_JSON:
+      put_str(out, "{\"date\":\"", 9);
+      put_str(out, out->date, 19);
+      put_str(out, "\",\"timestamp\":", 14);
+      put_timestamp(out, pr->tv);
+      put_str(out, ",\"mac\":\"", 8);
+      put_str(out, pr->mac, 17);
+      put_str(out, laa ? "\",\"laa\":true" : "\",\"laa\":false", laa ? 12 : 13);
+      put_str(out, ",\"vendor\":", 10);
+      put_json_str(out, pr->vendor);
+      put_str(out, ",\"ssid\":", 8);
+      put_json_str(out, pr->ssid_str);
+      put_str(out, ",\"rssi\":", 8);
+      put_int(out, pr->rssi);
+      put_str(out, ",\"fingerprint\":\"", 16);
+      put_hex64(out, pr->fingerprint);
+      put_str(out, "\"}", 2);
+      break;
+    case OUTPUT_CSV:
+      put_str(out, out->date, 19);
+      put_char(out, ',');
+      put_timestamp(out, pr->tv);
+      put_char(out, ',');
+      put_str(out, pr->mac, 17);
+      put_str(out, laa ? ",1," : ",0,", 3);
+      put_csv_str(out, pr->vendor);
+      put_char(out, ',');
+      put_csv_str(out, pr->ssid_str);
+      put_char(out, ',');
+      put_int(out, pr->rssi);
+      put_char(out, ',');
+      put_hex64(out, pr->fingerprint);
+      break;
+  }
+  put_char(out, '\n');
+
+  // write the buffer when it is nearly full or after some time
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t elapsed = (int64_t)(now.tv_sec - out->last_flush.tv_sec) * 1000
+    + (now.tv_nsec - out->last_flush.tv_nsec) / 1000000;
+  if (out->len > OUTPUT_BUFFER_SIZE - MAX_RECORD_LENGTH || elapsed >= OUTPUT_FLUSH_TIME) {
+    output_flush(out);
+  }
+}
+
+void output_flush(output_t *out)
+{
+  if (out->len) {
+    fwrite(out->buf, 1, out->len, out->stream);
+    out->len = 0;
+  }
+  fflush(out->stream);
+  clock_gettime(CLOCK_MONOTONIC, &out->last_flush);
+}
@@ -0,0 +1,34 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "logger_thread.h"
+#include "config.h"
+
+enum output_format {
+  OUTPUT_TEXT = 0,
+  OUTPUT_JSON,    // JSON Lines
+  OUTPUT_CSV
+};
+
+// buffered formatter of the probe requests logged to stdout
+typedef struct output {
+  enum output_format format;
+  FILE *stream;
+  char buf[OUTPUT_BUFFER_SIZE];
+  size_t len;
+  time_t date_sec;          // second of the cached formatted date
+  char date[20];
+  struct timespec last_flush;
+} output_t;
+
+int parse_output_format(const char *name, enum output_format *format);
+void output_init(output_t *out, enum output_format format, FILE *stream);
+void output_header(enum output_format format, FILE *stream);
+void output_probereq(output_t *out, const probereq_t *pr);
+void output_flush(output_t *out);
+
+#endif
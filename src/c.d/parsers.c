@@ -6,12 +6,31 @@
 #include <stdbool.h>
 
 #include "radiotap_iter.h"
+#include "platform.h"
 #include "parsers.h"
 #include "logger_thread.h"
 #include "base64.h"
+#include "utf8.h"
+#include "trace.h"
 #include "config.h"
 
-int8_t parse_radiotap_header(const uint8_t * packet, uint16_t * freq, int8_t * rssi)
+// offsets of the radiotap fields we need, for a given chain of present words.
+// A driver emits the same layout for every frame, so we only need to run the
+// radiotap iterator once per layout
+struct radiotap_layout {
+  uint32_t present[RADIOTAP_MAX_PRESENT];
+  uint8_t n_present;
+  int16_t channel;        // offset from the start of the header, -1 if absent
+  int16_t antsignal;
+  int16_t flags;
+  int16_t rx_flags;
+};
+
+static struct radiotap_layout layouts[RADIOTAP_LAYOUT_CACHE_SIZE];
+static int layouts_count = 0, layouts_next = 0;
+
+static int8_t parse_radiotap_header_slow(const uint8_t * packet, uint16_t * freq, int8_t * rssi,
+  uint8_t *flags, uint16_t *rx_flags, struct radiotap_layout *layout)
 {
   // parse radiotap header to get frequency and rssi
   // returns radiotap header size or -1 on error
@@ -46,211 +65,222 @@ int8_t parse_radiotap_header(const uint8_t * packet, uint16_t * freq, int8_t * r
       ieee80211_radiotap_iterator_init(&iter, rtaphdr, rtaphdr->it_len,
                                        &vns);
   if (err) {
-    printf("Error: malformed radiotap header (init returned %d)\n", err);
+    fprintf(stderr, "Error: malformed radiotap header (init returned %d)\n", err);
     return -1;
   }
 
   *freq = 0;
   *rssi = 0;
-  // iterate through radiotap fields and look for frequency and rssi
+  *flags = 0;
+  *rx_flags = 0;
+  // iterate through radiotap fields and look for frequency, rssi and flags
   while (!(err = ieee80211_radiotap_iterator_next(&iter))) {
+    if (iter.this_arg_index == IEEE80211_RADIOTAP_FLAGS && iter.is_radiotap_ns
+      && layout->flags < 0) {
+      *flags = *iter.this_arg;
+      layout->flags = iter.this_arg - packet;
+    }
+    if (iter.this_arg_index == IEEE80211_RADIOTAP_RX_FLAGS && iter.is_radiotap_ns
+      && layout->rx_flags < 0) {
+      *rx_flags = get_unaligned_le16(iter.this_arg);
+      layout->rx_flags = iter.this_arg - packet;
+    }
     if (iter.this_arg_index == IEEE80211_RADIOTAP_CHANNEL) {
       assert(iter.this_arg_size == 4);  // XXX: why ?
       *freq = iter.this_arg[0] + (iter.this_arg[1] << 8);
       //flags = iter.this_arg[2] + (iter.this_arg[3] << 8);
+      if (layout->channel < 0 && iter.is_radiotap_ns) {
+        layout->channel = iter.this_arg - packet;
+      }
     }
     if (iter.this_arg_index == IEEE80211_RADIOTAP_DBM_ANTSIGNAL) {
       r = (int8_t) * iter.this_arg;
-      if (r != 0)
+      if (r != 0 && *rssi == 0)
         *rssi = r;              // XXX: why do we get multiple dBm_antSignal with 0 value after the first one ?
+      if (layout->antsignal < 0 && iter.is_radiotap_ns) {
+        layout->antsignal = iter.this_arg - packet;
+      }
     }
-    if (*freq != 0 && *rssi != 0)
-      break;
   }
   return offset;
 }
 
-void parse_probereq_frame(const uint8_t *packet, uint32_t packet_len,
-  int8_t offset, char **mac, uint8_t **ssid, uint8_t *ssid_len)
+// read the chain of present words; returns the number of words or -1 if we can't cache it
+static int read_present_words(const uint8_t *packet, uint16_t it_len, uint32_t *present)
 {
-  *mac = malloc(18 * sizeof(char));
-  // parse the probe request frame to look for mac and Information Element we need (ssid)
-  // SA
-  const uint8_t *sa_addr = packet + offset + 2 + 2 + 6;   // FC + duration + DA
-  sprintf(*mac, "%02x:%02x:%02x:%02x:%02x:%02x", sa_addr[0],
-    sa_addr[1], sa_addr[2], sa_addr[3], sa_addr[4], sa_addr[5]);
-
-  *ssid = NULL;
-  uint8_t *ie = (uint8_t *)sa_addr + 6 + 6 + 2 ; // + SA + BSSID + Seqctl
-  uint8_t ie_len = *(ie + 1);
-  *ssid_len = 0;
+  const uint8_t *p = packet + 4;
+  int n = 0;
+  uint32_t word;
 
-  // iterate over Information Element to look for SSID
-  while (ie < packet + packet_len) {
-    if ((ie + ie_len + 2 <= packet + packet_len)) {     // just double check that this is an IE with length inside packet
-      if (*ie == 0) { // SSID aka IE with id 0
-        *ssid_len = *(ie + 1);
-        if (*ssid_len > 32) {
-          fprintf(stderr, "Warning: detected SSID greater than 32 bytes. Cutting it to 32 bytes.");
-          *ssid_len = 32;
-        }
-        *ssid = malloc((*ssid_len) * sizeof(uint8_t));        // AP name
-        memcpy(*ssid, ie+2, *ssid_len);
-        break;
-      }
+  do {
+    if (n == RADIOTAP_MAX_PRESENT || p + 4 > packet + it_len) {
+      return -1;
     }
-    ie = ie + ie_len + 2;
-    ie_len = *(ie + 1);
-  }
-  return;
+    word = get_unaligned_le32(p);
+    // the length of vendor namespaces is read from the data, so offsets can't be cached
+    if (word & (1 << IEEE80211_RADIOTAP_VENDOR_NAMESPACE)) {
+      return -1;
+    }
+    present[n++] = word;
+    p += 4;
+  } while (word & (1U << IEEE80211_RADIOTAP_EXT));
+
+  return n;
 }
 
-char *probereq_to_str(probereq_t pr)
+int8_t parse_radiotap_header(const uint8_t * packet, uint16_t * freq, int8_t * rssi,
+  uint8_t *flags, uint16_t *rx_flags)
 {
-  char tmp[1024], vendor[MAX_VENDOR_LENGTH+1], ssid[MAX_SSID_LENGTH+1], datetime[20], rssi[5];
-  char *pr_str;
-
-  strftime(datetime, 20, "%Y-%m-%d %H:%M:%S", localtime(&pr.tv.tv_sec));
+  struct radiotap_layout uncached = { .channel = -1, .antsignal = -1, .flags = -1, .rx_flags = -1 };
+  uint16_t it_len = get_unaligned_le16(packet + 2);
+  uint32_t present[RADIOTAP_MAX_PRESENT];
+  int n = read_present_words(packet, it_len, present);
 
-  char *first = strndup(pr.mac, 2);
-  bool is_laa = strtoll(first, NULL, 16) & 0x2;
-  free(first);
+  if (n < 0) {
+    return parse_radiotap_header_slow(packet, freq, rssi, flags, rx_flags, &uncached);
+  }
 
-  // cut or pad vendor string
-  if (strlen(pr.vendor) >= MAX_VENDOR_LENGTH) {
-      strncpy(vendor, pr.vendor, MAX_VENDOR_LENGTH-1);
-      for (int i=MAX_VENDOR_LENGTH-3; i<MAX_VENDOR_LENGTH; i++) {
-        vendor[i] = '.';
-      }
-      vendor[MAX_VENDOR_LENGTH] = '\0';
-  } else {
-    strcpy(vendor, pr.vendor);
-    for (int i=strlen(pr.vendor); i<MAX_VENDOR_LENGTH; i++) {
-      vendor[i] = ' ';
+  for (int i = 0; i < layouts_count; i++) {
+    struct radiotap_layout *l = &layouts[i];
+    if (l->n_present != n || memcmp(l->present, present, n * sizeof(uint32_t))) {
+      continue;
+    }
+    if (l->channel + 4 > it_len || l->antsignal + 1 > it_len
+      || l->flags + 1 > it_len || l->rx_flags + 2 > it_len) {
+      break;
     }
-    vendor[MAX_VENDOR_LENGTH] = '\0';
+    *rssi = l->antsignal < 0 ? 0 : (int8_t)packet[l->antsignal];
+    if (l->antsignal >= 0 && *rssi == 0) {
+      // let the iterator look for another dBm_antSignal
+      break;
+    }
+    *freq = l->channel < 0 ? 0 : get_unaligned_le16(packet + l->channel);
+    *flags = l->flags < 0 ? 0 : packet[l->flags];
+    *rx_flags = l->rx_flags < 0 ? 0 : get_unaligned_le16(packet + l->rx_flags);
+    return (int8_t)it_len;
   }
-  // is ssid a valid utf-8 string
-  memcpy(tmp, pr.ssid, pr.ssid_len);
-  tmp[pr.ssid_len] = '\0';
 
-  if (!is_utf8(tmp)) {
-    // base64 encode the ssid
-    size_t length;
-    char * b64tmp = base64_encode((unsigned char *)tmp, pr.ssid_len, &length);
-    strcpy(tmp, "b64_");
-    strncat(tmp, b64tmp, length);
-    free(b64tmp);
+  // unseen layout: run the iterator and remember the offsets
+  struct radiotap_layout layout = { .n_present = n, .channel = -1, .antsignal = -1, .flags = -1, .rx_flags = -1 };
+  memcpy(layout.present, present, n * sizeof(uint32_t));
+  int8_t offset = parse_radiotap_header_slow(packet, freq, rssi, flags, rx_flags, &layout);
+  if (offset < 0) {
+    return offset;
   }
-  // cut or pad ssid string
-  if (strlen(tmp) >= MAX_SSID_LENGTH) {
-      strncpy(ssid, tmp, MAX_SSID_LENGTH);
-      for (int i=MAX_SSID_LENGTH-3; i<MAX_SSID_LENGTH; i++) {
-        ssid[i] = '.';
-      }
-      ssid[MAX_SSID_LENGTH] = '\0';
-  } else {
-    strcpy(ssid, tmp);
-    for (int i=strlen(tmp); i<MAX_SSID_LENGTH; i++) {
-      ssid[i] = ' ';
+  for (int i = 0; i < layouts_count; i++) {
+    if (layouts[i].n_present == n && !memcmp(layouts[i].present, present, n * sizeof(uint32_t))) {
+      return offset;
     }
-    ssid[MAX_SSID_LENGTH] = '\0';
   }
+  layouts[layouts_next] = layout;
+  layouts_next = (layouts_next + 1) % RADIOTAP_LAYOUT_CACHE_SIZE;
+  if (layouts_count < RADIOTAP_LAYOUT_CACHE_SIZE) {
+    layouts_count++;
+  }
+
+  return offset;
+}
 
-  sprintf(rssi, "%-3d", pr.rssi);
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
 
-  tmp[0] = '\0';
-  strcat(tmp, datetime);
-  strcat(tmp, "\t");
-  strcat(tmp, pr.mac);
-  if (is_laa) {
-    strcat(tmp, " (LAA)");
+static inline uint64_t fnv64(uint64_t h, const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    h ^= data[i];
+    h *= FNV64_PRIME;
   }
-  strcat(tmp, "\t");
-  strcat(tmp, vendor);
-  strcat(tmp, "\t");
-  strcat(tmp, ssid);
-  strcat(tmp, "\t");
-  strcat(tmp, rssi);
+  return h;
+}
 
-  pr_str = strdup(tmp);
+// add an Information Element to the fingerprint of the device: the id of every IE
+// (in order) and the content of the ones describing the capabilities of the chipset
+static inline uint64_t fingerprint_ie(uint64_t h, const uint8_t *ie)
+{
+  uint8_t id = ie[0], len = ie[1];
 
-  return pr_str;
+  h = fnv64(h, &id, 1);
+  switch (id) {
+    case 1:     // supported rates
+    case 45:    // HT capabilities
+    case 50:    // extended supported rates
+    case 127:   // extended capabilities
+    case 191:   // VHT capabilities
+      h = fnv64(h, ie + 2, len);
+      break;
+    case 221:   // vendor specific: OUI and type only
+      h = fnv64(h, ie + 2, len < 4 ? len : 4);
+      break;
+    case 255:   // element id extension
+      if (len > 0) {
+        h = fnv64(h, ie + 2, 1);
+      }
+      break;
+    default:    // ssid, ds parameter set, ...: their content depends on the network or channel
+      break;
+  }
+  return h;
 }
 
-// from https://stackoverflow.com/a/1031773/283067
-bool is_utf8(const char * string)
+// parse the probe request frame in a single pass over the Information Elements, to get
+// the source mac, the sequence number, the ssid and a fingerprint of the IE layout, into
+// the buffers of the caller: mac holds 18 chars and ssid 32 bytes
+// returns 0 on success, -1 if the frame is too short
+int parse_probereq_frame(const uint8_t *packet, uint32_t packet_len,
+  int8_t offset, char *mac, uint16_t *seq, uint8_t *ssid, uint8_t *ssid_len, uint64_t *fingerprint)
 {
-  if (!string) {
-    return 0;
+  const uint8_t *end = packet + packet_len;
+  bool ssid_found = false;
+
+  *ssid_len = 0;
+  *fingerprint = 0;
+  // FC + duration + DA + SA + BSSID + Seqctl
+  if (offset < 0 || packet + offset + 24 > end) {
+    mac[0] = '\0';
+    return -1;
   }
 
-  const unsigned char * bytes = (const unsigned char *)string;
-  while(*bytes) {
-    if ( (// ASCII
-      // use bytes[0] <= 0x7F to allow ASCII control characters
-      bytes[0] == 0x09 ||
-      bytes[0] == 0x0A ||
-      bytes[0] == 0x0D ||
-      (0x20 <= bytes[0] && bytes[0] <= 0x7E)
-    ) ) {
-      bytes += 1;
-      continue;
-    }
+  // SA
+  const uint8_t *sa_addr = packet + offset + 2 + 2 + 6;   // FC + duration + DA
+  sprintf(mac, "%02x:%02x:%02x:%02x:%02x:%02x", sa_addr[0],
+    sa_addr[1], sa_addr[2], sa_addr[3], sa_addr[4], sa_addr[5]);
 
-    if( (// non-overlong 2-byte
-      (0xC2 <= bytes[0] && bytes[0] <= 0xDF) &&
-      (0x80 <= bytes[1] && bytes[1] <= 0xBF)
-    ) ) {
-      bytes += 2;
-      continue;
-    }
+  // the sequence number is the 12 high bits of the sequence control
+  *seq = get_unaligned_le16(sa_addr + 6 + 6) >> 4;
 
-    if( (// excluding overlongs
-      bytes[0] == 0xE0 &&
-      (0xA0 <= bytes[1] && bytes[1] <= 0xBF) &&
-      (0x80 <= bytes[2] && bytes[2] <= 0xBF)
-    ) ||
-    (// straight 3-byte
-      ((0xE1 <= bytes[0] && bytes[0] <= 0xEC) ||
-      bytes[0] == 0xEE ||
-      bytes[0] == 0xEF) &&
-      (0x80 <= bytes[1] && bytes[1] <= 0xBF) &&
-      (0x80 <= bytes[2] && bytes[2] <= 0xBF)
-    ) ||
-    (// excluding surrogates
-      bytes[0] == 0xED &&
-      (0x80 <= bytes[1] && bytes[1] <= 0x9F) &&
-      (0x80 <= bytes[2] && bytes[2] <= 0xBF)
-    ) ) {
-      bytes += 3;
-      continue;
-    }
+  const uint8_t *ie = sa_addr + 6 + 6 + 2 ; // + SA + BSSID + Seqctl
+  uint64_t h = FNV64_OFFSET;
 
-    if( (// planes 1-3
-      bytes[0] == 0xF0 &&
-      (0x90 <= bytes[1] && bytes[1] <= 0xBF) &&
-      (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
-      (0x80 <= bytes[3] && bytes[3] <= 0xBF)
-    ) ||
-    (// planes 4-15
-      (0xF1 <= bytes[0] && bytes[0] <= 0xF3) &&
-      (0x80 <= bytes[1] && bytes[1] <= 0xBF) &&
-      (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
-      (0x80 <= bytes[3] && bytes[3] <= 0xBF)
-    ) ||
-    (// plane 16
-      bytes[0] == 0xF4 &&
-      (0x80 <= bytes[1] && bytes[1] <= 0x8F) &&
-      (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
-      (0x80 <= bytes[3] && bytes[3] <= 0xBF)
-    ) ) {
-      bytes += 4;
-      continue;
+  TRACE_BEGIN(IE_WALK);
+  // iterate over all the Information Elements that fit inside the packet
+  while (ie + 2 <= end && ie + 2 + ie[1] <= end) {
+    if (*ie == 0 && !ssid_found) { // SSID aka IE with id 0
+      ssid_found = true;
+      *ssid_len = *(ie + 1);
+      if (*ssid_len > 32) {
+        fprintf(stderr, "Warning: detected SSID greater than 32 bytes. Cutting it to 32 bytes.");
+        *ssid_len = 32;
+      }
+      memcpy(ssid, ie+2, *ssid_len);        // AP name
     }
-
-    return 0;
+    h = fingerprint_ie(h, ie);
+    ie = ie + ie[1] + 2;
   }
+  *fingerprint = h;
+  TRACE_END(IE_WALK);
+
+  return 0;
+}
 
-  return 1;
+// ssid as stored in the db and printed: as is if it is valid utf-8, base64 encoded
+// and prefixed with "b64_" otherwise. ssid_str must hold at least 4+44+1 bytes
+void ssid_to_str(const uint8_t *ssid, uint8_t ssid_len, char *ssid_str)
+{
+  if (is_utf8(ssid, ssid_len)) {
+    memcpy(ssid_str, ssid, ssid_len);
+    ssid_str[ssid_len] = '\0';
+  } else {
+    memcpy(ssid_str, "b64_", 4);
+    base64_encode_to(ssid, ssid_len, ssid_str + 4);
+  }
 }
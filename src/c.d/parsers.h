@@ -3,17 +3,32 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <strings.h>
 
 #include "logger_thread.h"
 
 int8_t parse_radiotap_header(const uint8_t * packet, uint16_t * freq,
-                                    int8_t * rssi);
+                                    int8_t * rssi, uint8_t *flags, uint16_t *rx_flags);
 
-void parse_probereq_frame(const uint8_t *packet, uint32_t header_len,
-  int8_t offset, char **mac, uint8_t **ssid, uint8_t *ssid_len);
+int parse_probereq_frame(const uint8_t *packet, uint32_t packet_len,
+  int8_t offset, char *mac, uint16_t *seq, uint8_t *ssid, uint8_t *ssid_len, uint64_t *fingerprint);
 
-char *probereq_to_str(probereq_t pr);
+void ssid_to_str(const uint8_t *ssid, uint8_t ssid_len, char *ssid_str);
 
-bool is_utf8(const char * string);
+// the U/L bit is the second least significant bit of the first octet, ie of its second hex digit
+static inline bool is_laa(const char *mac)
+{
+  char c = mac[1];
+  int v = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+  return v & 0x2;
+}
+
+// a filter matches a whole mac, or its beginning when it is shorter, like in the python stats
+static inline bool mac_matches(const char *mac, const char *filter)
+{
+  size_t len = strlen(filter);
+  return len == 17 ? strcasecmp(mac, filter) == 0 : strncasecmp(mac, filter, len) == 0;
+}
 
 #endif
@@ -0,0 +1,159 @@
+/*
+slab pools of fixed-size objects, for the records allocated for each packet
+(probe requests, bursts, batches). A freed object goes back to the free list
+of its pool, for the next packet, instead of back to malloc: no fragmentation,
+and a resident memory that only grows with the peak number of objects in flight.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "config.h"
+
+#define ALIGNMENT 16
+
+struct slab {
+  struct slab *next;
+  uint8_t pad[ALIGNMENT - sizeof(struct slab *)];
+  uint8_t items[];
+};
+
+static pool_t *pools = NULL;
+static pthread_mutex_t mutex_pools = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t stride(const pool_t *pool)
+{
+  size_t size = pool->item_size < sizeof(void *) ? sizeof(void *) : pool->item_size;
+  return (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+static int grow(pool_t *pool)
+{
+  size_t size = stride(pool);
+  struct slab *slab = malloc(sizeof(struct slab) + POOL_SLAB_ITEMS * size);
+  if (slab == NULL) {
+    return -1;
+  }
+
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  for (int i = POOL_SLAB_ITEMS - 1; i >= 0; i--) {
+    void **item = (void **)(slab->items + i * size);
+    *item = pool->free_items;
+    pool->free_items = item;
+  }
+  pool->capacity += POOL_SLAB_ITEMS;
+
+  return 0;
+}
+
+void *pool_alloc(pool_t *pool)
+{
+  bool first_slab = false;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->free_items == NULL) {
+    first_slab = pool->slabs == NULL;
+    if (grow(pool)) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+  }
+  void **item = pool->free_items;
+  pool->free_items = *item;
+  pool->allocs++;
+  if (++pool->in_use > pool->peak) {
+    pool->peak = pool->in_use;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (first_slab) {
+    // now listed in the stats
+    pthread_mutex_lock(&mutex_pools);
+    pool->next = pools;
+    pools = pool;
+    pthread_mutex_unlock(&mutex_pools);
+  }
+
+  return item;
+}
+
+void pool_free(pool_t *pool, void *item)
+{
+  if (item == NULL) return;
+
+  pthread_mutex_lock(&pool->lock);
+  *(void **)item = pool->free_items;
+  pool->free_items = item;
+  pool->in_use--;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void release(pool_t *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  struct slab *slab = pool->slabs;
+  while (slab) {
+    struct slab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  pool->slabs = NULL;
+  pool->free_items = NULL;
+  pool->capacity = 0;
+  pool->in_use = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// give the slabs back to malloc; no object of the pool may be in use
+void pool_release(pool_t *pool)
+{
+  pthread_mutex_lock(&mutex_pools);
+  for (pool_t **p = &pools; *p; p = &(*p)->next) {
+    if (*p == pool) {
+      *p = pool->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mutex_pools);
+
+  release(pool);
+}
+
+// on exit, once the threads using the pools have stopped
+void pool_release_all(void)
+{
+  pthread_mutex_lock(&mutex_pools);
+  while (pools) {
+    pool_t *pool = pools;
+    pools = pool->next;
+    release(pool);
+  }
+  pthread_mutex_unlock(&mutex_pools);
+}
+
+// stats of the pools in use; returns their number
+int pool_stats(struct pool_stats *stats, int max)
+{
+  int n = 0;
+
+  pthread_mutex_lock(&mutex_pools);
+  for (pool_t *pool = pools; pool && n < max; pool = pool->next) {
+    pthread_mutex_lock(&pool->lock);
+    stats[n].name = pool->name;
+    stats[n].item_size = pool->item_size;
+    stats[n].capacity = pool->capacity;
+    stats[n].in_use = pool->in_use;
+    stats[n].peak = pool->peak;
+    stats[n].allocs = pool->allocs;
+    stats[n].bytes = pool->capacity / POOL_SLAB_ITEMS * (sizeof(struct slab) + POOL_SLAB_ITEMS * stride(pool));
+    pthread_mutex_unlock(&pool->lock);
+    n++;
+  }
+  pthread_mutex_unlock(&mutex_pools);
+
+  return n;
+}
@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "config.h"
+
+// fixed-size objects carved out of slabs that are never given back to malloc:
+// once the pipeline has warmed up, the memory used stays flat
+typedef struct pool {
+  const char *name;
+  size_t item_size;
+  pthread_mutex_t lock;
+  void *free_items;
+  void *slabs;
+  uint64_t capacity;          // items in the slabs
+  uint64_t in_use;
+  uint64_t peak;
+  uint64_t allocs;
+  struct pool *next;          // registered pools, for the stats
+} pool_t;
+
+#define POOL_INITIALIZER(name, type) \
+  { name, sizeof(type), PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0, 0, 0, NULL }
+
+struct pool_stats {
+  const char *name;
+  size_t item_size;
+  uint64_t capacity;
+  uint64_t in_use;
+  uint64_t peak;
+  uint64_t allocs;
+  uint64_t bytes;             // held in slabs
+};
+
+void *pool_alloc(pool_t *pool);
+void pool_free(pool_t *pool, void *item);
+void pool_release(pool_t *pool);
+void pool_release_all(void);
+int pool_stats(struct pool_stats *stats, int max);
+
+#endif
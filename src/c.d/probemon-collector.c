@@ -0,0 +1,117 @@
+// collector of the probe requests sent by probemon sensors (probemon -C), into a single db
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <inttypes.h>
+
+#include "collector.h"
+#include "db.h"
+#include "config.h"
+
+static collector_t *collector = NULL;
+
+static void sigint_handler(int s)
+{
+  collector_stop(collector);
+}
+
+static void usage(void)
+{
+  printf("Usage: probemon-collector -l [ADDR:]PORT [-d DB_NAME] [-t TOLERANCE] [-g GAP] [-p POLICY]\n");
+  printf("  -l [ADDR:]PORT  listen for sensors on ADDR (default 127.0.0.1) and PORT\n"
+         "  -d DB_NAME      explicitly set the db filename\n"
+         "  -t TOLERANCE    merge the probe requests heard by several sensors up to TOLERANCE ms apart (default %d, 0 to disable)\n"
+         "  -g GAP          close the session of a mac after GAP s without probe request (default %d, 0 to disable)\n"
+         "  -p POLICY       replacement policy of the mac and ssid caches: lru (default) or tinylfu\n",
+         DEDUP_TOLERANCE, SESSION_GAP
+       );
+}
+
+int main(int argc, char *argv[])
+{
+  const char *db_name = DB_NAME;
+  const char *address = NULL;
+  int tolerance = DEDUP_TOLERANCE;
+  int gap = SESSION_GAP;
+  lruc_policy cache_policy = LRUC_LRU;
+  sqlite3 *db;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:g:hl:p:t:V")) != -1) {
+    switch (opt) {
+    case 'h':
+      usage();
+      exit(EXIT_SUCCESS);
+      break;
+    case 'd':
+      db_name = optarg;
+      break;
+    case 'l':
+      address = optarg;
+      break;
+    case 'g':
+      gap = atoi(optarg);
+      if (gap < 0) {
+        fprintf(stderr, "Error: invalid session gap %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'p':
+      if (lruc_parse_policy(optarg, &cache_policy)) {
+        fprintf(stderr, "Error: unknown cache policy %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 't':
+      tolerance = atoi(optarg);
+      if (tolerance < 0) {
+        fprintf(stderr, "Error: invalid tolerance %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'V':
+      printf("%s-collector %s\nCopyright © 2020 solsTice d'Hiver\nLicense GPLv3+: GNU GPL version 3\n", NAME, VERSION);
+      exit(EXIT_SUCCESS);
+      break;
+    default:
+      usage();
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (address == NULL) {
+    fprintf(stderr, "Error: no address to listen on\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (init_probemon_db(db_name, &db) != SQLITE_OK) {
+    exit(EXIT_FAILURE);
+  }
+  if ((collector = collector_new(address, db, tolerance, gap, cache_policy)) == NULL) {
+    sqlite3_close(db);
+    exit(EXIT_FAILURE);
+  }
+
+  struct sigaction act;
+  act.sa_handler = sigint_handler;
+  act.sa_flags = 0;
+  sigemptyset(&act.sa_mask);
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGQUIT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+
+  printf(":: Collecting from sensors on %s, writing to %s\n", address, db_name);
+  printf("Hit CTRL+C to quit\n");
+  fflush(stdout);
+
+  collector_run(collector);
+
+  printf(":: Received %"PRIu64" batches (%"PRIu64" bytes), %"PRIu64" records, %"PRIu64" duplicate batches, "
+    "%"PRIu64" probe requests heard by several sensors\n",
+    collector->batches, collector->bytes, collector->records_count, collector->duplicates, collector->merged);
+  collector_free(collector);
+  sqlite3_close(db);
+
+  return EXIT_SUCCESS;
+}
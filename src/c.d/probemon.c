@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <pcap/pcap.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <string.h>
@@ -11,82 +12,98 @@
 #include <pthread.h>
 #include <time.h>
 #include <sqlite3.h>
+#include <inttypes.h>
+#include <getopt.h>
 #ifdef HAS_SYS_STAT_H
 #include <sys/stat.h>
 #endif
-#include <semaphore.h>
 
-#include "queue.h"
 #include "parsers.h"
+#include "reject.h"
 #include "logger_thread.h"
 #include "db.h"
+#include "lruc.h"
 #include "manuf.h"
 #include "config_yaml.h"
+#include "output.h"
+#include "stream.h"
+#include "http.h"
+#include "dashboard.h"
+#include "series.h"
+#include "session.h"
+#include "uniques.h"
+#include "topk.h"
+#include "metrics.h"
+#include "trace.h"
+#include "capture.h"
+#include "uplink.h"
+#include "pool.h"
+#include "budget.h"
+#include "loop.h"
+#include "globals.h"
 #include "config.h"
 
-pcap_t *handle;                 // global, to use it in sigint_handler
-queue_t *queue;                 // queue to hold parsed ap infos
-
-pthread_t logger;
-pthread_mutex_t mutex_queue = PTHREAD_MUTEX_INITIALIZER;
-sem_t queue_empty;
-sem_t queue_full;
 struct timespec start_ts_queue;
-bool option_stdout;
+int option_workers = 1;
 
-sqlite3 *db = NULL;
 int ret = 0;
 
-size_t ouidb_size;
-manuf_t *ouidb;
-uint64_t *ignored = NULL;
-int ignored_count = 0;
-
-void sigint_handler(int s)
-{
-  // stop pcap capture loop
-  pcap_breakloop(handle);
-}
-
-void process_packet(uint8_t * args, const struct pcap_pkthdr *header, const uint8_t *packet)
+char *option_stream = NULL;
+http_server_t *http = NULL;
+int option_gap = SESSION_GAP;
+size_t option_memory_budget = 0;
+char *option_http = NULL;
+char *option_collector = NULL;
+char *option_sensor = NULL;
+char *option_spool = NULL;
+
+// CTRL+C, quit and term stop the capture; USR1 dumps the stats
+void handle_signal(loop_t *loop, uint32_t signo, void *data)
 {
-  uint16_t freq;
-  int8_t rssi;
-  // parse radiotap header
-  int8_t offset = parse_radiotap_header(packet, &freq, &rssi);
-  if (offset < 0) {
+  if (signo == SIGUSR1) {
+    update_pcap_stats();
+    metrics_dump(stderr);
+    TRACE_REPORT(stderr);
     return;
   }
+  loop_stop(loop);
+}
 
-  char *mac;
-  uint8_t ssid_len, *ssid;
-
-  parse_probereq_frame(packet, header->len, offset, &mac, &ssid, &ssid_len);
-
-  probereq_t *pr = malloc(sizeof(probereq_t));
-  pr->tv.tv_sec = header->ts.tv_sec;
-  pr->tv.tv_usec = header->ts.tv_usec;
-  pr->mac = mac;
-  pr->ssid = ssid;
-  pr->ssid_len = ssid_len;
-  pr->vendor = NULL;
-  pr->rssi = rssi;
+// the pcap counters, and the frames of a capture buffer not full yet
+void handle_stats_timer(loop_t *loop, uint32_t expirations, void *data)
+{
+  update_pcap_stats();
+  capture_ready(loop, EPOLLIN, data);
+}
 
-  sem_wait(&queue_full);
-  pthread_mutex_lock(&mutex_queue);
-  enqueue(queue, pr);
-  pthread_mutex_unlock(&mutex_queue);
-  sem_post(&queue_empty);
+// the workers flush and the writer commits, even without new probe requests
+void handle_commit_timer(loop_t *loop, uint32_t expirations, void *data)
+{
+  flush_workers();
 }
 
 void usage(void)
 {
-  printf("Usage: probemon -i IFACE -c CHANNEL [-d DB_NAME] [-m MANUF_NAME] [-s]\n");
+  printf("Usage: probemon -i IFACE -c CHANNEL [-d DB_NAME] [-m MANUF_NAME] [-s] [-f FORMAT] [-w WINDOW] [-u SOCKET] [-H [ADDR:]PORT] [-j WORKERS] [-g GAP] [-e HOURS] [-p POLICY] [-M SIZE] [-C HOST:PORT [-n NAME] [-S SPOOL]]\n");
   printf("  -i IFACE        interface to use\n"
          "  -c CHANNEL      channel to sniff on\n"
          "  -d DB_NAME      explicitly set the db filename\n"
          "  -m MANUF_NAME   path to manuf file\n"
          "  -s              also log probe requests to stdout\n"
+         "  -f FORMAT       format of the stdout log: text (default), json or csv; implies -s\n"
+         "  -w WINDOW       coalesce repeated probe requests seen within WINDOW ms\n"
+         "  -u SOCKET       stream probe requests as protobuf messages on unix socket SOCKET\n"
+         "  -H [ADDR:]PORT  serve the dashboard queries, recent series, top talkers and metrics over http on ADDR (default 127.0.0.1) and PORT\n"
+         "  -j WORKERS      number of threads processing the probe requests before the db (default 1)\n"
+         "  -g GAP          close the session of a mac after GAP s without probe request (default %d, 0 to disable)\n"
+         "  -e HOURS        keep the probe requests of randomized macs apart, for HOURS h only\n"
+         "  -p POLICY       replacement policy of the mac and ssid caches: lru (default) or tinylfu\n"
+         "  -M, --memory-budget SIZE\n"
+         "                  size the caches, queues and indexes to use about SIZE bytes (or K, M, G) in all\n"
+         "  -C HOST:PORT    send the probe requests to probemon-collector on HOST and PORT instead of the db\n"
+         "  -n NAME         name of this sensor for the collector (default: the hostname)\n"
+         "  -S SPOOL        file keeping the batches while the collector can't be reached (default %s)\n",
+         SESSION_GAP, SPOOL_NAME
        );
 }
 
@@ -97,8 +114,13 @@ void parse_args(int argc, char *argv[], char **iface, uint8_t *channel, char **m
   char *option_db_name = NULL;
   char *option_manuf_name = NULL;
 
+  static const struct option long_options[] = {
+    { "memory-budget", required_argument, NULL, 'M' },
+    { NULL, 0, NULL, 0 }
+  };
+
   *option_stdout = false;
-  while ((opt = getopt(argc, argv, "c:hi:d:m:sV")) != -1) {
+  while ((opt = getopt_long(argc, argv, "c:C:e:f:g:hH:i:d:j:m:M:n:p:sS:u:Vw:", long_options, NULL)) != -1) {
     switch (opt) {
     case 'h':
       usage();
@@ -119,6 +141,65 @@ void parse_args(int argc, char *argv[], char **iface, uint8_t *channel, char **m
     case 's':
       *option_stdout = true;
       break;
+    case 'f':
+      if (parse_output_format(optarg, &option_format)) {
+        fprintf(stderr, "Error: unknown output format %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      *option_stdout = true;
+      break;
+    case 'u':
+      option_stream = optarg;
+      break;
+    case 'H':
+      option_http = optarg;
+      break;
+    case 'C':
+      option_collector = optarg;
+      break;
+    case 'n':
+      option_sensor = optarg;
+      break;
+    case 'S':
+      option_spool = optarg;
+      break;
+    case 'w':
+      option_coalesce = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    case 'g':
+      option_gap = (int)strtol(optarg, NULL, 10);
+      if (option_gap < 0) {
+        fprintf(stderr, "Error: invalid session gap %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'e':
+      option_ephemeral = (int)strtol(optarg, NULL, 10);
+      if (option_ephemeral <= 0 || option_ephemeral > 24 * 365) {
+        fprintf(stderr, "Error: invalid ephemeral retention %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      option_ephemeral *= 3600;
+      break;
+    case 'M':
+      if (budget_parse(optarg, &option_memory_budget)) {
+        fprintf(stderr, "Error: invalid memory budget %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'p':
+      if (lruc_parse_policy(optarg, &option_cache_policy)) {
+        fprintf(stderr, "Error: unknown cache policy %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'j':
+      option_workers = (int)strtol(optarg, NULL, 10);
+      if (option_workers < 1 || option_workers > MAX_WORKERS) {
+        fprintf(stderr, "Error: the number of workers must be between 1 and %d\n", MAX_WORKERS);
+        exit(EXIT_FAILURE);
+      }
+      break;
     case 'V':
       printf("%s %s\nCopyright © 2020 solsTice d'Hiver\nLicense GPLv3+: GNU GPL version 3\n", NAME, VERSION);
       exit(EXIT_SUCCESS);
@@ -280,6 +361,9 @@ int main(int argc, char *argv[])
   char *db_name = NULL;
   char *manuf_name = NULL;
   uint8_t channel;
+  bool logger_running = false;
+  loop_t *loop = NULL;
+  char hostname[UPLINK_MAX_NAME + 1];
 
   parse_args(argc, argv, &iface, &channel, &manuf_name, &db_name, &option_stdout);
 
@@ -288,13 +372,23 @@ int main(int argc, char *argv[])
     fprintf(stderr, "Error: can't find manuf file %s\n", manuf_name);
     exit(EXIT_FAILURE);
   }
-  printf(":: Parsing manuf file...\n");
-  fflush(stdout);
+  fprintf(stderr, ":: Parsing manuf file...\n");
   ouidb = parse_manuf_file(manuf_name, &ouidb_size);
   if (ouidb == NULL) {
     fprintf(stderr, "Error: can't parse manuf file\n");
     exit(EXIT_FAILURE);
   }
+  size_t manuf = manuf_memory(ouidb, ouidb_size);
+  budget_set_usage(BUDGET_MANUF, manuf);
+  if (option_memory_budget) {
+    if (budget_init(option_memory_budget, manuf)) {
+      fprintf(stderr, "Error: a memory budget of %zu KiB is too small, the manuf file alone takes %zu KiB\n",
+        option_memory_budget / 1024, manuf / 1024);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, ":: Memory budget of %zu KiB, %zu KiB for the manuf file\n", option_memory_budget / 1024,
+      manuf / 1024);
+  }
 
   // parse config.yaml file to populate ignored entries
   char **entries = parse_config_yaml(CONFIG_NAME, "ignored", &ignored_count);
@@ -303,69 +397,177 @@ int main(int argc, char *argv[])
     free(entries[i]);
   }
   free(entries);
+  // and known entries, flagged in the probe stream
+  entries = parse_config_yaml(CONFIG_NAME, "knownmac", &known_count);
+  known = parse_ignored_entries(entries, known_count);
+  for (int i=0; i<known_count; i++) {
+    free(entries[i]);
+  }
+  free(entries);
 
   initiliaze_pcap(&handle, iface);
 
   // change channel with iw binary (fork)
   change_channel(iface, channel);
 
-  queue = new_queue(MAX_QUEUE_SIZE);
-  sem_init(&queue_full, 0, MAX_QUEUE_SIZE);
-  sem_init(&queue_empty, 0, 0);
-  // start the helper logger thread
-  if (pthread_create(&logger, NULL, process_queue, NULL)) {
-    fprintf(stderr, "Error creating logger thread\n");
-    ret = EXIT_FAILURE;
-    goto logger_failure;
+  // the signals are blocked before any thread is started, so that only the loop gets them
+  static const int signals[] = { SIGINT, SIGQUIT, SIGTERM, SIGUSR1 };
+  if ((loop = loop_new()) == NULL || loop_add_signals(loop, signals, 4, handle_signal, NULL) < 0) {
+    exit(EXIT_FAILURE);
   }
-  pthread_detach(logger);
 
-  struct sigaction act;
-  act.sa_handler = sigint_handler;
-  act.sa_flags = 0;
-  sigemptyset(&act.sa_mask);
-  // catch CTRL+C to break loop cleanly
-  sigaction(SIGINT, &act, NULL);
-  // catch quit signal to flush data to file on disk
-  sigaction(SIGQUIT, &act, NULL);
-  sigaction(SIGTERM, &act, NULL);
+  if (option_stream) {
+    if ((stream = stream_new(option_stream)) == NULL) {
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  clock_gettime(CLOCK_MONOTONIC, &start_ts_queue);
+  if (option_http) {
+    if ((http = http_new(option_http)) == NULL) {
+      exit(EXIT_FAILURE);
+    }
+    dashboard = dashboard_new();
+    dashboard_routes(dashboard, http);
+    series = series_new(budget_share(BUDGET_SERIES) ? budget_share(BUDGET_SERIES) : SERIES_MEMORY_BUDGET,
+      SERIES_RETENTION);
+    series_routes(series, http);
+    if ((topk = topk_new()) != NULL && budget_share(BUDGET_TOPK) && topk_memory(topk) > budget_share(BUDGET_TOPK)) {
+      fprintf(stderr, "Warning: the top talkers don't fit in %zu KiB, they are disabled\n",
+        budget_share(BUDGET_TOPK) / 1024);
+      topk_free(topk);
+      topk = NULL;
+    }
+    if (topk) {
+      topk_routes(topk, http);
+    }
+    metrics_routes(http);
+    if (http_start(http)) {
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (option_collector) {
+    if (option_sensor == NULL) {
+      if (gethostname(hostname, sizeof(hostname)) < 0) {
+        perror("Error: can't get the hostname");
+        exit(EXIT_FAILURE);
+      }
+      hostname[UPLINK_MAX_NAME] = '\0';
+      option_sensor = hostname;
+    }
+    if ((uplink = uplink_new(option_collector, option_sensor, option_spool ? option_spool : SPOOL_NAME)) == NULL) {
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // a sensor leaves the sessions and the counts of distinct macs to the collector
+  if (uplink == NULL && option_gap > 0) {
+    sessions = session_new(SESSION_TABLE_SIZE, option_gap);
+  }
+  if (uplink == NULL) {
+    // a dense sketch at most for each
+    size_t share = budget_share(BUDGET_UNIQUES);
+    uniques = uniques_new(UNIQUES_TABLE_SIZE,
+      share ? share / (sizeof(struct unique_sketch) + HLL_REGISTERS) : UNIQUES_MAX_SKETCHES);
+  }
 
   #ifdef HAS_SYS_STAT_H
-  if (access(db_name, F_OK) == 0) {
+  if (uplink == NULL && access(db_name, F_OK) == 0) {
     // file exits, so double check it has writable permission
     struct stat perm;
     stat(db_name, &perm);
     if (!(perm.st_mode & S_IWUSR)) {
       // abort because the file does exist but is not writable. sqlite3 will not write to it
       fprintf(stderr, "Error: %s is not writable\n", db_name);
-      goto logger_failure;;
+      ret = EXIT_FAILURE;
+      goto logger_failure;
     }
   }
   #endif
-  if (init_probemon_db(db_name, &db) != SQLITE_OK) {
+  if (uplink == NULL) {
+    if (init_probemon_db(db_name, &db) != SQLITE_OK) {
+      ret = EXIT_FAILURE;
+      goto logger_failure;
+    }
+    begin_txn(db);
+  }
+
+  // the writer loads the known macs filter from the db as it starts
+  assert(uplink != NULL || db != NULL);
+
+  if (option_stdout) {
+    output_header(option_format, stdout);
+  }
+
+  // start the worker threads and the db writer
+  if (start_workers(option_workers)) {
+    ret = EXIT_FAILURE;
     goto logger_failure;
   }
-  begin_txn(db);
+  logger_running = true;
 
-  // we have to cheat a little and print the message before pcap_loop
-  printf(":: Started sniffing probe requests with %s on channel %d, writing to %s\n", iface, channel, db_name);
-  printf("Hit CTRL+C to quit\n");
-  fflush(stdout);
+  clock_gettime(CLOCK_MONOTONIC, &start_ts_queue);
 
-  int err;
-  if ((err = pcap_loop(handle, -1, (pcap_handler) process_packet, NULL))) {
-    if (err == PCAP_ERROR) {
-      pcap_perror(handle, "Error: ");
-    }
-    if (err == PCAP_ERROR_BREAK) {
-      printf("exiting...\n");
-    }
+  // the frames are read as soon as pcap has some, along with the timers and signals
+  char errbuf[PCAP_ERRBUF_SIZE];
+  int pcap_fd;
+  if (pcap_setnonblock(handle, 1, errbuf) < 0) {
+    fprintf(stderr, "Error: can't set pcap in non-blocking mode: %s\n", errbuf);
+    ret = EXIT_FAILURE;
+    goto logger_failure;
+  }
+  if ((pcap_fd = pcap_get_selectable_fd(handle)) < 0) {
+    fprintf(stderr, "Error: %s can't be waited for\n", iface);
+    ret = EXIT_FAILURE;
+    goto logger_failure;
+  }
+  if (loop_add_fd(loop, pcap_fd, EPOLLIN, capture_ready, NULL)
+    || loop_add_timer(loop, PCAP_STATS_TIME, handle_stats_timer, NULL) < 0
+    || loop_add_timer(loop, DB_CACHE_TIME * 1000, handle_commit_timer, NULL) < 0) {
+    ret = EXIT_FAILURE;
+    goto logger_failure;
   }
 
-  commit_txn(db);
-  sqlite3_close(db);
+  if (uplink) {
+    fprintf(stderr, ":: Started sniffing probe requests with %s on channel %d, sending to %s as %s\n", iface,
+      channel, option_collector, option_sensor);
+  } else {
+    fprintf(stderr, ":: Started sniffing probe requests with %s on channel %d, writing to %s\n", iface, channel,
+      db_name);
+  }
+  fprintf(stderr, "Hit CTRL+C to quit\n");
+
+  metrics_register("capture");
+  TRACE_INIT();
+  TRACE_THREAD_START("capture");
+
+  if (loop_run(loop) == 0) {
+    fprintf(stderr, "exiting...\n");
+  }
+  // what pcap already holds goes down the pipeline too
+  pcap_dispatch(handle, -1, (pcap_handler) process_packet, NULL);
+
+  update_pcap_stats();
+  fprintf(stderr, ":: Dropped frames:");
+  for (int i = REJECT_NONE + 1; i < REJECT_REASONS; i++) {
+    fprintf(stderr, " %s=%"PRIu64, reject_names[i], reject_counters[i]);
+  }
+  fprintf(stderr, "\n");
+
+  // let the workers and the writer stop once the queues are processed
+  stop_workers();
+  logger_running = false;
+  TRACE_THREAD_STOP();
+  TRACE_REPORT(stderr);
+
+  if (db) {
+    commit_txn(db);
+    sqlite3_close(db);
+  }
+
+  // the dashboard points into the manuf table
+  http_free(http);
+  http = NULL;
 
   // free up manuf table
   for (int i=0; i<ouidb_size; i++) {
@@ -376,23 +578,24 @@ int main(int argc, char *argv[])
   free(ouidb);
 
   free(ignored);
+  free(known);
 
 logger_failure:
-  pthread_cancel(logger);
-
-  sem_destroy(&queue_empty);
-  sem_destroy(&queue_full);
-
-  // free up elements of the queue
-  int qs = queue->size;
-  probereq_t *pr;
-  for (int i = 0; i < qs; i++) {
-    pr = (probereq_t *) dequeue(queue);
-    free_probereq(pr);
+  if (logger_running) {
+    // nothing was captured yet
+    stop_workers();
   }
-  free(queue);
 
-  pthread_mutex_destroy(&mutex_queue);
+  loop_free(loop);
+  uplink_free(uplink);
+  stream_free(stream);
+  http_free(http);
+  dashboard_free(dashboard);
+  series_free(series);
+  topk_free(topk);
+  session_free(sessions);
+  uniques_free(uniques);
+  pool_release_all();
 
   pcap_close(handle);
 
@@ -10,6 +10,18 @@ queue_t *new_queue(int capacity)
     return q;
   }
 
+  // no malloc per item: the nodes are allocated with the queue
+  q->nodes = malloc(capacity * sizeof(struct Node));
+  if (q->nodes == NULL) {
+    free(q);
+    return NULL;
+  }
+  q->free_nodes = NULL;
+  for (int i = capacity - 1; i >= 0; i--) {
+    q->nodes[i].next = q->free_nodes;
+    q->free_nodes = &q->nodes[i];
+  }
+
   q->size = 0;
   q->max_size = capacity;
   q->head = NULL;
@@ -24,11 +36,8 @@ int enqueue(queue_t * q, void *value)
     return q->size;
   }
 
-  struct Node *node = malloc(sizeof(struct Node));
-
-  if (node == NULL) {
-    return q->size;
-  }
+  struct Node *node = q->free_nodes;
+  q->free_nodes = node->next;
 
   node->value = value;
   node->next = NULL;
@@ -62,30 +71,84 @@ void *dequeue(queue_t * q)
   q->head = q->head->next;
   q->size -= 1;
 
-  free(tmp);
+  tmp->next = q->free_nodes;
+  q->free_nodes = tmp;
 
   return value;
 }
 
+// the values still queued are not freed: they may come from a pool
 void free_queue(queue_t * q)
 {
   if (q == NULL) {
     return;
   }
 
-  while (q->head != NULL) {
-    struct Node *tmp = q->head;
-    q->head = q->head->next;
-    if (tmp->value != NULL) {
-      free(tmp->value);
-    }
+  free(q->nodes);
+  free(q);
+}
 
-    free(tmp);
+int channel_init(channel_t *ch, int capacity)
+{
+  if ((ch->queue = new_queue(capacity)) == NULL) {
+    return -1;
   }
+  pthread_mutex_init(&ch->mutex, NULL);
+  sem_init(&ch->empty, 0, 0);
+  sem_init(&ch->full, 0, capacity);
+
+  return 0;
+}
 
-  if (q->tail != NULL) {
-    free(q->tail);
+void channel_put(channel_t *ch, void *value)
+{
+  sem_wait(&ch->full);
+  pthread_mutex_lock(&ch->mutex);
+  enqueue(ch->queue, value);
+  pthread_mutex_unlock(&ch->mutex);
+  sem_post(&ch->empty);
+}
+
+static void *channel_take(channel_t *ch)
+{
+  pthread_mutex_lock(&ch->mutex);
+  void *value = dequeue(ch->queue);
+  pthread_mutex_unlock(&ch->mutex);
+  sem_post(&ch->full);
+
+  return value;
+}
+
+void *channel_get(channel_t *ch)
+{
+  sem_wait(&ch->empty);
+  return channel_take(ch);
+}
+
+// don't wait: false if the channel is empty
+bool channel_try_get(channel_t *ch, void **value)
+{
+  if (sem_trywait(&ch->empty)) {
+    return false;
   }
+  *value = channel_take(ch);
+  return true;
+}
 
-  free(q);
+int channel_size(channel_t *ch)
+{
+  pthread_mutex_lock(&ch->mutex);
+  int size = ch->queue->size;
+  pthread_mutex_unlock(&ch->mutex);
+
+  return size;
+}
+
+void channel_destroy(channel_t *ch)
+{
+  free_queue(ch->queue);
+  ch->queue = NULL;
+  pthread_mutex_destroy(&ch->mutex);
+  sem_destroy(&ch->empty);
+  sem_destroy(&ch->full);
 }
@@ -1,6 +1,10 @@
 #ifndef SIMPLE_QUEUE
 #define SIMPLE_QUEUE
 
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+
 struct Node {
   void *value;
   struct Node *next;
@@ -11,6 +15,8 @@ typedef struct Queue {
   int max_size;
   struct Node *head;
   struct Node *tail;
+  struct Node *nodes;       // the capacity nodes, allocated at once
+  struct Node *free_nodes;
 } queue_t;
 
 extern queue_t *new_queue(int capacity);
@@ -21,4 +27,24 @@ extern void *dequeue(queue_t * q);
 
 extern void free_queue(queue_t * q);
 
+// bounded queue between threads: put waits for room, get waits for an item
+typedef struct channel {
+  queue_t *queue;
+  pthread_mutex_t mutex;
+  sem_t empty;            // number of items
+  sem_t full;             // number of free slots
+} channel_t;
+
+extern int channel_init(channel_t *ch, int capacity);
+
+extern void channel_put(channel_t *ch, void *value);
+
+extern void *channel_get(channel_t *ch);
+
+extern bool channel_try_get(channel_t *ch, void **value);
+
+extern int channel_size(channel_t *ch);
+
+extern void channel_destroy(channel_t *ch);
+
 #endif
@@ -0,0 +1,139 @@
+/*
+early rejection of corrupted and retransmitted frames, before they reach the parser
+and insert garbage mac addresses or duplicated rows in the db
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "reject.h"
+#include "radiotap.h"
+#include "platform.h"
+#include "config.h"
+
+const char *reject_names[REJECT_REASONS] = {
+  [REJECT_NONE] = "accepted",
+  [REJECT_MALFORMED] = "malformed",
+  [REJECT_BADFCS] = "bad_fcs_flag",
+  [REJECT_BADPLCP] = "bad_plcp",
+  [REJECT_FCS] = "fcs_mismatch",
+  [REJECT_RETRY] = "retry",
+};
+uint64_t reject_counters[REJECT_REASONS];
+
+// CRC-32 (IEEE 802.3), slicing-by-8
+static uint32_t crc32_table[8][256];
+static bool crc32_ready = false;
+
+static void crc32_init(void)
+{
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+    }
+    crc32_table[0][i] = c;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int t = 1; t < 8; t++) {
+      crc32_table[t][i] = (crc32_table[t-1][i] >> 8) ^ crc32_table[0][crc32_table[t-1][i] & 0xff];
+    }
+  }
+  crc32_ready = true;
+}
+
+uint32_t crc32_ieee(const uint8_t *data, size_t len)
+{
+  uint32_t crc = 0xffffffff;
+
+  if (!crc32_ready) {
+    crc32_init();
+  }
+
+  while (len >= 8) {
+    uint32_t a = get_unaligned_le32(data) ^ crc;
+    uint32_t b = get_unaligned_le32(data + 4);
+    crc = crc32_table[7][a & 0xff] ^ crc32_table[6][(a >> 8) & 0xff]
+      ^ crc32_table[5][(a >> 16) & 0xff] ^ crc32_table[4][a >> 24]
+      ^ crc32_table[3][b & 0xff] ^ crc32_table[2][(b >> 8) & 0xff]
+      ^ crc32_table[1][(b >> 16) & 0xff] ^ crc32_table[0][b >> 24];
+    data += 8;
+    len -= 8;
+  }
+  while (len--) {
+    crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data++) & 0xff];
+  }
+
+  return ~crc;
+}
+
+// last (mac, sequence number) seen, to spot the link-layer retransmissions
+struct last_seen {
+  uint64_t mac;
+  uint16_t seq;
+  struct timeval ts;
+};
+static struct last_seen seen[RETRY_TABLE_SIZE];
+
+static bool is_retransmission(const uint8_t *hdr, struct timeval ts)
+{
+  const uint8_t *sa = hdr + 10;
+  uint64_t mac = (uint64_t)sa[0] << 40 | (uint64_t)sa[1] << 32 | (uint64_t)sa[2] << 24
+    | (uint64_t)sa[3] << 16 | (uint64_t)sa[4] << 8 | sa[5];
+  uint16_t seq = get_unaligned_le16(hdr + 22) >> 4;
+  bool retry = hdr[1] & 0x08;   // retry bit of the frame control
+
+  uint32_t indx = (uint32_t)((mac ^ (mac >> 24) ^ ((uint64_t)seq << 8)) * 0x9e3779b1u) % RETRY_TABLE_SIZE;
+  struct last_seen *s = &seen[indx];
+  int64_t elapsed = (int64_t)(ts.tv_sec - s->ts.tv_sec) * 1000 + (ts.tv_usec - s->ts.tv_usec) / 1000;
+  bool dup = retry && s->mac == mac && s->seq == seq && elapsed <= RETRY_WINDOW;
+
+  s->mac = mac;
+  s->seq = seq;
+  s->ts = ts;
+
+  return dup;
+}
+
+// check the frame; frame_len is set to the length of the captured frame without its FCS
+enum reject_reason reject_frame(const uint8_t *packet, uint32_t caplen, uint32_t len, int8_t offset,
+  uint8_t flags, uint16_t rx_flags, struct timeval ts, uint32_t *frame_len)
+{
+  *frame_len = caplen;
+
+  if (offset < 0 || (uint32_t)offset > caplen) {
+    return REJECT_MALFORMED;
+  }
+  if (flags & IEEE80211_RADIOTAP_F_BADFCS) {
+    return REJECT_BADFCS;
+  }
+  if (rx_flags & IEEE80211_RADIOTAP_F_RX_BADPLCP) {
+    return REJECT_BADPLCP;
+  }
+  if (flags & IEEE80211_RADIOTAP_F_FCS) {
+    if (caplen < (uint32_t)offset + 4) {
+      return REJECT_MALFORMED;
+    }
+    // we can only check the FCS of frames that were not truncated by the snap length
+    if (caplen == len) {
+      const uint8_t *fcs = packet + caplen - 4;
+      if (crc32_ieee(packet + offset, caplen - 4 - offset) != get_unaligned_le32(fcs)) {
+        return REJECT_FCS;
+      }
+      *frame_len = caplen - 4;
+    } else if (len - caplen < 4) {
+      // part of the FCS was captured
+      *frame_len = len - 4;
+    }
+  }
+  // FC + duration + DA + SA + BSSID + Seqctl
+  if ((uint32_t)offset + 24 > *frame_len) {
+    return REJECT_MALFORMED;
+  }
+  if (is_retransmission(packet + offset, ts)) {
+    return REJECT_RETRY;
+  }
+
+  return REJECT_NONE;
+}
@@ -0,0 +1,25 @@
+#ifndef REJECT_H
+#define REJECT_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+// reasons to drop a frame before parsing it
+enum reject_reason {
+  REJECT_NONE = 0,
+  REJECT_MALFORMED,   // radiotap header or 802.11 header doesn't fit in the packet
+  REJECT_BADFCS,      // the driver flagged a bad FCS
+  REJECT_BADPLCP,     // the driver flagged a bad PLCP
+  REJECT_FCS,         // the FCS doesn't match the frame
+  REJECT_RETRY,       // retransmission of a frame we've just seen
+  REJECT_REASONS
+};
+
+extern const char *reject_names[REJECT_REASONS];
+extern uint64_t reject_counters[REJECT_REASONS];
+
+uint32_t crc32_ieee(const uint8_t *data, size_t len);
+enum reject_reason reject_frame(const uint8_t *packet, uint32_t caplen, uint32_t len, int8_t offset,
+  uint8_t flags, uint16_t rx_flags, struct timeval ts, uint32_t *frame_len);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+in-memory store of the recent (timestamp, rssi) points of each mac, to draw
+the charts of the last days without going through the db.
+
+Points are appended to fixed-size chunks, compressed like in Gorilla: the
+first point is stored as is in the chunk, then each timestamp is written as
+the difference between its delta and the previous one, in a variable number
+of bits, and each rssi as its difference with the previous one.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "series.h"
+#include "parsers.h"
+
+// worst case of an encoded point: 4+32 bits of timestamp and 2+8 bits of rssi
+#define MAX_POINT_BITS 46
+
+// ------------------------------------------
+// bit stream
+// ------------------------------------------
+static void put_bits(struct series_chunk *c, uint64_t v, int n)
+{
+  for (int i = n - 1; i >= 0; i--) {
+    if ((v >> i) & 1) {
+      c->data[c->bits >> 3] |= 0x80 >> (c->bits & 7);
+    }
+    c->bits++;
+  }
+}
+
+struct reader {
+  const struct series_chunk *c;
+  uint32_t pos;
+};
+
+static uint64_t get_bits(struct reader *r, int n)
+{
+  uint64_t v = 0;
+  for (int i = 0; i < n; i++) {
+    v = v << 1 | ((r->c->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+    r->pos++;
+  }
+  return v;
+}
+
+static int64_t get_signed(struct reader *r, int n)
+{
+  uint64_t v = get_bits(r, n);
+  // sign extension
+  if (v & (1ULL << (n - 1))) {
+    v |= ~0ULL << n;
+  }
+  return (int64_t)v;
+}
+
+static inline bool fits(int64_t v, int n)
+{
+  return v >= -(1LL << (n - 1)) && v < (1LL << (n - 1));
+}
+
+// ------------------------------------------
+// chunks
+// ------------------------------------------
+static uint32_t mac_hash(const char *mac, uint32_t size)
+{
+  uint32_t h = 2166136261u;
+  for (const char *p = mac; *p; p++) {
+    h ^= (uint8_t)*p;
+    h *= 16777619u;
+  }
+  return h % size;
+}
+
+static void seal_chunk(series_store_t *store, struct series_chunk *c)
+{
+  c->sealed_next = NULL;
+  if (store->sealed_tail) {
+    store->sealed_tail->sealed_next = c;
+  } else {
+    store->sealed_head = c;
+  }
+  store->sealed_tail = c;
+}
+
+static struct series_chunk *new_chunk(series_store_t *store, struct series *s, int64_t ts, int8_t rssi)
+{
+  struct series_chunk *c = calloc(1, sizeof(struct series_chunk));
+  if (c == NULL) {
+    return NULL;
+  }
+  c->series = s;
+  c->first = c->last = ts;
+  c->rssi_first = c->rssi_last = rssi;
+  c->count = 1;
+  if (s->tail) {
+    s->tail->next = c;
+    seal_chunk(store, s->tail);
+  } else {
+    s->head = c;
+  }
+  s->tail = c;
+  store->memory += sizeof(struct series_chunk);
+  store->points++;
+  return c;
+}
+
+// drop the oldest chunk of a mac, and the mac with its last chunk
+static void remove_chunk(series_store_t *store, struct series_chunk *c)
+{
+  struct series *s = c->series;
+
+  if (c->last > store->since) {
+    store->since = c->last;
+  }
+  store->points -= c->count;
+  s->head = c->next;
+  if (s->tail == c) {
+    s->tail = NULL;
+  }
+  free(c);
+  store->memory -= sizeof(struct series_chunk);
+
+  if (s->head == NULL) {
+    uint32_t indx = mac_hash(s->mac, store->size);
+    struct series **p = &store->buckets[indx];
+    while (*p != s) {
+      p = &(*p)->next;
+    }
+    *p = s->next;
+    free(s);
+    store->memory -= sizeof(struct series);
+  }
+}
+
+// the opened chunk seen the longest time ago
+static struct series_chunk *oldest_opened(series_store_t *store)
+{
+  struct series_chunk *oldest = NULL;
+  for (uint32_t i = 0; i < store->size; i++) {
+    for (struct series *s = store->buckets[i]; s; s = s->next) {
+      if (oldest == NULL || s->tail->last < oldest->last) {
+        oldest = s->tail;
+      }
+    }
+  }
+  return oldest;
+}
+
+static void remove_oldest(series_store_t *store)
+{
+  struct series_chunk *c = store->sealed_head;
+  if (c) {
+    store->sealed_head = c->sealed_next;
+    if (store->sealed_head == NULL) {
+      store->sealed_tail = NULL;
+    }
+  } else {
+    // only opened chunks are left
+    c = oldest_opened(store);
+    if (c == NULL) {
+      return;
+    }
+  }
+  remove_chunk(store, c);
+}
+
+// ------------------------------------------
+// store
+// ------------------------------------------
+series_store_t *series_new(size_t budget, int64_t retention)
+{
+  series_store_t *store = calloc(1, sizeof(series_store_t));
+  if (store == NULL) {
+    return NULL;
+  }
+  store->size = SERIES_TABLE_SIZE;
+  store->buckets = calloc(store->size, sizeof(struct series *));
+  if (store->buckets == NULL) {
+    free(store);
+    return NULL;
+  }
+  pthread_mutex_init(&store->lock, NULL);
+  store->budget = budget;
+  store->retention = retention;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  store->since = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+
+  return store;
+}
+
+void series_free(series_store_t *store)
+{
+  if (store == NULL) return;
+
+  for (uint32_t i = 0; i < store->size; i++) {
+    struct series *s = store->buckets[i];
+    while (s) {
+      struct series *next = s->next;
+      struct series_chunk *c = s->head;
+      while (c) {
+        struct series_chunk *cn = c->next;
+        free(c);
+        c = cn;
+      }
+      free(s);
+      s = next;
+    }
+  }
+  pthread_mutex_destroy(&store->lock);
+  free(store->buckets);
+  free(store);
+}
+
+void series_add(series_store_t *store, const char *mac, struct timeval tv, int8_t rssi)
+{
+  int64_t ts = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+
+  pthread_mutex_lock(&store->lock);
+  uint32_t indx = mac_hash(mac, store->size);
+  struct series *s = store->buckets[indx];
+  while (s && strcmp(s->mac, mac)) {
+    s = s->next;
+  }
+
+  if (s == NULL) {
+    s = calloc(1, sizeof(struct series));
+    if (s == NULL) {
+      goto unlock;
+    }
+    strncpy(s->mac, mac, sizeof(s->mac) - 1);
+    s->next = store->buckets[indx];
+    store->buckets[indx] = s;
+    store->memory += sizeof(struct series);
+    if (new_chunk(store, s, ts, rssi) == NULL) {
+      store->buckets[indx] = s->next;
+      free(s);
+      store->memory -= sizeof(struct series);
+      goto unlock;
+    }
+  } else {
+    struct series_chunk *c = s->tail;
+    int64_t delta = ts - c->last;
+    int64_t dod = delta - c->delta;
+    if (c->bits + MAX_POINT_BITS > SERIES_CHUNK_SIZE * 8 || c->count == UINT16_MAX || !fits(dod, 32)) {
+      new_chunk(store, s, ts, rssi);
+    } else {
+      if (dod == 0) {
+        put_bits(c, 0x0, 1);
+      } else if (fits(dod, 12)) {
+        put_bits(c, 0x2, 2);
+        put_bits(c, dod, 12);
+      } else if (fits(dod, 18)) {
+        put_bits(c, 0x6, 3);
+        put_bits(c, dod, 18);
+      } else if (fits(dod, 26)) {
+        put_bits(c, 0xe, 4);
+        put_bits(c, dod, 26);
+      } else {
+        put_bits(c, 0xf, 4);
+        put_bits(c, dod, 32);
+      }
+      int d = rssi - c->rssi_last;
+      if (d == 0) {
+        put_bits(c, 0x0, 1);
+      } else if (fits(d, 4)) {
+        put_bits(c, 0x2, 2);
+        put_bits(c, d, 4);
+      } else {
+        put_bits(c, 0x3, 2);
+        put_bits(c, (uint8_t)rssi, 8);
+      }
+      c->delta = delta;
+      c->last = ts;
+      c->rssi_last = rssi;
+      c->count++;
+      store->points++;
+    }
+  }
+
+  while (store->memory > store->budget) {
+    remove_oldest(store);
+  }
+
+unlock:
+  pthread_mutex_unlock(&store->lock);
+}
+
+// drop the points older than the retention time
+void series_expire(series_store_t *store, struct timeval now)
+{
+  int64_t cutoff = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000 - store->retention;
+
+  pthread_mutex_lock(&store->lock);
+  while (store->sealed_head && store->sealed_head->last < cutoff) {
+    remove_oldest(store);
+  }
+  struct series_chunk *c;
+  while (store->sealed_head == NULL && (c = oldest_opened(store)) != NULL && c->last < cutoff) {
+    remove_chunk(store, c);
+  }
+  if (cutoff > store->since) {
+    store->since = cutoff;
+  }
+  pthread_mutex_unlock(&store->lock);
+}
+
+static void decode_chunk(const struct series_chunk *c, int64_t after, int64_t before,
+  series_handler handler, void *data)
+{
+  struct reader r = { c, 0 };
+  int64_t ts = c->first, delta = 0;
+  int rssi = c->rssi_first;
+
+  for (uint16_t i = 0; i < c->count; i++) {
+    if (i > 0) {
+      int64_t dod;
+      if (get_bits(&r, 1) == 0) {
+        dod = 0;
+      } else if (get_bits(&r, 1) == 0) {
+        dod = get_signed(&r, 12);
+      } else if (get_bits(&r, 1) == 0) {
+        dod = get_signed(&r, 18);
+      } else if (get_bits(&r, 1) == 0) {
+        dod = get_signed(&r, 26);
+      } else {
+        dod = get_signed(&r, 32);
+      }
+      delta += dod;
+      ts += delta;
+      if (get_bits(&r, 1) == 1) {
+        if (get_bits(&r, 1) == 0) {
+          rssi += get_signed(&r, 4);
+        } else {
+          rssi = (int8_t)get_bits(&r, 8);
+        }
+      }
+    }
+    if (ts > after && (before < 0 || ts < before)) {
+      handler(c->series->mac, ts, rssi, data);
+    }
+  }
+}
+
+// call handler on every point of the macs matching one of macs (or all of
+// them), between after and before (if not negative), mac by mac, in time order
+// returns -1 if the store doesn't hold every point after after
+int series_query(series_store_t *store, const char **macs, int macs_count,
+  int64_t after, int64_t before, series_handler handler, void *data)
+{
+  pthread_mutex_lock(&store->lock);
+  if (after < store->since) {
+    pthread_mutex_unlock(&store->lock);
+    return -1;
+  }
+  for (uint32_t i = 0; i < store->size; i++) {
+    for (struct series *s = store->buckets[i]; s; s = s->next) {
+      bool match = macs_count == 0;
+      for (int k = 0; k < macs_count && !match; k++) {
+        match = mac_matches(s->mac, macs[k]);
+      }
+      if (!match) {
+        continue;
+      }
+      for (struct series_chunk *c = s->head; c; c = c->next) {
+        if (c->last > after && (before < 0 || c->first < before)) {
+          decode_chunk(c, after, before, handler, data);
+        }
+      }
+    }
+  }
+  pthread_mutex_unlock(&store->lock);
+  return 0;
+}
+
+// ------------------------------------------
+// /api/series
+// ------------------------------------------
+struct series_json {
+  http_response_t *resp;
+  const char *mac;
+};
+
+static void write_point(const char *mac, int64_t ts, int8_t rssi, void *data)
+{
+  struct series_json *out = (struct series_json *)data;
+
+  if (out->mac != mac) {
+    if (out->mac) {
+      http_append(out->resp, "]}, ", 4);
+    }
+    http_printf(out->resp, "{\"mac\": \"%s\", \"points\": [", mac);
+    out->mac = mac;
+  } else {
+    http_append(out->resp, ", ", 2);
+  }
+  http_printf(out->resp, "[%" PRId64 ", %d]", ts, rssi);
+}
+
+static void get_series(const char *query, http_response_t *resp, void *data)
+{
+  series_store_t *store = (series_store_t *)data;
+  char value[64];
+  char filters[SERIES_MAX_MACS_FILTER][18];
+  const char *macs[SERIES_MAX_MACS_FILTER];
+  int macs_count = 0;
+  double after, before = -1;
+
+  if (http_query_next(query, "after", value, sizeof(value)) == NULL) {
+    resp->status = 404;
+    return;
+  }
+  if (http_parse_date(value, &after)) {
+    resp->status = 400;
+    http_printf(resp, "{\"message\": \"Invalid after parameter\"}");
+    return;
+  }
+  if (http_query_next(query, "before", value, sizeof(value)) != NULL && http_parse_date(value, &before)) {
+    resp->status = 400;
+    http_printf(resp, "{\"message\": \"Invalid before parameter\"}");
+    return;
+  }
+  const char *q = query;
+  while ((q = http_query_next(q, "macs", value, sizeof(value))) != NULL) {
+    if (macs_count == SERIES_MAX_MACS_FILTER) {
+      resp->status = 400;
+      http_printf(resp, "{\"message\": \"Too many macs\"}");
+      return;
+    }
+    value[17] = '\0';
+    strcpy(filters[macs_count], value);
+    macs[macs_count] = filters[macs_count];
+    macs_count++;
+  }
+
+  struct series_json out = { resp, NULL };
+  http_append(resp, "[", 1);
+  if (series_query(store, macs, macs_count, (int64_t)after * 1000,
+      before < 0 ? -1 : (int64_t)before * 1000, write_point, &out)) {
+    // reaching before what we hold
+    resp->len = 0;
+    resp->status = 404;
+    return;
+  }
+  http_append(resp, out.mac ? "]}]" : "]", out.mac ? 3 : 1);
+}
+
+void series_routes(series_store_t *store, http_server_t *server)
+{
+  http_route(server, "/api/series", get_series, store);
+}
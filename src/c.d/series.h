@@ -0,0 +1,62 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "http.h"
+#include "config.h"
+
+// a block of compressed (timestamp, rssi) points of a mac
+struct series_chunk {
+  struct series_chunk *next;        // next chunk of the same mac
+  struct series_chunk *sealed_next; // next sealed chunk, in the order they were sealed
+  struct series *series;
+  int64_t first;                    // in ms
+  int64_t last;
+  int64_t delta;                    // between the last two timestamps
+  int8_t rssi_first;
+  int8_t rssi_last;
+  uint16_t count;
+  uint16_t bits;
+  uint8_t data[SERIES_CHUNK_SIZE];
+};
+
+// the chunks of a mac, from the oldest
+struct series {
+  char mac[18];
+  struct series_chunk *head;
+  struct series_chunk *tail;        // the opened one
+  struct series *next;
+};
+
+// recent time series of the rssi of each mac, compressed like in Gorilla
+// (delta of delta of the timestamps, delta of the rssi) and bounded in time
+// and memory, dropping the oldest data first
+typedef struct series_store {
+  pthread_mutex_t lock;
+  struct series **buckets;
+  uint32_t size;
+  struct series_chunk *sealed_head;
+  struct series_chunk *sealed_tail;
+  size_t memory;
+  size_t budget;
+  int64_t retention;                // in ms
+  int64_t since;                    // the store holds every point after that date, in ms
+  uint64_t points;
+} series_store_t;
+
+typedef void (*series_handler)(const char *mac, int64_t ts, int8_t rssi, void *data);
+
+series_store_t *series_new(size_t budget, int64_t retention);
+void series_add(series_store_t *store, const char *mac, struct timeval tv, int8_t rssi);
+void series_expire(series_store_t *store, struct timeval now);
+int series_query(series_store_t *store, const char **macs, int macs_count,
+  int64_t after, int64_t before, series_handler handler, void *data);
+void series_routes(series_store_t *store, http_server_t *server);
+void series_free(series_store_t *store);
+
+#endif
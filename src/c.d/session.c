@@ -0,0 +1,155 @@
+/*
+sessionization of the probe requests: a mac is present from its first probe
+request until it stays silent for more than the gap. Answering "when was this
+device around" then takes a few intervals from the sessions table instead of
+every probe request of the mac.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "session.h"
+#include "manuf.h"
+#include "db.h"
+#include "pool.h"
+
+static pool_t session_pool = POOL_INITIALIZER("session", struct session);
+
+static inline int64_t timeval_us(struct timeval tv)
+{
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static inline uint32_t session_hash(uint64_t mac, uint32_t size)
+{
+  return (uint32_t)((mac * 0x9e3779b97f4a7c15ULL) >> 32) % size;
+}
+
+// gap is in s
+session_store_t *session_new(uint32_t size, int gap)
+{
+  session_store_t *store = calloc(1, sizeof(session_store_t));
+  if (store == NULL) {
+    return NULL;
+  }
+  if ((store->buckets = calloc(size, sizeof(struct session *))) == NULL) {
+    free(store);
+    return NULL;
+  }
+  store->size = size;
+  store->gap = (int64_t)gap * 1000000;
+  return store;
+}
+
+static void write_session(struct session *s, sqlite3 *db)
+{
+  if (!s->dirty) {
+    return;
+  }
+  if (s->row == 0) {
+    s->row = insert_session(s->mac_id, s->start, s->end, s->count, s->rssi_max, db);
+    if (s->row < 0) {
+      s->row = 0;
+      return;
+    }
+  } else if (update_session(s->row, s->start, s->end, s->count, s->rssi_max, db)) {
+    return;
+  }
+  s->dirty = false;
+}
+
+// a probe request, or a burst of count of them, of mac: it extends the open session
+// of the mac, unless it is more than the gap away from it, then that one is closed
+// and a new one is opened
+void session_add(session_store_t *store, const char *mac, int64_t mac_id, struct timeval first,
+  struct timeval last, uint32_t count, int rssi_max, sqlite3 *db)
+{
+  uint64_t key = mac_to_uint64(mac);
+  int64_t start = timeval_us(first), end = timeval_us(last);
+  struct session **p = &store->buckets[session_hash(key, store->size)];
+
+  if (end > store->latest) {
+    store->latest = end;
+  }
+  while (*p && (*p)->mac != key) {
+    p = &(*p)->next;
+  }
+
+  struct session *s = *p;
+  if (s && (start > s->end + store->gap || end < s->start - store->gap)) {
+    // closed: a probe request arriving late (from a spool) after that can only open a new one
+    write_session(s, db);
+    *p = s->next;
+    pool_free(&session_pool, s);
+    store->count--;
+    s = NULL;
+  }
+  if (s == NULL) {
+    if ((s = pool_alloc(&session_pool)) == NULL) {
+      return;
+    }
+    s->mac = key;
+    s->mac_id = mac_id;
+    s->row = 0;
+    s->start = start;
+    s->end = end;
+    s->count = 0;
+    s->rssi_max = rssi_max;
+    s->next = *p;
+    *p = s;
+    store->count++;
+  }
+
+  if (start < s->start) {
+    s->start = start;
+  }
+  if (end > s->end) {
+    s->end = end;
+  }
+  if (rssi_max > s->rssi_max) {
+    s->rssi_max = rssi_max;
+  }
+  s->count += count;
+  s->dirty = true;
+}
+
+// at commit: write the sessions that changed, and forget those closed, silent for more
+// than the gap since the newest probe request; all closes every session, on exit
+void session_flush(session_store_t *store, sqlite3 *db, bool all)
+{
+  for (uint32_t i = 0; i < store->size; i++) {
+    struct session **p = &store->buckets[i];
+    while (*p) {
+      struct session *s = *p;
+      write_session(s, db);
+      if (all || s->end + store->gap < store->latest) {
+        *p = s->next;
+        pool_free(&session_pool, s);
+        store->count--;
+      } else {
+        p = &s->next;
+      }
+    }
+  }
+}
+
+size_t session_memory(const session_store_t *store)
+{
+  return sizeof(session_store_t) + store->size * sizeof(struct session *) + store->count * sizeof(struct session);
+}
+
+void session_free(session_store_t *store)
+{
+  if (store == NULL) return;
+
+  for (uint32_t i = 0; i < store->size; i++) {
+    struct session *s = store->buckets[i];
+    while (s) {
+      struct session *next = s->next;
+      pool_free(&session_pool, s);
+      s = next;
+    }
+  }
+  free(store->buckets);
+  free(store);
+}
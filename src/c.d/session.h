@@ -0,0 +1,39 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <sqlite3.h>
+
+// presence of a mac: its probe requests with less than the gap between two of them
+struct session {
+  uint64_t mac;
+  int64_t mac_id;
+  int64_t row;          // rowid in the sessions table, 0 until first written
+  int64_t start;        // in µs
+  int64_t end;
+  uint32_t count;
+  int8_t rssi_max;
+  bool dirty;           // changed since written
+  struct session *next;
+};
+
+// the open session of each mac, written to the sessions table once closed, and
+// at each commit while still open
+typedef struct session_store {
+  struct session **buckets;
+  uint32_t size;
+  int64_t gap;          // in µs
+  int64_t latest;       // newest probe request seen, in µs
+  uint32_t count;
+} session_store_t;
+
+session_store_t *session_new(uint32_t size, int gap);
+void session_add(session_store_t *store, const char *mac, int64_t mac_id, struct timeval first,
+  struct timeval last, uint32_t count, int rssi_max, sqlite3 *db);
+void session_flush(session_store_t *store, sqlite3 *db, bool all);
+size_t session_memory(const session_store_t *store);
+void session_free(session_store_t *store);
+
+#endif
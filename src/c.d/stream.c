@@ -0,0 +1,345 @@
+/*
+live stream of the accepted probe requests on a unix domain socket
+
+Each probe request is sent as a varint length followed by a protobuf Probes
+message of src/www/probe.proto, with a single ssid and a single Probereq.
+The logger thread only copies the encoded message into the ring buffer of each
+subscriber; a dedicated thread writes them to the sockets. A subscriber whose
+ring buffer is full is dropped, so it can never stall the logger thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stream.h"
+
+// ------------------------------------------
+// protobuf encoding
+// ------------------------------------------
+static size_t put_varint(uint8_t *buf, uint64_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80) {
+    buf[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  buf[n++] = v;
+  return n;
+}
+
+static size_t varint_size(uint64_t v)
+{
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static size_t put_bytes(uint8_t *buf, uint8_t tag, const void *data, size_t len)
+{
+  size_t n = 0;
+  buf[n++] = tag;
+  n += put_varint(buf + n, len);
+  memcpy(buf + n, data, len);
+  return n + len;
+}
+
+// encode the probe request as a length-delimited Probes message; returns its size or 0 if
+// it doesn't fit in buf
+size_t encode_probes(const probereq_t *pr, bool known, uint8_t *buf, size_t size)
+{
+  uint8_t msg[STREAM_MAX_MESSAGE], sub[64];
+  size_t n = 0, s;
+  size_t vendor_len = strlen(pr->vendor), ssid_len = strlen(pr->ssid_str);
+
+  // mac, vendor and ssid are the only variable length fields
+  if (17 + vendor_len + ssid_len + 64 > sizeof(msg)) {
+    return 0;
+  }
+
+  n += put_bytes(msg + n, 0x0a, pr->mac, strlen(pr->mac));          // 1: mac
+  n += put_bytes(msg + n, 0x12, pr->vendor, vendor_len);            // 2: vendor
+  if (known) {
+    msg[n++] = 0x18;                                                // 3: known
+    msg[n++] = 1;
+  }
+  // 4: ssids, a single Ssid { 1: name }
+  msg[n++] = 0x22;
+  n += put_varint(msg + n, 1 + varint_size(ssid_len) + ssid_len);
+  n += put_bytes(msg + n, 0x0a, pr->ssid_str, ssid_len);
+  // 5: starting_ts, in ms
+  uint64_t ts = (uint64_t)pr->tv.tv_sec * 1000 + pr->tv.tv_usec / 1000;
+  msg[n++] = 0x28;
+  n += put_varint(msg + n, ts);
+  // 6: probereq, a single Probereq { 1: timestamp = 0, 2: rssi, 3: ssid = 0 }, relative to
+  // starting_ts and ssids; zero values are not encoded
+  s = 0;
+  sub[s++] = 0x10;
+  s += put_varint(sub + s, ((uint32_t)pr->rssi << 1) ^ (uint32_t)(pr->rssi >> 31));  // zigzag
+  n += put_bytes(msg + n, 0x32, sub, s);
+
+  if (varint_size(n) + n > size) {
+    return 0;
+  }
+  s = put_varint(buf, n);
+  memcpy(buf + s, msg, n);
+  return s + n;
+}
+
+// ------------------------------------------
+// publisher
+// ------------------------------------------
+static void remove_subscriber(stream_t *st, subscriber_t *prev, subscriber_t *sub)
+{
+  if (prev) {
+    prev->next = sub->next;
+  } else {
+    st->subscribers = sub->next;
+  }
+  close(sub->fd);
+  free(sub);
+  st->count--;
+}
+
+static void accept_subscriber(stream_t *st)
+{
+  int fd = accept(st->listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  pthread_mutex_lock(&st->mutex);
+  if (st->count >= STREAM_MAX_SUBSCRIBERS) {
+    pthread_mutex_unlock(&st->mutex);
+    close(fd);
+    return;
+  }
+  subscriber_t *sub = malloc(sizeof(subscriber_t));
+  if (sub == NULL) {
+    pthread_mutex_unlock(&st->mutex);
+    close(fd);
+    return;
+  }
+  sub->fd = fd;
+  sub->head = 0;
+  sub->len = 0;
+  sub->dropped = false;
+  sub->next = st->subscribers;
+  st->subscribers = sub;
+  st->count++;
+  pthread_mutex_unlock(&st->mutex);
+}
+
+// write as much of the ring as the socket accepts; returns -1 if the subscriber is gone
+static int write_subscriber(subscriber_t *sub)
+{
+  while (sub->len) {
+    size_t chunk = sub->len;
+    if (sub->head + chunk > STREAM_RING_SIZE) {
+      chunk = STREAM_RING_SIZE - sub->head;
+    }
+    ssize_t w = send(sub->fd, sub->ring + sub->head, chunk, MSG_NOSIGNAL);
+    if (w < 0) {
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    sub->head = (sub->head + w) % STREAM_RING_SIZE;
+    sub->len -= w;
+  }
+  return 0;
+}
+
+static void *run_publisher(void *args)
+{
+  stream_t *st = (stream_t *)args;
+  struct pollfd fds[STREAM_MAX_SUBSCRIBERS + 2];
+  subscriber_t *subs[STREAM_MAX_SUBSCRIBERS];
+
+  while (true) {
+    int n = 0;
+    fds[n].fd = st->wake_fd[0];
+    fds[n++].events = POLLIN;
+    fds[n].fd = st->listen_fd;
+    fds[n++].events = POLLIN;
+
+    pthread_mutex_lock(&st->mutex);
+    subscriber_t *sub = st->subscribers, *prev = NULL;
+    while (sub) {
+      subscriber_t *next = sub->next;
+      if (sub->dropped) {
+        fprintf(stderr, "Warning: dropping slow subscriber of the probe stream\n");
+        remove_subscriber(st, prev, sub);
+      } else {
+        subs[n-2] = sub;
+        fds[n].fd = sub->fd;
+        fds[n++].events = sub->len ? POLLOUT : POLLIN;
+        prev = sub;
+      }
+      sub = next;
+    }
+    pthread_mutex_unlock(&st->mutex);
+
+    if (poll(fds, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      char tmp[64];
+      ssize_t r = read(st->wake_fd[0], tmp, sizeof(tmp));
+      if (r > 0 && memchr(tmp, 'q', r)) {
+        break;
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      accept_subscriber(st);
+    }
+
+    pthread_mutex_lock(&st->mutex);
+    for (int i = 2; i < n; i++) {
+      sub = subs[i-2];
+      if (fds[i].revents & (POLLERR | POLLHUP)) {
+        sub->dropped = true;
+      } else if (fds[i].revents & POLLIN) {
+        // subscribers are not supposed to talk: a read of 0 means they left
+        char tmp[64];
+        if (recv(sub->fd, tmp, sizeof(tmp), 0) <= 0) {
+          sub->dropped = true;
+        }
+      }
+      if (!sub->dropped && write_subscriber(sub) < 0) {
+        sub->dropped = true;
+      }
+    }
+    pthread_mutex_unlock(&st->mutex);
+  }
+
+  return NULL;
+}
+
+stream_t *stream_new(const char *path)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Error: socket path %s is too long\n", path);
+    return NULL;
+  }
+
+  stream_t *st = calloc(1, sizeof(stream_t));
+  st->path = strdup(path);
+  pthread_mutex_init(&st->mutex, NULL);
+
+  if ((st->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("Error: can't create stream socket");
+    goto error;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(st->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+    || listen(st->listen_fd, 8) < 0) {
+    perror("Error: can't listen on stream socket");
+    close(st->listen_fd);
+    goto error;
+  }
+  if (pipe(st->wake_fd) < 0) {
+    perror("Error: can't create pipe");
+    close(st->listen_fd);
+    goto error;
+  }
+  fcntl(st->wake_fd[1], F_SETFL, fcntl(st->wake_fd[1], F_GETFL) | O_NONBLOCK);
+
+  if (pthread_create(&st->thread, NULL, run_publisher, st)) {
+    fprintf(stderr, "Error creating stream thread\n");
+    close(st->listen_fd);
+    close(st->wake_fd[0]);
+    close(st->wake_fd[1]);
+    unlink(path);
+    goto error;
+  }
+
+  return st;
+
+error:
+  pthread_mutex_destroy(&st->mutex);
+  free(st->path);
+  free(st);
+  return NULL;
+}
+
+// called by the logger thread: never blocks on a subscriber
+void stream_publish(stream_t *st, const probereq_t *pr, bool known)
+{
+  uint8_t buf[STREAM_MAX_MESSAGE + 8];
+  size_t len;
+
+  if ((len = encode_probes(pr, known, buf, sizeof(buf))) == 0) {
+    return;
+  }
+
+  bool wake = false;
+  pthread_mutex_lock(&st->mutex);
+  for (subscriber_t *sub = st->subscribers; sub; sub = sub->next) {
+    if (sub->dropped) {
+      continue;
+    }
+    if (sub->len + len > STREAM_RING_SIZE) {
+      sub->dropped = true;
+      st->dropped++;
+      wake = true;
+      continue;
+    }
+    size_t tail = (sub->head + sub->len) % STREAM_RING_SIZE;
+    size_t first = len < STREAM_RING_SIZE - tail ? len : STREAM_RING_SIZE - tail;
+    memcpy(sub->ring + tail, buf, first);
+    memcpy(sub->ring, buf + first, len - first);
+    wake = wake || sub->len == 0;
+    sub->len += len;
+  }
+  st->published++;
+  pthread_mutex_unlock(&st->mutex);
+
+  if (wake) {
+    // the pipe is non blocking: if it is full, the publisher is already awake
+    char c = 'w';
+    if (write(st->wake_fd[1], &c, 1) < 0) {
+      // ignore
+    }
+  }
+}
+
+void stream_free(stream_t *st)
+{
+  if (st == NULL) return;
+
+  char c = 'q';
+  if (write(st->wake_fd[1], &c, 1) == 1) {
+    pthread_join(st->thread, NULL);
+  } else {
+    pthread_cancel(st->thread);
+    pthread_join(st->thread, NULL);
+  }
+
+  while (st->subscribers) {
+    remove_subscriber(st, NULL, st->subscribers);
+  }
+  close(st->listen_fd);
+  close(st->wake_fd[0]);
+  close(st->wake_fd[1]);
+  unlink(st->path);
+  pthread_mutex_destroy(&st->mutex);
+  free(st->path);
+  free(st);
+}
@@ -0,0 +1,42 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "logger_thread.h"
+#include "config.h"
+
+// a client of the probe stream, with its own bounded ring buffer
+typedef struct subscriber {
+  int fd;
+  uint8_t ring[STREAM_RING_SIZE];
+  size_t head;            // next byte to write to the socket
+  size_t len;             // number of bytes waiting in the ring
+  bool dropped;           // too slow, will be disconnected
+  struct subscriber *next;
+} subscriber_t;
+
+// publisher of the accepted probe requests on a unix socket, as length-delimited
+// protobuf Probes messages (see src/www/probe.proto)
+typedef struct stream {
+  char *path;
+  int listen_fd;
+  int wake_fd[2];         // pipe to wake the publisher thread up
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  subscriber_t *subscribers;
+  int count;
+  uint64_t published;
+  uint64_t dropped;
+} stream_t;
+
+stream_t *stream_new(const char *path);
+void stream_publish(stream_t *st, const probereq_t *pr, bool known);
+void stream_free(stream_t *st);
+
+size_t encode_probes(const probereq_t *pr, bool known, uint8_t *buf, size_t size);
+
+#endif
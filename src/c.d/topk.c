@@ -0,0 +1,342 @@
+/*
+heavy hitters with Space-Saving (Metwally et al., 2005): a summary keeps
+TOPK_SIZE counters; a key without one takes the counter of the least frequent
+key, whose count it inherits as error. Every key seen more often than
+1/TOPK_SIZE of the time is then in the summary, with its count overestimated by
+at most its error. There is a summary per dimension for each 5 min of the last
+hour and for each hour of the last day, so that the memory used doesn't depend
+on the number of macs or ssids.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "topk.h"
+
+static const int32_t tiers[TOPK_TIERS][2] = {
+  { 300, 12 },          // duration of a slice in s, number of slices
+  { 3600, 24 },
+};
+
+static const char *dimension_names[TOPK_DIMENSIONS] = { "mac", "ssid", "vendor" };
+
+#define INDEX_MASK (2 * TOPK_SIZE - 1)
+
+// FNV-1a of the key, as truncated in a counter
+static uint64_t key_hash(const char *key)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (int i = 0; i < TOPK_KEY_SIZE - 1 && key[i]; i++) {
+    h = (h ^ (uint8_t)key[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+topk_store_t *topk_new(void)
+{
+  topk_store_t *store = calloc(1, sizeof(topk_store_t));
+  if (store == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&store->lock, NULL);
+  for (int t = 0; t < TOPK_TIERS; t++) {
+    struct topk_tier *tier = &store->tiers[t];
+    tier->duration = tiers[t][0];
+    tier->count = tiers[t][1];
+    if ((tier->slices = calloc(tier->count, sizeof(struct topk_slice))) == NULL) {
+      topk_free(store);
+      return NULL;
+    }
+    for (int i = 0; i < tier->count; i++) {
+      tier->slices[i].number = -1;
+    }
+  }
+  return store;
+}
+
+static void index_insert(struct topk_summary *s, uint16_t counter)
+{
+  uint32_t i = s->counters[counter].hash & INDEX_MASK;
+  while (s->index[i]) {
+    i = (i + 1) & INDEX_MASK;
+  }
+  s->index[i] = counter + 1;
+}
+
+// with backward shift, so that no lookup stops early on the free slot
+static void index_remove(struct topk_summary *s, uint16_t counter)
+{
+  uint32_t i = s->counters[counter].hash & INDEX_MASK;
+  while (s->index[i] != counter + 1) {
+    i = (i + 1) & INDEX_MASK;
+  }
+  for (uint32_t j = (i + 1) & INDEX_MASK; s->index[j]; j = (j + 1) & INDEX_MASK) {
+    uint32_t home = s->counters[s->index[j] - 1].hash & INDEX_MASK;
+    // the entry at j can fill the free slot if it is between its home and j
+    if (((j - home) & INDEX_MASK) >= ((j - i) & INDEX_MASK)) {
+      s->index[i] = s->index[j];
+      i = j;
+    }
+  }
+  s->index[i] = 0;
+}
+
+static void summary_add(struct topk_summary *s, const char *key, uint32_t count)
+{
+  uint64_t hash = key_hash(key);
+
+  for (uint32_t i = hash & INDEX_MASK; s->index[i]; i = (i + 1) & INDEX_MASK) {
+    struct topk_counter *c = &s->counters[s->index[i] - 1];
+    if (c->hash == hash && strncmp(c->key, key, TOPK_KEY_SIZE - 1) == 0) {
+      c->count += count;
+      return;
+    }
+  }
+
+  struct topk_counter *c;
+  if (s->used < TOPK_SIZE) {
+    c = &s->counters[s->used++];
+    c->count = 0;
+    c->error = 0;
+  } else {
+    // replace the least frequent key
+    c = &s->counters[0];
+    for (int i = 1; i < TOPK_SIZE; i++) {
+      if (s->counters[i].count < c->count) {
+        c = &s->counters[i];
+      }
+    }
+    index_remove(s, c - s->counters);
+    c->error = c->count;
+  }
+  c->count += count;
+  c->hash = hash;
+  snprintf(c->key, sizeof(c->key), "%s", key);
+  index_insert(s, c - s->counters);
+}
+
+// count is the number of probe requests (more than one for a burst)
+void topk_add(topk_store_t *store, const char *mac, const char *ssid, const char *vendor,
+  struct timeval tv, uint32_t count)
+{
+  const char *keys[TOPK_DIMENSIONS] = { mac, ssid, vendor };
+
+  pthread_mutex_lock(&store->lock);
+  for (int t = 0; t < TOPK_TIERS; t++) {
+    struct topk_tier *tier = &store->tiers[t];
+    int64_t number = tv.tv_sec / tier->duration;
+    struct topk_slice *slice = &tier->slices[number % tier->count];
+    if (slice->number > number) {
+      // older than what the ring holds
+      continue;
+    }
+    if (slice->number < number) {
+      memset(slice->summaries, 0, sizeof(slice->summaries));
+      slice->number = number;
+    }
+    for (int d = 0; d < TOPK_DIMENSIONS; d++) {
+      // broadcast probe requests don't count for an ssid
+      if (keys[d] && keys[d][0] != '\0') {
+        summary_add(&slice->summaries[d], keys[d], count);
+      }
+    }
+  }
+  pthread_mutex_unlock(&store->lock);
+}
+
+struct merged {
+  const struct topk_counter *c;
+  uint64_t count;
+  uint64_t error;
+  uint64_t missed;      // the minimum counts of the full slices it is in
+};
+
+static int cmp_hash(const void *a, const void *b)
+{
+  const struct topk_counter *ca = ((const struct merged *)a)->c;
+  const struct topk_counter *cb = ((const struct merged *)b)->c;
+  if (ca->hash != cb->hash) {
+    return ca->hash < cb->hash ? -1 : 1;
+  }
+  return strcmp(ca->key, cb->key);
+}
+
+static int cmp_count(const void *a, const void *b)
+{
+  const struct merged *ma = (const struct merged *)a;
+  const struct merged *mb = (const struct merged *)b;
+  if (ma->count != mb->count) {
+    return ma->count > mb->count ? -1 : 1;
+  }
+  return strcmp(ma->c->key, mb->c->key);
+}
+
+// the n most frequent keys of dimension in the window of s before now (in s),
+// rounded up to whole slices; returns how many were written to results, or -1
+int topk_query(topk_store_t *store, enum topk_dimension dimension, int32_t window, int64_t now,
+  struct topk_result *results, int n)
+{
+  // the finest tier covering the window
+  int t = 0;
+  while (t < TOPK_TIERS - 1 && (int64_t)store->tiers[t].duration * store->tiers[t].count < window) {
+    t++;
+  }
+  struct topk_tier *tier = &store->tiers[t];
+  int slices = (window + tier->duration - 1) / tier->duration;
+  if (slices < 1) {
+    slices = 1;
+  } else if (slices > tier->count) {
+    slices = tier->count;
+  }
+
+  struct merged *m = malloc(slices * TOPK_SIZE * sizeof(struct merged));
+  if (m == NULL) {
+    return -1;
+  }
+  int count = 0;
+  // a key missing from a full slice may have had up to its minimum count there
+  uint64_t missed = 0;
+  pthread_mutex_lock(&store->lock);
+  int64_t last = now / tier->duration;
+  for (int64_t number = last - slices + 1 < 0 ? 0 : last - slices + 1; number <= last; number++) {
+    const struct topk_slice *slice = &tier->slices[number % tier->count];
+    if (slice->number != number) {
+      continue;
+    }
+    const struct topk_summary *s = &slice->summaries[dimension];
+    uint64_t min = 0;
+    if (s->used == TOPK_SIZE) {
+      min = s->counters[0].count;
+      for (int i = 1; i < s->used; i++) {
+        if (s->counters[i].count < min) {
+          min = s->counters[i].count;
+        }
+      }
+      missed += min;
+    }
+    for (int i = 0; i < s->used; i++) {
+      m[count].c = &s->counters[i];
+      m[count].count = s->counters[i].count;
+      m[count].error = s->counters[i].error;
+      m[count].missed = min;
+      count++;
+    }
+  }
+
+  // sum the counters of the same key over the slices
+  qsort(m, count, sizeof(struct merged), cmp_hash);
+  int keys = 0;
+  for (int i = 0; i < count; i++) {
+    if (keys > 0 && cmp_hash(&m[keys - 1], &m[i]) == 0) {
+      m[keys - 1].count += m[i].count;
+      m[keys - 1].error += m[i].error;
+      m[keys - 1].missed += m[i].missed;
+    } else {
+      m[keys++] = m[i];
+    }
+  }
+  // so that count stays an upper bound, and error how far above it may be
+  for (int i = 0; i < keys; i++) {
+    m[i].count += missed - m[i].missed;
+    m[i].error += missed - m[i].missed;
+  }
+  qsort(m, keys, sizeof(struct merged), cmp_count);
+  if (n > keys) {
+    n = keys;
+  }
+  for (int i = 0; i < n; i++) {
+    strcpy(results[i].key, m[i].c->key);
+    results[i].count = m[i].count;
+    results[i].error = m[i].error;
+  }
+  pthread_mutex_unlock(&store->lock);
+  free(m);
+
+  return n;
+}
+
+size_t topk_memory(const topk_store_t *store)
+{
+  size_t memory = sizeof(topk_store_t);
+  for (int t = 0; t < TOPK_TIERS; t++) {
+    memory += store->tiers[t].count * sizeof(struct topk_slice);
+  }
+  return memory;
+}
+
+// ------------------------------------------
+// /api/top
+// ------------------------------------------
+static void get_top(const char *query, http_response_t *resp, void *data)
+{
+  topk_store_t *store = (topk_store_t *)data;
+  struct topk_result results[TOPK_SIZE];
+  char value[64];
+  int dimension = TOPK_MAC;
+  int32_t window = tiers[0][0];
+  int n = 10;
+
+  if (http_query_next(query, "by", value, sizeof(value)) != NULL) {
+    for (dimension = 0; dimension < TOPK_DIMENSIONS; dimension++) {
+      if (strcmp(value, dimension_names[dimension]) == 0) {
+        break;
+      }
+    }
+    if (dimension == TOPK_DIMENSIONS) {
+      resp->status = 400;
+      http_printf(resp, "{\"message\": \"Invalid by parameter\"}");
+      return;
+    }
+  }
+  if (http_query_next(query, "window", value, sizeof(value)) != NULL) {
+    window = atoi(value);
+    if (window <= 0) {
+      resp->status = 400;
+      http_printf(resp, "{\"message\": \"Invalid window parameter\"}");
+      return;
+    }
+  }
+  if (http_query_next(query, "count", value, sizeof(value)) != NULL) {
+    n = atoi(value);
+    if (n <= 0 || n > TOPK_SIZE) {
+      resp->status = 400;
+      http_printf(resp, "{\"message\": \"Invalid count parameter\"}");
+      return;
+    }
+  }
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  if ((n = topk_query(store, dimension, window, now.tv_sec, results, n)) < 0) {
+    resp->status = 500;
+    return;
+  }
+  http_append(resp, "[", 1);
+  for (int i = 0; i < n; i++) {
+    if (i > 0) {
+      http_append(resp, ", ", 2);
+    }
+    http_append(resp, "{\"key\": ", 8);
+    http_append_json_str(resp, results[i].key);
+    http_printf(resp, ", \"count\": %" PRIu64 ", \"error\": %" PRIu64 "}", results[i].count, results[i].error);
+  }
+  http_append(resp, "]", 1);
+}
+
+void topk_routes(topk_store_t *store, http_server_t *server)
+{
+  http_route(server, "/api/top", get_top, store);
+}
+
+void topk_free(topk_store_t *store)
+{
+  if (store == NULL) return;
+
+  for (int t = 0; t < TOPK_TIERS; t++) {
+    free(store->tiers[t].slices);
+  }
+  pthread_mutex_destroy(&store->lock);
+  free(store);
+}
@@ -0,0 +1,70 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "http.h"
+#include "config.h"
+
+#define TOPK_TIERS 2
+
+enum topk_dimension {
+  TOPK_MAC = 0,
+  TOPK_SSID,
+  TOPK_VENDOR,
+  TOPK_DIMENSIONS
+};
+
+struct topk_counter {
+  uint64_t hash;
+  uint32_t count;
+  uint32_t error;       // count overestimates the probe requests of key by at most that
+  char key[TOPK_KEY_SIZE];
+};
+
+// Space-Saving summary of the keys of a dimension during a slice of time
+struct topk_summary {
+  struct topk_counter counters[TOPK_SIZE];
+  uint16_t index[2 * TOPK_SIZE];  // by hash, with linear probing: counter + 1, 0 if free
+  uint16_t used;
+};
+
+struct topk_slice {
+  int64_t number;       // start of the slice / its duration, -1 if unused
+  struct topk_summary summaries[TOPK_DIMENSIONS];
+};
+
+// a ring of consecutive slices of the same duration
+struct topk_tier {
+  int32_t duration;     // in s
+  int32_t count;
+  struct topk_slice *slices;
+};
+
+// the most frequent macs, ssids and vendors of the last minutes and hours: a
+// summary of fixed size per dimension and slice of time, those of the slices of
+// a window being merged when queried
+typedef struct topk_store {
+  pthread_mutex_t lock;
+  struct topk_tier tiers[TOPK_TIERS];
+} topk_store_t;
+
+struct topk_result {
+  char key[TOPK_KEY_SIZE];
+  uint64_t count;
+  uint64_t error;
+};
+
+topk_store_t *topk_new(void);
+void topk_add(topk_store_t *store, const char *mac, const char *ssid, const char *vendor,
+  struct timeval tv, uint32_t count);
+int topk_query(topk_store_t *store, enum topk_dimension dimension, int32_t window, int64_t now,
+  struct topk_result *results, int n);
+size_t topk_memory(const topk_store_t *store);
+void topk_routes(topk_store_t *store, http_server_t *server);
+void topk_free(topk_store_t *store);
+
+#endif
@@ -0,0 +1,265 @@
+/*
+optional tracing of the stages of the processing of each packet, only built
+with -Dtracing=true. Durations are read from the tick counter of the cpu and
+kept in HDR-style histograms: log-linear buckets with 32 sub-buckets per
+power of 2, ie a relative error below 3%. With -Dperf=true, the hardware
+counters of each traced thread are also read with perf_event_open.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#ifdef PROBEMON_PERF
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define SUB_BITS 5
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_BITS 40                               // ~18 minutes at 1 GHz
+#define BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+#define MAX_THREADS (MAX_WORKERS + 2)   // capture, db writer and workers
+
+struct hdr_histogram {
+  uint64_t counts[BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t max;
+};
+
+static const char *stage_names[TRACE_STAGES] = {
+  "radiotap", "ie_walk", "enqueue_wait", "oui_lookup",
+  "ignore_check", "cache_lookup", "sql_insert", "stdout"
+};
+
+// the workers share stages: each traced thread records into its own histograms
+// (see struct trace_thread), merged when reported; the others share these ones
+static struct hdr_histogram shared[TRACE_STAGES];
+static double ns_per_tick = 1.0;
+
+static int bucket_index(uint64_t v)
+{
+  if (v < SUB_COUNT) {
+    return v;
+  }
+  int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+  int i = (shift + 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+  return i < BUCKETS ? i : BUCKETS - 1;
+}
+
+// highest value of a bucket
+static uint64_t bucket_value(int i)
+{
+  if (i < SUB_COUNT) {
+    return i;
+  }
+  int shift = i / SUB_COUNT - 1;
+  uint64_t mantissa = i % SUB_COUNT + SUB_COUNT;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+// ------------------------------------------
+// threads
+// ------------------------------------------
+enum perf_counter { PERF_CYCLES = 0, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_COUNTERS };
+
+struct trace_thread {
+  const char *name;
+  struct hdr_histogram histograms[TRACE_STAGES];    // single writer: this thread
+  int fds[PERF_COUNTERS];
+  uint64_t values[PERF_COUNTERS];
+};
+
+static struct trace_thread threads[MAX_THREADS];
+static int threads_count = 0;
+static pthread_mutex_t mutex_threads = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct trace_thread *local = NULL;
+
+void trace_record(enum trace_stage stage, uint64_t ticks)
+{
+  int i = bucket_index(ticks);
+  if (local == NULL) {
+    struct hdr_histogram *h = &shared[stage];
+    __atomic_fetch_add(&h->counts[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, ticks, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ticks > max && !__atomic_compare_exchange_n(&h->max, &max, ticks, true,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return;
+  }
+  struct hdr_histogram *h = &local->histograms[stage];
+  __atomic_store_n(&h->counts[i], h->counts[i] + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->total, h->total + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum, h->sum + ticks, __ATOMIC_RELAXED);
+  if (ticks > h->max) {
+    __atomic_store_n(&h->max, ticks, __ATOMIC_RELAXED);
+  }
+}
+
+static void merge(struct hdr_histogram *to, const struct hdr_histogram *h)
+{
+  for (int i = 0; i < BUCKETS; i++) {
+    to->counts[i] += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+  }
+  to->total += __atomic_load_n(&h->total, __ATOMIC_RELAXED);
+  to->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  if (max > to->max) {
+    to->max = max;
+  }
+}
+
+static uint64_t percentile(const struct hdr_histogram *h, double p)
+{
+  uint64_t rank = (uint64_t)(h->total * p + 0.5), seen = 0;
+  if (rank == 0) rank = 1;
+  for (int i = 0; i < BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank) {
+      uint64_t v = bucket_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+// ------------------------------------------
+// perf counters
+// ------------------------------------------
+
+#ifdef PROBEMON_PERF
+static int open_counter(uint64_t config)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // this thread only, on any cpu
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+void trace_thread_start(const char *name)
+{
+  // set up under the lock, trace_report() reading the counters of the threads listed
+  pthread_mutex_lock(&mutex_threads);
+  if (threads_count == MAX_THREADS) {
+    pthread_mutex_unlock(&mutex_threads);
+    return;
+  }
+  struct trace_thread *t = &threads[threads_count];
+  t->name = name;
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    t->fds[i] = -1;
+  }
+#ifdef PROBEMON_PERF
+  static const uint64_t configs[PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+  };
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if ((t->fds[i] = open_counter(configs[i])) < 0) {
+      perror("Warning: can't open perf counter (check /proc/sys/kernel/perf_event_paranoid)");
+      break;
+    }
+  }
+#endif
+  __atomic_store_n(&threads_count, threads_count + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&mutex_threads);
+  local = t;
+}
+
+// with mutex_threads held; a counter follows its thread, and can be read from any other
+static void read_counters(struct trace_thread *t)
+{
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (t->fds[i] >= 0 && read(t->fds[i], &t->values[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+      t->values[i] = 0;
+    }
+  }
+}
+
+void trace_thread_stop(void)
+{
+  if (local == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_threads);
+  read_counters(local);
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    if (local->fds[i] >= 0) {
+      close(local->fds[i]);
+      local->fds[i] = -1;
+    }
+  }
+  pthread_mutex_unlock(&mutex_threads);
+}
+
+// ------------------------------------------
+// clock
+// ------------------------------------------
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// measure the frequency of the tick counter against the monotonic clock
+void trace_init(void)
+{
+  uint64_t t0 = now_ns(), c0 = trace_clock();
+  usleep(20000);
+  uint64_t t1 = now_ns(), c1 = trace_clock();
+  if (c1 > c0) {
+    ns_per_tick = (double)(t1 - t0) / (c1 - c0);
+  }
+}
+
+void trace_report(FILE *f)
+{
+  static struct hdr_histogram h;
+  int count = __atomic_load_n(&threads_count, __ATOMIC_ACQUIRE);
+
+  fprintf(f, ":: Trace, in ns:\n%-14s %10s %10s %10s %10s %10s %10s\n",
+    "stage", "count", "mean", "p50", "p90", "p99", "max");
+  for (int s = 0; s < TRACE_STAGES; s++) {
+    memset(&h, 0, sizeof(h));
+    merge(&h, &shared[s]);
+    for (int i = 0; i < count; i++) {
+      merge(&h, &threads[i].histograms[s]);
+    }
+    if (h.total == 0) {
+      continue;
+    }
+    fprintf(f, "%-14s %10" PRIu64 " %10.0f %10.0f %10.0f %10.0f %10.0f\n", stage_names[s], h.total,
+      h.sum * ns_per_tick / h.total, percentile(&h, 0.5) * ns_per_tick, percentile(&h, 0.9) * ns_per_tick,
+      percentile(&h, 0.99) * ns_per_tick, h.max * ns_per_tick);
+  }
+  // the counters of the running threads are read now, those of the stopped ones were on their exit
+  pthread_mutex_lock(&mutex_threads);
+  for (int i = 0; i < threads_count; i++) {
+    struct trace_thread *t = &threads[i];
+    read_counters(t);
+    if (t->values[PERF_CYCLES] == 0) {
+      continue;
+    }
+    fprintf(f, ":: %s thread: cycles=%" PRIu64 " instructions=%" PRIu64 " IPC=%.2f cache misses=%" PRIu64 "\n",
+      t->name, t->values[PERF_CYCLES], t->values[PERF_INSTRUCTIONS],
+      (double)t->values[PERF_INSTRUCTIONS] / t->values[PERF_CYCLES], t->values[PERF_CACHE_MISSES]);
+  }
+  pthread_mutex_unlock(&mutex_threads);
+  fflush(f);
+}
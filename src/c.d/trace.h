@@ -0,0 +1,72 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "config.h"
+
+// stages of the processing of a packet, timed when built with -Dtracing=true
+enum trace_stage {
+  TRACE_RADIOTAP = 0,
+  TRACE_IE_WALK,
+  TRACE_ENQUEUE_WAIT,
+  TRACE_OUI_LOOKUP,
+  TRACE_IGNORE_CHECK,
+  TRACE_CACHE_LOOKUP,
+  TRACE_SQL_INSERT,
+  TRACE_STDOUT,
+  TRACE_STAGES
+};
+
+#ifdef PROBEMON_TRACING
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// cheapest monotonic tick counter of the platform; converted to ns when reported
+static inline uint64_t trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t v;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void trace_init(void);
+void trace_thread_start(const char *name);
+void trace_thread_stop(void);
+void trace_record(enum trace_stage stage, uint64_t ticks);
+void trace_report(FILE *f);
+
+#define TRACE_BEGIN(stage) uint64_t trace_start_##stage = trace_clock()
+// time the same stage again in the same scope
+#define TRACE_RESTART(stage) trace_start_##stage = trace_clock()
+#define TRACE_END(stage) trace_record(TRACE_##stage, trace_clock() - trace_start_##stage)
+#define TRACE_INIT() trace_init()
+#define TRACE_THREAD_START(name) trace_thread_start(name)
+#define TRACE_THREAD_STOP() trace_thread_stop()
+#define TRACE_REPORT(f) trace_report(f)
+
+#else
+
+// compiled out
+#define TRACE_BEGIN(stage) do {} while (0)
+#define TRACE_RESTART(stage) do {} while (0)
+#define TRACE_END(stage) do {} while (0)
+#define TRACE_INIT() do {} while (0)
+#define TRACE_THREAD_START(name) do {} while (0)
+#define TRACE_THREAD_STOP() do {} while (0)
+#define TRACE_REPORT(f) do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+/*
+counts of distinct devices per period, overall and per ssid and vendor: a
+HyperLogLog sketch (see hll.c) for each, of a few bytes to 4 KB whatever the
+number of macs, even under a flood of randomized ones. Only the sketches of
+the current periods are in memory: a sketch is merged with the one already in
+the db, written by a previous run or before a late probe request came, so that
+the table always holds the sketch of every probe request of the period.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uniques.h"
+#include "manuf.h"
+#include "db.h"
+#include "config.h"
+
+static const int32_t granularities[] = { 300, 3600, 86400 };
+#define GRANULARITIES (sizeof(granularities) / sizeof(granularities[0]))
+
+// size buckets; past max sketches, the new ssids and vendors are not counted
+unique_store_t *uniques_new(uint32_t size, uint32_t max)
+{
+  unique_store_t *store = calloc(1, sizeof(unique_store_t));
+  if (store == NULL) {
+    return NULL;
+  }
+  if ((store->buckets = calloc(size, sizeof(struct unique_sketch *))) == NULL) {
+    free(store);
+    return NULL;
+  }
+  store->size = size;
+  store->max = max;
+  return store;
+}
+
+static uint32_t sketch_hash(int32_t granularity, int64_t start, uint8_t dimension, const char *value, uint32_t size)
+{
+  uint32_t h = 2166136261u;
+  for (const char *p = value; *p; p++) {
+    h ^= (uint8_t)*p;
+    h *= 16777619u;
+  }
+  h ^= (uint32_t)(start / granularity) * 0x9e3779b1u + dimension;
+  return h % size;
+}
+
+static struct unique_sketch *get_sketch(unique_store_t *store, int32_t granularity, int64_t start,
+  uint8_t dimension, const char *value)
+{
+  struct unique_sketch **p = &store->buckets[sketch_hash(granularity, start, dimension, value, store->size)];
+  struct unique_sketch *s = *p;
+
+  while (s && (s->granularity != granularity || s->start != start || s->dimension != dimension
+      || strcmp(s->value, value))) {
+    s = s->next;
+  }
+  if (s) {
+    return s;
+  }
+
+  // past the limit, only the overall counts are kept
+  if (store->count >= store->max && dimension != UNIQUE_ALL) {
+    return NULL;
+  }
+  if ((s = malloc(sizeof(struct unique_sketch))) == NULL) {
+    return NULL;
+  }
+  if ((s->value = strdup(value)) == NULL) {
+    free(s);
+    return NULL;
+  }
+  s->granularity = granularity;
+  s->start = start;
+  s->dimension = dimension;
+  s->dirty = false;
+  s->loaded = false;
+  hll_init(&s->hll);
+  s->next = *p;
+  *p = s;
+  store->count++;
+  return s;
+}
+
+void uniques_add(unique_store_t *store, const char *mac, const char *ssid, const char *vendor, struct timeval tv)
+{
+  uint64_t hash = hll_hash(mac_to_uint64(mac));
+  const char *values[UNIQUE_DIMENSIONS] = { "", ssid, vendor };
+
+  if (tv.tv_sec > store->latest) {
+    store->latest = tv.tv_sec;
+  }
+  for (size_t g = 0; g < GRANULARITIES; g++) {
+    int64_t start = tv.tv_sec - tv.tv_sec % granularities[g];
+    for (int d = 0; d < UNIQUE_DIMENSIONS; d++) {
+      // broadcast probe requests don't count for an ssid
+      if (values[d] == NULL || (d != UNIQUE_ALL && values[d][0] == '\0')) {
+        continue;
+      }
+      struct unique_sketch *s = get_sketch(store, granularities[g], start, d, values[d]);
+      if (s == NULL || hll_add(&s->hll, hash)) {
+        store->dropped++;
+        continue;
+      }
+      s->dirty = true;
+    }
+  }
+}
+
+// write the sketches that changed, then forget those of the periods over for more
+// than a period; with the transaction opened
+void uniques_flush(unique_store_t *store, sqlite3 *db)
+{
+  for (uint32_t i = 0; i < store->size; i++) {
+    struct unique_sketch **p = &store->buckets[i];
+    while (*p) {
+      struct unique_sketch *s = *p;
+      if (s->dirty) {
+        if (!s->loaded && load_unique_sketch(s->granularity, s->start, s->dimension, s->value, &s->hll, db) == 0) {
+          s->loaded = true;
+        }
+        if (s->loaded && save_unique_sketch(s->granularity, s->start, s->dimension, s->value, &s->hll, db) == 0) {
+          s->dirty = false;
+        }
+      }
+      if (!s->dirty && s->start + 2 * s->granularity <= store->latest) {
+        *p = s->next;
+        hll_clear(&s->hll);
+        free(s->value);
+        free(s);
+        store->count--;
+      } else {
+        p = &s->next;
+      }
+    }
+  }
+}
+
+size_t uniques_memory(const unique_store_t *store)
+{
+  size_t memory = store->size * sizeof(struct unique_sketch *);
+  for (uint32_t i = 0; i < store->size; i++) {
+    for (struct unique_sketch *s = store->buckets[i]; s; s = s->next) {
+      memory += sizeof(struct unique_sketch) + strlen(s->value) + 1 + hll_memory(&s->hll);
+    }
+  }
+  return memory;
+}
+
+void uniques_free(unique_store_t *store)
+{
+  if (store == NULL) return;
+
+  for (uint32_t i = 0; i < store->size; i++) {
+    struct unique_sketch *s = store->buckets[i];
+    while (s) {
+      struct unique_sketch *next = s->next;
+      hll_clear(&s->hll);
+      free(s->value);
+      free(s);
+      s = next;
+    }
+  }
+  free(store->buckets);
+  free(store);
+}
@@ -0,0 +1,48 @@
+#ifndef UNIQUES_H
+#define UNIQUES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <sqlite3.h>
+
+#include "hll.h"
+
+enum unique_dimension {
+  UNIQUE_ALL = 0,       // every mac
+  UNIQUE_SSID,          // the macs probing for an ssid
+  UNIQUE_VENDOR,        // the macs of a vendor
+  UNIQUE_DIMENSIONS
+};
+
+// the macs seen during a period, of a dimension
+struct unique_sketch {
+  int32_t granularity;  // in s
+  int64_t start;        // in s
+  uint8_t dimension;
+  char *value;          // ssid or vendor, "" for UNIQUE_ALL
+  bool dirty;           // changed since written
+  bool loaded;          // merged with the sketch in the db
+  hll_t hll;
+  struct unique_sketch *next;
+};
+
+// sketches of the distinct macs per 5 min, hour and day, overall and per ssid and
+// vendor, written to the uniques table at each commit; those of the periods over
+// are then forgotten
+typedef struct unique_store {
+  struct unique_sketch **buckets;
+  uint32_t size;
+  uint32_t count;
+  uint32_t max;         // sketches, past which only the overall counts are kept
+  int64_t latest;       // newest probe request seen, in s
+  uint64_t dropped;     // adds to a sketch that couldn't be created
+} unique_store_t;
+
+unique_store_t *uniques_new(uint32_t size, uint32_t max);
+void uniques_add(unique_store_t *store, const char *mac, const char *ssid, const char *vendor, struct timeval tv);
+void uniques_flush(unique_store_t *store, sqlite3 *db);
+size_t uniques_memory(const unique_store_t *store);
+void uniques_free(unique_store_t *store);
+
+#endif
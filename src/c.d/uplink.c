@@ -0,0 +1,728 @@
+/*
+sensor side of the sensor to collector mode: the probe requests and bursts are
+encoded in binary records, batched and compressed with zlib, then sent over TCP
+to probemon-collector (see collector.c). A batch is only forgotten once the
+collector acknowledges it is committed to its db; when the collector can't be
+reached, the batches pile up in memory, then in the spool file, and are sent
+again once the connection is back.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <time.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <zlib.h>
+
+#include "uplink.h"
+#include "parsers.h"
+#include "manuf.h"
+#include "metrics.h"
+
+// ------------------------------------------
+// records
+// ------------------------------------------
+enum record_kind { RECORD_PROBEREQ = 0, RECORD_PROBEBURST };
+
+static uint64_t timeval_us(struct timeval tv)
+{
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// a record is: kind (u8), time in µs (u64), mac (6 bytes), rssi (i8), seq (u16), fingerprint (u64),
+// ssid length (u8) and ssid, vendor length (u8) and vendor with its '\0', then for a
+// burst: last time in µs (u64), count (u32), rssi min and max (i8), rssi sum (u64)
+// returns its size, or 0 if it doesn't fit in buf
+size_t uplink_encode(const struct write_item *item, uint8_t *buf, size_t size)
+{
+  const probereq_t *pr = item->burst ? item->burst->pr : item->pr;
+  size_t vendor_len = pr->vendor ? strlen(pr->vendor) : 0;
+  size_t n = 0;
+
+  if (vendor_len > 254) {
+    vendor_len = 254;
+  }
+  if (1 + 8 + 6 + 1 + 2 + 8 + 1 + pr->ssid_len + 1 + vendor_len + 1 + 8 + 4 + 2 + 8 > size) {
+    return 0;
+  }
+
+  buf[n++] = item->burst ? RECORD_PROBEBURST : RECORD_PROBEREQ;
+  uplink_put_u64(buf + n, timeval_us(pr->tv));
+  n += 8;
+  uint64_t mac = mac_to_uint64(pr->mac);
+  for (int i = 5; i >= 0; i--) {
+    buf[n++] = mac >> (8 * i);
+  }
+  buf[n++] = (uint8_t)(int8_t)pr->rssi;
+  buf[n++] = pr->seq;
+  buf[n++] = pr->seq >> 8;
+  uplink_put_u64(buf + n, pr->fingerprint);
+  n += 8;
+  buf[n++] = pr->ssid_len;
+  memcpy(buf + n, pr->ssid, pr->ssid_len);
+  n += pr->ssid_len;
+  buf[n++] = vendor_len + 1;
+  memcpy(buf + n, pr->vendor ? pr->vendor : "", vendor_len);
+  n += vendor_len;
+  buf[n++] = '\0';
+
+  if (item->burst) {
+    const probeburst_t *b = item->burst;
+    uplink_put_u64(buf + n, timeval_us(b->last));
+    n += 8;
+    uplink_put_u32(buf + n, b->count);
+    n += 4;
+    buf[n++] = (uint8_t)(int8_t)b->rssi_min;
+    buf[n++] = (uint8_t)(int8_t)b->rssi_max;
+    uplink_put_u64(buf + n, (uint64_t)b->rssi_sum);
+    n += 8;
+  }
+
+  return n;
+}
+
+// decode the record at the start of buf into pr, and burst if it is one (burst->pr is
+// then pr); pr->vendor points into buf
+// returns the size of the record, or 0 if it is malformed
+size_t uplink_decode(const uint8_t *buf, size_t len, probereq_t *pr, probeburst_t *burst, bool *is_burst)
+{
+  size_t n = 0;
+
+  if (len < 1 + 8 + 6 + 1 + 2 + 8 + 1 || buf[0] > RECORD_PROBEBURST) {
+    return 0;
+  }
+  *is_burst = buf[n++] == RECORD_PROBEBURST;
+  uint64_t ts = uplink_get_u64(buf + n);
+  n += 8;
+  pr->tv.tv_sec = ts / 1000000;
+  pr->tv.tv_usec = ts % 1000000;
+  snprintf(pr->mac, sizeof(pr->mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+    buf[n], buf[n+1], buf[n+2], buf[n+3], buf[n+4], buf[n+5]);
+  n += 6;
+  pr->rssi = (int8_t)buf[n++];
+  pr->seq = buf[n] | buf[n+1] << 8;
+  n += 2;
+  pr->fingerprint = uplink_get_u64(buf + n);
+  n += 8;
+  pr->ssid_len = buf[n++];
+  if (pr->ssid_len > sizeof(pr->ssid) || n + pr->ssid_len + 1 > len) {
+    return 0;
+  }
+  memcpy(pr->ssid, buf + n, pr->ssid_len);
+  n += pr->ssid_len;
+  size_t vendor_len = buf[n++];
+  if (vendor_len == 0 || n + vendor_len > len || buf[n + vendor_len - 1] != '\0') {
+    return 0;
+  }
+  pr->vendor = (const char *)buf + n;
+  n += vendor_len;
+  ssid_to_str(pr->ssid, pr->ssid_len, pr->ssid_str);
+
+  if (*is_burst) {
+    if (n + 8 + 4 + 2 + 8 > len) {
+      return 0;
+    }
+    burst->pr = pr;
+    ts = uplink_get_u64(buf + n);
+    n += 8;
+    burst->last.tv_sec = ts / 1000000;
+    burst->last.tv_usec = ts % 1000000;
+    burst->count = uplink_get_u32(buf + n);
+    n += 4;
+    burst->rssi_min = (int8_t)buf[n++];
+    burst->rssi_max = (int8_t)buf[n++];
+    burst->rssi_sum = (int64_t)uplink_get_u64(buf + n);
+    n += 8;
+    burst->next = NULL;
+  }
+
+  return n;
+}
+
+// ------------------------------------------
+// batches
+// ------------------------------------------
+static void wake(uplink_t *up)
+{
+  // the pipe is non blocking: if it is full, the uplink thread is already awake
+  char c = 'w';
+  if (write(up->wake_fd[1], &c, 1) < 0) {
+    // ignore
+  }
+}
+
+static void update_backlog(uplink_t *up)
+{
+  metrics_set(GAUGE_UPLINK_BACKLOG, up->frames_count + up->spool_count);
+}
+
+// append a batch to the spool file; with the mutex held
+static void spool_frame(uplink_t *up, uplink_frame_t *f)
+{
+  if (up->spool_fd < 0 || write(up->spool_fd, f->data, f->len) != f->len) {
+    fprintf(stderr, "Error: can't spool a batch for the collector, %u records lost\n",
+      uplink_get_u32(f->data + UPLINK_HEADER_SIZE + 8));
+    if (up->spool_fd >= 0 && ftruncate(up->spool_fd, up->spool_size) < 0) {
+      // the next frame will be written after the partial one, and the spool cut there on load
+    }
+  } else {
+    up->spool_size += f->len;
+    up->spool_count++;
+    up->spool_last = f->seq;
+  }
+  free(f);
+}
+
+// the seq of the batches must keep increasing from one run to the next, whatever
+// the clock: they are reserved by blocks of UPLINK_SEQ_BLOCK, in the state file
+static void reserve_seq(uplink_t *up)
+{
+  up->seq_reserved = up->next_seq + UPLINK_SEQ_BLOCK;
+
+  size_t len = strlen(up->state_path) + 5;
+  char *tmp_path = malloc(len);
+  snprintf(tmp_path, len, "%s.tmp", up->state_path);
+  FILE *f = fopen(tmp_path, "w");
+  bool ok = f != NULL && fprintf(f, "%" PRIu64 "\n", up->seq_reserved) > 0 && fflush(f) == 0
+    && fsync(fileno(f)) == 0;
+  if ((f == NULL || fclose(f) != 0 || !ok) || rename(tmp_path, up->state_path) < 0) {
+    fprintf(stderr, "Error: can't save the sequence number in %s\n", up->state_path);
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+}
+
+// compress the pending records into a batch; with the mutex held
+static void seal_batch(uplink_t *up)
+{
+  if (up->records_count == 0) {
+    return;
+  }
+
+  uLongf clen = compressBound(up->records_len);
+  uplink_frame_t *f = malloc(sizeof(uplink_frame_t) + UPLINK_BATCH_HEADER_SIZE + clen);
+  if (f == NULL || compress2(f->data + UPLINK_BATCH_HEADER_SIZE, &clen, up->records, up->records_len,
+      Z_BEST_SPEED) != Z_OK) {
+    fprintf(stderr, "Error: can't compress a batch for the collector, %u records lost\n", up->records_count);
+    free(f);
+    up->records_len = 0;
+    up->records_count = 0;
+    return;
+  }
+  if (up->next_seq >= up->seq_reserved) {
+    reserve_seq(up);
+  }
+  f->seq = up->next_seq++;
+  f->len = UPLINK_BATCH_HEADER_SIZE + clen;
+  f->next = NULL;
+  f->data[0] = UPLINK_BATCH;
+  uplink_put_u32(f->data + 1, f->len - UPLINK_HEADER_SIZE);
+  uplink_put_u64(f->data + UPLINK_HEADER_SIZE, f->seq);
+  uplink_put_u32(f->data + UPLINK_HEADER_SIZE + 8, up->records_count);
+  uplink_put_u32(f->data + UPLINK_HEADER_SIZE + 12, up->records_len);
+  metrics_add(METRIC_UPLINK_BYTES, f->len);
+  up->records_len = 0;
+  up->records_count = 0;
+
+  // once batches are spooled, the newer ones follow them there, to be sent in order
+  if (up->spool_size > 0 || up->frames_count >= UPLINK_MAX_FRAMES) {
+    spool_frame(up, f);
+  } else {
+    if (up->frames_tail) {
+      up->frames_tail->next = f;
+    } else {
+      up->frames = f;
+    }
+    up->frames_tail = f;
+    if (up->unsent == NULL) {
+      up->unsent = f;
+    }
+    up->frames_count++;
+  }
+  update_backlog(up);
+  wake(up);
+}
+
+// called by the writer thread, in place of the db insert
+void uplink_add(uplink_t *up, const struct write_item *item)
+{
+  pthread_mutex_lock(&up->mutex);
+  if (up->records_len + UPLINK_MAX_RECORD > UPLINK_BATCH_SIZE) {
+    seal_batch(up);
+  }
+  size_t n = uplink_encode(item, up->records + up->records_len, UPLINK_BATCH_SIZE - up->records_len);
+  if (n) {
+    if (up->records_count == 0) {
+      clock_gettime(CLOCK_MONOTONIC, &up->records_start);
+    }
+    up->records_len += n;
+    up->records_count++;
+  }
+  pthread_mutex_unlock(&up->mutex);
+  metrics_add(METRIC_UPLINK_RECORDS, 1);
+}
+
+// forget the batches committed by the collector; with the mutex held
+static void drop_acked(uplink_t *up, uint64_t seq)
+{
+  if (seq > up->acked) {
+    up->acked = seq;
+  }
+  while (up->frames && up->frames->seq <= up->acked) {
+    uplink_frame_t *f = up->frames;
+    up->frames = f->next;
+    if (up->unsent == f) {
+      up->unsent = f->next;
+    }
+    free(f);
+    up->frames_count--;
+  }
+  if (up->frames == NULL) {
+    up->frames_tail = NULL;
+  }
+  if (up->spool_size > 0 && up->acked >= up->spool_last) {
+    if (ftruncate(up->spool_fd, 0) < 0) {
+      perror("Error: can't truncate the spool file");
+    }
+    up->spool_size = 0;
+    up->spool_sent = 0;
+    up->spool_count = 0;
+  }
+  update_backlog(up);
+}
+
+// ------------------------------------------
+// connection
+// ------------------------------------------
+static void disconnect(uplink_t *up)
+{
+  close(up->fd);
+  up->fd = -1;
+  up->ready = false;
+  up->in_len = 0;
+  if (up->out_owned) {
+    free(up->out);
+  }
+  up->out = NULL;
+  up->out_owned = false;
+
+  // send everything not acknowledged again, the collector drops what it already has
+  pthread_mutex_lock(&up->mutex);
+  up->unsent = up->frames;
+  up->spool_sent = 0;
+  pthread_mutex_unlock(&up->mutex);
+}
+
+static int connect_collector(uplink_t *up)
+{
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+  int err;
+
+  if ((err = getaddrinfo(up->host, up->port, &hints, &res))) {
+    fprintf(stderr, "Error: can't resolve collector %s: %s\n", up->host, gai_strerror(err));
+    return -1;
+  }
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0) {
+    freeaddrinfo(res);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if (connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+    freeaddrinfo(res);
+    close(fd);
+    return -1;
+  }
+  freeaddrinfo(res);
+
+  struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+  int so_error = 0;
+  socklen_t len = sizeof(so_error);
+  if (poll(&pfd, 1, UPLINK_CONNECT_TIMEOUT) <= 0
+    || getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0 || so_error) {
+    close(fd);
+    return -1;
+  }
+
+  // introduce ourselves; the collector replies with the last batch it committed
+  size_t name_len = strlen(up->name);
+  up->out = malloc(UPLINK_HEADER_SIZE + 1 + name_len);
+  up->out[0] = UPLINK_HELLO;
+  uplink_put_u32(up->out + 1, 1 + name_len);
+  up->out[UPLINK_HEADER_SIZE] = UPLINK_VERSION;
+  memcpy(up->out + UPLINK_HEADER_SIZE + 1, up->name, name_len);
+  up->out_len = UPLINK_HEADER_SIZE + 1 + name_len;
+  up->out_sent = 0;
+  up->out_owned = true;
+  up->fd = fd;
+  up->ready = false;
+  up->in_len = 0;
+
+  return 0;
+}
+
+// the next batch to send: the oldest ones in memory first, then the spool
+static void next_frame(uplink_t *up)
+{
+  uint8_t header[UPLINK_BATCH_HEADER_SIZE];
+
+  pthread_mutex_lock(&up->mutex);
+  if (up->unsent) {
+    up->out = up->unsent->data;
+    up->out_len = up->unsent->len;
+    up->out_owned = false;
+    up->unsent = up->unsent->next;
+  }
+  while (up->out == NULL && up->spool_sent < up->spool_size) {
+    if (pread(up->spool_fd, header, sizeof(header), up->spool_sent) != sizeof(header)) {
+      break;
+    }
+    uint32_t len = UPLINK_HEADER_SIZE + uplink_get_u32(header + 1);
+    // skip what was committed before a reconnection
+    if (uplink_get_u64(header + UPLINK_HEADER_SIZE) > up->acked) {
+      up->out = malloc(len);
+      if (up->out == NULL || pread(up->spool_fd, up->out, len, up->spool_sent) != len) {
+        free(up->out);
+        up->out = NULL;
+        break;
+      }
+      up->out_len = len;
+      up->out_owned = true;
+    }
+    up->spool_sent += len;
+  }
+  up->out_sent = 0;
+  pthread_mutex_unlock(&up->mutex);
+}
+
+static int send_frame(uplink_t *up)
+{
+  ssize_t w = send(up->fd, up->out + up->out_sent, up->out_len - up->out_sent, MSG_NOSIGNAL);
+  if (w < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  up->out_sent += w;
+  if (up->out_sent == up->out_len) {
+    if (up->out_owned) {
+      free(up->out);
+    }
+    up->out = NULL;
+    up->out_owned = false;
+  }
+  return 0;
+}
+
+static int read_acks(uplink_t *up)
+{
+  ssize_t r = recv(up->fd, up->in + up->in_len, sizeof(up->in) - up->in_len, 0);
+  if (r <= 0) {
+    return (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) ? 0 : -1;
+  }
+  up->in_len += r;
+  if (up->in_len < sizeof(up->in)) {
+    return 0;
+  }
+  if (up->in[0] != UPLINK_ACK || uplink_get_u32(up->in + 1) != 8) {
+    fprintf(stderr, "Error: unexpected message from the collector\n");
+    return -1;
+  }
+  uint64_t seq = uplink_get_u64(up->in + UPLINK_HEADER_SIZE);
+  pthread_mutex_lock(&up->mutex);
+  if (!up->ready && up->next_seq <= seq) {
+    // the reply to the hello: the collector dropping the seq it has seen, the
+    // next batches follow the last one it committed, if the state file was lost
+    up->next_seq = seq + 1;
+  }
+  drop_acked(up, seq);
+  pthread_mutex_unlock(&up->mutex);
+  up->in_len = 0;
+  up->ready = true;
+
+  return 0;
+}
+
+static uint64_t elapsed_ms(struct timespec from, struct timespec to)
+{
+  return (to.tv_sec - from.tv_sec) * 1000 + (to.tv_nsec - from.tv_nsec) / 1000000;
+}
+
+static void *run_uplink(void *args)
+{
+  uplink_t *up = (uplink_t *)args;
+  struct timespec now, retry_at = { 0 }, stop_at = { 0 };
+  int retry = UPLINK_RETRY_TIME;
+  bool was_connected = false;
+
+  metrics_register("uplink");
+
+  while (true) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&up->mutex);
+    bool stopping = up->stopping;
+    if (up->records_count && (stopping || elapsed_ms(up->records_start, now) >= UPLINK_FLUSH_TIME)) {
+      seal_batch(up);
+    }
+    bool pending = up->frames || up->spool_size > 0;
+    pthread_mutex_unlock(&up->mutex);
+
+    if (stopping) {
+      // give the collector some time to commit the last batches
+      if (!pending) {
+        break;
+      }
+      if (stop_at.tv_sec == 0) {
+        stop_at = now;
+      } else if (elapsed_ms(stop_at, now) >= UPLINK_LINGER_TIME) {
+        break;
+      }
+    }
+
+    if (up->fd < 0 && (now.tv_sec > retry_at.tv_sec
+        || (now.tv_sec == retry_at.tv_sec && now.tv_nsec >= retry_at.tv_nsec))) {
+      if (connect_collector(up) < 0) {
+        if (was_connected || retry == UPLINK_RETRY_TIME) {
+          fprintf(stderr, "Warning: can't reach the collector %s:%s, retrying in %d s\n", up->host, up->port,
+            retry / 1000);
+        }
+        was_connected = false;
+        retry_at = now;
+        retry_at.tv_sec += retry / 1000;
+        retry = retry * 2 > UPLINK_MAX_RETRY_TIME ? UPLINK_MAX_RETRY_TIME : retry * 2;
+      } else {
+        was_connected = true;
+        retry = UPLINK_RETRY_TIME;
+      }
+    }
+    if (up->fd >= 0 && up->ready && up->out == NULL) {
+      next_frame(up);
+    }
+
+    struct pollfd fds[2];
+    int n = 0;
+    fds[n].fd = up->wake_fd[0];
+    fds[n++].events = POLLIN;
+    if (up->fd >= 0) {
+      fds[n].fd = up->fd;
+      fds[n++].events = POLLIN | (up->out ? POLLOUT : 0);
+    }
+    if (poll(fds, n, up->fd >= 0 ? UPLINK_FLUSH_TIME : UPLINK_FLUSH_TIME / 4) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      char tmp[64];
+      if (read(up->wake_fd[0], tmp, sizeof(tmp)) < 0) {
+        // ignore
+      }
+    }
+    if (n > 1) {
+      if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)
+        || (fds[1].revents & POLLIN && read_acks(up) < 0)
+        || (fds[1].revents & POLLOUT && up->out && send_frame(up) < 0)) {
+        fprintf(stderr, "Warning: lost the connection to the collector\n");
+        disconnect(up);
+        clock_gettime(CLOCK_MONOTONIC, &retry_at);
+        retry_at.tv_sec += retry / 1000;
+      }
+    }
+  }
+
+  if (up->fd >= 0) {
+    disconnect(up);
+  }
+
+  return NULL;
+}
+
+// ------------------------------------------
+// spool
+// ------------------------------------------
+
+// check the spool left by a previous run; a truncated batch at its end is cut off
+static int load_spool(uplink_t *up)
+{
+  uint8_t header[UPLINK_BATCH_HEADER_SIZE];
+  off_t offset = 0, size;
+  int count = 0;
+
+  if ((up->spool_fd = open(up->spool_path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0) {
+    fprintf(stderr, "Error: can't open spool file %s: %s\n", up->spool_path, strerror(errno));
+    return -1;
+  }
+  size = lseek(up->spool_fd, 0, SEEK_END);
+  while (pread(up->spool_fd, header, sizeof(header), offset) == sizeof(header) && header[0] == UPLINK_BATCH) {
+    off_t len = UPLINK_HEADER_SIZE + uplink_get_u32(header + 1);
+    if (offset + len > size) {
+      break;
+    }
+    up->spool_last = uplink_get_u64(header + UPLINK_HEADER_SIZE);
+    offset += len;
+    count++;
+  }
+  if (offset < size) {
+    fprintf(stderr, "Warning: truncated spool file %s\n", up->spool_path);
+    if (ftruncate(up->spool_fd, offset) < 0) {
+      perror("Error: can't truncate the spool file");
+    }
+  }
+  up->spool_size = offset;
+  up->spool_sent = 0;
+  up->spool_count = count;
+  if (count) {
+    fprintf(stderr, ":: %d batches left in spool file %s\n", count, up->spool_path);
+  }
+  update_backlog(up);
+
+  return 0;
+}
+
+// keep the batches still in memory, before the ones already in the spool
+static void save_spool(uplink_t *up)
+{
+  int fd;
+
+  if (up->frames == NULL) {
+    return;
+  }
+  size_t len = strlen(up->spool_path) + 5;
+  char *tmp_path = malloc(len);
+  snprintf(tmp_path, len, "%s.tmp", up->spool_path);
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf(stderr, "Error: can't open %s: %s\n", tmp_path, strerror(errno));
+    free(tmp_path);
+    return;
+  }
+
+  bool ok = true;
+  int count = 0;
+  for (uplink_frame_t *f = up->frames; f && ok; f = f->next, count++) {
+    ok = write(fd, f->data, f->len) == f->len;
+  }
+  uint8_t buf[8192];
+  ssize_t r;
+  for (off_t offset = 0; ok && offset < up->spool_size; offset += r) {
+    r = pread(up->spool_fd, buf, sizeof(buf), offset);
+    ok = r > 0 && write(fd, buf, r) == r;
+  }
+  if (close(fd) == 0 && ok && rename(tmp_path, up->spool_path) == 0) {
+    fprintf(stderr, ":: %d batches not acknowledged by the collector saved in spool file %s\n", count,
+      up->spool_path);
+  } else {
+    fprintf(stderr, "Error: can't save the batches not acknowledged by the collector in %s\n", up->spool_path);
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+}
+
+// address is HOST:PORT; the sensor is known by name to the collector
+uplink_t *uplink_new(const char *address, const char *name, const char *spool_path)
+{
+  const char *colon = strrchr(address, ':');
+  if (colon == NULL || colon == address || colon[1] == '\0') {
+    fprintf(stderr, "Error: invalid collector address %s\n", address);
+    return NULL;
+  }
+  if (strlen(name) == 0 || strlen(name) > UPLINK_MAX_NAME) {
+    fprintf(stderr, "Error: the name of the sensor must be 1 to %d characters long\n", UPLINK_MAX_NAME);
+    return NULL;
+  }
+
+  uplink_t *up = calloc(1, sizeof(uplink_t));
+  up->host = strndup(address, colon - address);
+  up->port = strdup(colon + 1);
+  up->name = strdup(name);
+  up->spool_path = strdup(spool_path);
+  size_t len = strlen(spool_path) + 5;
+  up->state_path = malloc(len);
+  snprintf(up->state_path, len, "%s.seq", spool_path);
+  up->fd = -1;
+  pthread_mutex_init(&up->mutex, NULL);
+
+  if (load_spool(up)) {
+    goto error;
+  }
+  // the collector drops the batches whose seq it has already seen: keep it increasing
+  // from one run to the next, past what was reserved, and at least the clock in µs for
+  // a first run
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  up->next_seq = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  FILE *state = fopen(up->state_path, "r");
+  if (state) {
+    uint64_t reserved;
+    if (fscanf(state, "%" SCNu64, &reserved) == 1 && up->next_seq < reserved) {
+      up->next_seq = reserved;
+    }
+    fclose(state);
+  }
+  if (up->spool_size > 0 && up->next_seq <= up->spool_last) {
+    up->next_seq = up->spool_last + 1;
+  }
+  reserve_seq(up);
+
+  if (pipe(up->wake_fd) < 0) {
+    perror("Error: can't create pipe");
+    close(up->spool_fd);
+    goto error;
+  }
+  fcntl(up->wake_fd[1], F_SETFL, fcntl(up->wake_fd[1], F_GETFL) | O_NONBLOCK);
+
+  if (pthread_create(&up->thread, NULL, run_uplink, up)) {
+    fprintf(stderr, "Error creating uplink thread\n");
+    close(up->wake_fd[0]);
+    close(up->wake_fd[1]);
+    close(up->spool_fd);
+    goto error;
+  }
+
+  return up;
+
+error:
+  pthread_mutex_destroy(&up->mutex);
+  free(up->host);
+  free(up->port);
+  free(up->name);
+  free(up->spool_path);
+  free(up->state_path);
+  free(up);
+  return NULL;
+}
+
+// send the pending records and wait a little for their ack, then keep what is left in the spool
+void uplink_free(uplink_t *up)
+{
+  if (up == NULL) return;
+
+  pthread_mutex_lock(&up->mutex);
+  up->stopping = true;
+  pthread_mutex_unlock(&up->mutex);
+  wake(up);
+  pthread_join(up->thread, NULL);
+
+  save_spool(up);
+  while (up->frames) {
+    uplink_frame_t *f = up->frames;
+    up->frames = f->next;
+    free(f);
+  }
+  close(up->spool_fd);
+  close(up->wake_fd[0]);
+  close(up->wake_fd[1]);
+  pthread_mutex_destroy(&up->mutex);
+  free(up->host);
+  free(up->port);
+  free(up->name);
+  free(up->spool_path);
+  free(up->state_path);
+  free(up);
+}
@@ -0,0 +1,116 @@
+#ifndef UPLINK_H
+#define UPLINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "writer.h"
+#include "config.h"
+
+// frames exchanged between a sensor and the collector: a type byte and the length
+// of the payload (u32), then the payload; integers are little endian
+#define UPLINK_HELLO 'H'    // sensor: version (u8), then the name of the sensor
+#define UPLINK_BATCH 'B'    // sensor: seq (u64), count (u32), raw length (u32), then the zlib compressed records
+#define UPLINK_ACK 'A'      // collector: seq (u64) of the last batch of the sensor committed to the db
+#define UPLINK_VERSION 2
+#define UPLINK_HEADER_SIZE 5
+#define UPLINK_BATCH_HEADER_SIZE (UPLINK_HEADER_SIZE + 16)
+
+// a batch, as sent on the wire, waiting for its ack
+typedef struct uplink_frame {
+  uint64_t seq;
+  uint32_t len;
+  struct uplink_frame *next;
+  uint8_t data[];
+} uplink_frame_t;
+
+// sender of the probe requests and bursts to a collector, in place of the db:
+// the writer thread encodes them in the pending batch; the uplink thread sends the
+// batches and keeps them until the collector acknowledges their commit. While the
+// collector can't be reached, the batches in excess of UPLINK_MAX_FRAMES go to
+// the spool file, sent once the connection is back.
+typedef struct uplink {
+  char *host;
+  char *port;
+  char *name;
+  char *spool_path;
+  char *state_path;           // the spool path and ".seq": the seq reserved so far
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  int wake_fd[2];
+  bool stopping;
+
+  // records of the pending batch
+  uint8_t records[UPLINK_BATCH_SIZE];
+  size_t records_len;
+  uint32_t records_count;
+  struct timespec records_start;
+
+  // batches not acknowledged yet, oldest first, from unsent on not sent on this connection
+  uplink_frame_t *frames, *frames_tail, *unsent;
+  int frames_count;
+  uint64_t next_seq;
+  uint64_t seq_reserved;       // next_seq stays below it, kept in the state file
+  uint64_t acked;
+
+  // newer batches, when too many are waiting
+  int spool_fd;
+  off_t spool_size;
+  off_t spool_sent;
+  int spool_count;
+  uint64_t spool_last;        // seq of the last batch in the spool
+
+  // connection, only used by the uplink thread
+  int fd;
+  bool ready;                 // the collector replied to the hello
+  uint8_t in[UPLINK_HEADER_SIZE + 8];
+  size_t in_len;
+  uint8_t *out;
+  size_t out_len, out_sent;
+  bool out_owned;             // read from the spool
+} uplink_t;
+
+uplink_t *uplink_new(const char *address, const char *name, const char *spool_path);
+void uplink_add(uplink_t *up, const struct write_item *item);
+void uplink_free(uplink_t *up);
+
+// records codec, shared with the collector
+size_t uplink_encode(const struct write_item *item, uint8_t *buf, size_t size);
+size_t uplink_decode(const uint8_t *buf, size_t len, probereq_t *pr, probeburst_t *burst, bool *is_burst);
+
+static inline void uplink_put_u32(uint8_t *buf, uint32_t v)
+{
+  for (int i = 0; i < 4; i++) {
+    buf[i] = v >> (8 * i);
+  }
+}
+
+static inline void uplink_put_u64(uint8_t *buf, uint64_t v)
+{
+  for (int i = 0; i < 8; i++) {
+    buf[i] = v >> (8 * i);
+  }
+}
+
+static inline uint32_t uplink_get_u32(const uint8_t *buf)
+{
+  uint32_t v = 0;
+  for (int i = 3; i >= 0; i--) {
+    v = v << 8 | buf[i];
+  }
+  return v;
+}
+
+static inline uint64_t uplink_get_u64(const uint8_t *buf)
+{
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = v << 8 | buf[i];
+  }
+  return v;
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+length-bounded utf-8 validation of ssid: the ASCII-only blocks are checked with
+SIMD instructions when available, the rest falls back to the scalar validator
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "utf8.h"
+
+// from https://stackoverflow.com/a/1031773/283067
+static bool is_utf8_scalar(const uint8_t *bytes, const uint8_t *end)
+{
+  while (bytes < end) {
+    ptrdiff_t left = end - bytes;
+
+    if ( (// ASCII
+      // use bytes[0] <= 0x7F to allow ASCII control characters
+      bytes[0] == 0x09 ||
+      bytes[0] == 0x0A ||
+      bytes[0] == 0x0D ||
+      (0x20 <= bytes[0] && bytes[0] <= 0x7E)
+    ) ) {
+      bytes += 1;
+      continue;
+    }
+
+    if (left >= 2 && (// non-overlong 2-byte
+      (0xC2 <= bytes[0] && bytes[0] <= 0xDF) &&
+      (0x80 <= bytes[1] && bytes[1] <= 0xBF)
+    ) ) {
+      bytes += 2;
+      continue;
+    }
+
+    if (left >= 3 && ((// excluding overlongs
+      bytes[0] == 0xE0 &&
+      (0xA0 <= bytes[1] && bytes[1] <= 0xBF) &&
+      (0x80 <= bytes[2] && bytes[2] <= 0xBF)
+    ) ||
+    (// straight 3-byte
+      ((0xE1 <= bytes[0] && bytes[0] <= 0xEC) ||
+      bytes[0] == 0xEE ||
+      bytes[0] == 0xEF) &&
+      (0x80 <= bytes[1] && bytes[1] <= 0xBF) &&
+      (0x80 <= bytes[2] && bytes[2] <= 0xBF)
+    ) ||
+    (// excluding surrogates
+      bytes[0] == 0xED &&
+      (0x80 <= bytes[1] && bytes[1] <= 0x9F) &&
+      (0x80 <= bytes[2] && bytes[2] <= 0xBF)
+    ) ) ) {
+      bytes += 3;
+      continue;
+    }
+
+    if (left >= 4 && ((// planes 1-3
+      bytes[0] == 0xF0 &&
+      (0x90 <= bytes[1] && bytes[1] <= 0xBF) &&
+      (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
+      (0x80 <= bytes[3] && bytes[3] <= 0xBF)
+    ) ||
+    (// planes 4-15
+      (0xF1 <= bytes[0] && bytes[0] <= 0xF3) &&
+      (0x80 <= bytes[1] && bytes[1] <= 0xBF) &&
+      (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
+      (0x80 <= bytes[3] && bytes[3] <= 0xBF)
+    ) ||
+    (// plane 16
+      bytes[0] == 0xF4 &&
+      (0x80 <= bytes[1] && bytes[1] <= 0x8F) &&
+      (0x80 <= bytes[2] && bytes[2] <= 0xBF) &&
+      (0x80 <= bytes[3] && bytes[3] <= 0xBF)
+    ) ) ) {
+      bytes += 4;
+      continue;
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+// returns the length of the leading blocks (of 16 or 32 bytes) made only of printable ASCII
+static size_t printable_ascii_prefix(const uint8_t *bytes, size_t len)
+{
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  const __m256i low32 = _mm256_set1_epi8(0x20);
+  const __m256i del32 = _mm256_set1_epi8(0x7F);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(bytes + i));
+    // signed compare: bytes >= 0x80 are negative so they are caught by the first test
+    __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi8(low32, v), _mm256_cmpeq_epi8(v, del32));
+    if (_mm256_movemask_epi8(bad)) {
+      return i;
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i low = _mm_set1_epi8(0x20);
+  const __m128i del = _mm_set1_epi8(0x7F);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(bytes + i));
+    __m128i bad = _mm_or_si128(_mm_cmplt_epi8(v, low), _mm_cmpeq_epi8(v, del));
+    if (_mm_movemask_epi8(bad)) {
+      return i;
+    }
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t low = vdupq_n_u8(0x20);
+  const uint8x16_t high = vdupq_n_u8(0x7E);
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t v = vld1q_u8(bytes + i);
+    uint8x16_t bad = vorrq_u8(vcltq_u8(v, low), vcgtq_u8(v, high));
+    if (vmaxvq_u8(bad)) {
+      return i;
+    }
+  }
+#endif
+
+  return i;
+}
+
+bool is_utf8(const uint8_t *bytes, size_t len)
+{
+  if (bytes == NULL) {
+    return len == 0;
+  }
+
+  size_t i = printable_ascii_prefix(bytes, len);
+  return is_utf8_scalar(bytes + i, bytes + len);
+}
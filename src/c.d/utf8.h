@@ -0,0 +1,10 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+bool is_utf8(const uint8_t *bytes, size_t len);
+
+#endif
@@ -0,0 +1,292 @@
+/*
+the single thread writing to the db: it takes the batches of enriched probe
+requests and bursts from the workers, inserts them within a transaction, and
+commits when the event loop of the main thread asks it to, every DB_CACHE_TIME s
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sqlite3.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "writer.h"
+#include "uplink.h"
+#include "queue.h"
+#include "db.h"
+#include "parsers.h"
+#include "lruc.h"
+#include "dashboard.h"
+#include "series.h"
+#include "session.h"
+#include "uniques.h"
+#include "topk.h"
+#include "metrics.h"
+#include "pool.h"
+#include "budget.h"
+#include "trace.h"
+#include "globals.h"
+#include "config.h"
+
+static pool_t batch_pool = POOL_INITIALIZER("batch", write_batch_t);
+
+static channel_t batches;
+static pthread_t writer;
+static int producers_count;
+// queued instead of a batch by writer_commit()
+static write_batch_t commit_request;
+
+// the primary keys of the macs and ssids are only known by the db
+static lruc *ssid_pk_cache = NULL, *mac_pk_cache = NULL;
+// of the macs already in the db, to insert the new ones without looking for them
+static bloom_t *mac_filter = NULL;
+
+static void write_item(const struct write_item *item)
+{
+  if (topk) {
+    const probereq_t *pr = item->burst ? item->burst->pr : item->pr;
+    topk_add(topk, pr->mac, pr->ssid_str, pr->vendor, pr->tv, item->burst ? item->burst->count : 1);
+  }
+  // a sensor sends everything to the collector instead
+  if (uplink) {
+    uplink_add(uplink, item);
+    return;
+  }
+  // without a db, only the enrichment is measured (see bench/bench_pipeline.c)
+  if (db == NULL) {
+    return;
+  }
+
+  uint64_t start = metrics_now();
+  // a randomized mac is seldom seen again: keep it out of the mac table and the caches
+  const probereq_t *first = item->burst ? item->burst->pr : item->pr;
+  bool ephemeral = option_ephemeral && is_laa(first->mac);
+  if (ephemeral) {
+    const probeburst_t *b = item->burst;
+    insert_ephemeral(first, b ? b->last : first->tv, b ? b->count : 1, b ? b->rssi_max : first->rssi,
+      ssid_pk_cache, db);
+  } else if (item->burst) {
+    insert_probeburst(item->burst, db, mac_pk_cache, ssid_pk_cache, mac_filter, 0);
+  } else {
+    insert_probereq(*item->pr, db, mac_pk_cache, ssid_pk_cache, mac_filter, 0);
+  }
+  metrics_observe(HISTOGRAM_INSERT, metrics_now() - start);
+
+  // a session refers to a row of the mac table
+  if (sessions && !ephemeral) {
+    const probeburst_t *b = item->burst;
+    const probereq_t *pr = b ? b->pr : item->pr;
+    session_add(sessions, pr->mac, lookup_mac_id(pr->mac, mac_pk_cache, db), pr->tv, b ? b->last : pr->tv,
+      b ? b->count : 1, b ? b->rssi_max : pr->rssi, db);
+  }
+  if (uniques) {
+    const probereq_t *pr = item->burst ? item->burst->pr : item->pr;
+    uniques_add(uniques, pr->mac, pr->ssid_str, pr->vendor, pr->tv);
+  }
+}
+
+// a cache of the ids, of size bytes of ids, or of what fits in memory bytes with a
+// memory budget
+static lruc *new_pk_cache(uint64_t size, size_t memory)
+{
+  if (memory) {
+    // a slot of the hash table, the item, a mac as key, the id, and the sketch of tinylfu
+    uint64_t ids = memory / (sizeof(lruc_item *) + sizeof(lruc_item) + 18 + sizeof(int64_t) + 2 * LRUC_SKETCH_ROWS);
+    return lruc_new(ids * sizeof(int64_t), sizeof(int64_t), option_cache_policy);
+  }
+  return lruc_new(size, 1, option_cache_policy);
+}
+
+// what each subsystem uses, to compare with its share of the memory budget; past
+// the budget, the caches of sqlite and malloc are given back
+static void account_memory(void)
+{
+  struct pool_stats pools[POOL_MAX_COUNT];
+  int pools_count = pool_stats(pools, POOL_MAX_COUNT);
+  size_t queues = 0;
+  for (int i = 0; i < pools_count; i++) {
+    queues += pools[i].bytes;
+  }
+  budget_set_usage(BUDGET_QUEUES, queues);
+  budget_set_usage(BUDGET_CACHES, lruc_memory(mac_pk_cache) + lruc_memory(ssid_pk_cache));
+  budget_set_usage(BUDGET_SQLITE, sqlite3_memory_used());
+  budget_set_usage(BUDGET_MAC_FILTER, mac_filter ? bloom_memory(mac_filter) : 0);
+  if (uniques) {
+    budget_set_usage(BUDGET_UNIQUES, uniques_memory(uniques));
+  }
+  if (series) {
+    budget_set_usage(BUDGET_SERIES, __atomic_load_n(&series->memory, __ATOMIC_RELAXED));
+  }
+  if (topk) {
+    budget_set_usage(BUDGET_TOPK, topk_memory(topk));
+  }
+  if (sessions) {
+    budget_set_usage(BUDGET_SESSIONS, session_memory(sessions));
+  }
+
+  if (budget_total() && budget_rss() > budget_total()) {
+    if (db) {
+      sqlite3_db_release_memory(db);
+    }
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    metrics_add(METRIC_MEMORY_RELEASES, 1);
+  }
+}
+
+// commit the transaction, and the periodic work that goes with it
+static void commit(time_t *last_purge)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (db) {
+    if (sessions) {
+      session_flush(sessions, db, false);
+      metrics_set(GAUGE_SESSIONS_OPEN, sessions->count);
+    }
+    if (uniques) {
+      uniques_flush(uniques, db);
+      metrics_set(GAUGE_UNIQUES_SKETCHES, uniques->count);
+      metrics_set(GAUGE_UNIQUES_BYTES, uniques_memory(uniques));
+    }
+    mac_filter = update_mac_filter(mac_filter, db);
+    if (option_ephemeral && now.tv_sec - *last_purge >= EPHEMERAL_PURGE_TIME) {
+      purge_ephemeral(time(NULL) - option_ephemeral, db);
+      *last_purge = now.tv_sec;
+    }
+    commit_txn(db);
+    begin_txn(db);
+  }
+  account_memory();
+  if (dashboard) {
+    dashboard_commit(dashboard);
+  }
+  if (series) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    series_expire(series, tv);
+  }
+}
+
+static void *write_batches(void *args)
+{
+  int done = 0;
+  // the first commit purges what expired while probemon wasn't running
+  time_t last_purge = -EPHEMERAL_PURGE_TIME;
+
+  // the macs are many more than the ssids
+  size_t caches = budget_share(BUDGET_CACHES);
+  mac_pk_cache = new_pk_cache(MAC_CACHE_SIZE, caches / 4 * 3);
+  ssid_pk_cache = new_pk_cache(SSID_CACHE_SIZE, caches / 4);
+  if (db && uplink == NULL) {
+    mac_filter = update_mac_filter(load_mac_filter(db), db);
+  }
+
+  metrics_register("writer");
+  TRACE_THREAD_START("writer");
+
+  // each worker sends a NULL batch when it stops
+  while (done < producers_count) {
+    write_batch_t *batch = channel_get(&batches);
+    metrics_set(GAUGE_WRITER_QUEUE_DEPTH, channel_size(&batches));
+    if (batch == NULL) {
+      done++;
+      continue;
+    }
+    if (batch == &commit_request) {
+      commit(&last_purge);
+      continue;
+    }
+
+    for (int i = 0; i < batch->count; i++) {
+      write_item(&batch->items[i]);
+      free_probeburst(batch->items[i].burst);
+      free_probereq(batch->items[i].pr);
+    }
+    free_write_batch(batch);
+  }
+
+  // the sessions still open end with the capture; committed by the main thread
+  if (db && sessions) {
+    session_flush(sessions, db, true);
+  }
+  if (db && uniques) {
+    uniques_flush(uniques, db);
+  }
+  if (db && mac_filter) {
+    save_mac_filter(mac_filter, db);
+  }
+  bloom_free(mac_filter);
+  mac_filter = NULL;
+  lruc_free(mac_pk_cache);
+  lruc_free(ssid_pk_cache);
+  TRACE_THREAD_STOP();
+
+  return NULL;
+}
+
+write_batch_t *new_write_batch(void)
+{
+  write_batch_t *batch = pool_alloc(&batch_pool);
+  if (batch) {
+    batch->count = 0;
+  }
+  return batch;
+}
+
+void free_write_batch(write_batch_t *batch)
+{
+  pool_free(&batch_pool, batch);
+}
+
+// start the writer thread, that stops once the producers have all sent a NULL batch
+int writer_start(int producers)
+{
+  producers_count = producers;
+  // with a memory budget, half the share of the queues for the batches
+  int capacity = WRITER_QUEUE_SIZE;
+  size_t share = budget_share(BUDGET_QUEUES);
+  if (share) {
+    size_t fit = share / 2 / (sizeof(write_batch_t) + WRITER_BATCH_SIZE * sizeof(probereq_t));
+    if (fit > QUEUE_MAX_ITEMS / WRITER_BATCH_SIZE) {
+      fit = QUEUE_MAX_ITEMS / WRITER_BATCH_SIZE;
+    }
+    capacity = fit < 2 ? 2 : fit;
+  }
+  if (channel_init(&batches, capacity)) {
+    return -1;
+  }
+  if (pthread_create(&writer, NULL, write_batches, NULL)) {
+    channel_destroy(&batches);
+    return -1;
+  }
+
+  return 0;
+}
+
+// hand a batch over to the writer thread, that takes ownership of it
+void writer_submit(write_batch_t *batch)
+{
+  channel_put(&batches, batch);
+  metrics_set(GAUGE_WRITER_QUEUE_DEPTH, channel_size(&batches));
+}
+
+// from the last worker to flush (see flush_workers): the writer commits once the
+// batches queued before are written
+void writer_commit(void)
+{
+  channel_put(&batches, &commit_request);
+}
+
+void writer_join(void)
+{
+  pthread_join(writer, NULL);
+  channel_destroy(&batches);
+}
@@ -0,0 +1,27 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "logger_thread.h"
+#include "coalesce.h"
+#include "config.h"
+
+// a probe request or a burst to insert in the db
+struct write_item {
+  probereq_t *pr;
+  probeburst_t *burst;
+};
+
+// what a worker hands over to the db writer at once
+typedef struct write_batch {
+  int count;
+  struct write_item items[WRITER_BATCH_SIZE];
+} write_batch_t;
+
+write_batch_t *new_write_batch(void);
+void free_write_batch(write_batch_t *batch);
+int writer_start(int producers);
+void writer_submit(write_batch_t *batch);
+void writer_commit(void);
+void writer_join(void);
+
+#endif
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# decode, merge and count the HyperLogLog sketches of the uniques table (see c.d/hll.c)
+
+import math
+
+PRECISION = 12
+REGISTERS = 1 << PRECISION
+SPARSE = 1
+DENSE = 2
+
+def decode(blob, registers=None):
+    '''merge the serialized sketch blob into registers, a new one if None'''
+    if registers is None:
+        registers = bytearray(REGISTERS)
+    if len(blob) < 2 or blob[1] != PRECISION:
+        raise ValueError('unsupported sketch')
+    if blob[0] == DENSE and len(blob) == 2 + REGISTERS:
+        for i, v in enumerate(blob[2:]):
+            if v > registers[i]:
+                registers[i] = v
+        return registers
+    if blob[0] != SPARSE or len(blob) < 4:
+        raise ValueError('malformed sketch')
+    count = blob[2] | blob[3] << 8
+    if len(blob) != 4 + 3*count:
+        raise ValueError('malformed sketch')
+    for i in range(4, len(blob), 3):
+        index = blob[i] | blob[i+1] << 8
+        if blob[i+2] > registers[index]:
+            registers[index] = blob[i+2]
+    return registers
+
+def encode(registers):
+    '''serialize registers the same way probemon does'''
+    used = [(i, v) for i, v in enumerate(registers) if v != 0]
+    if 4 + 3*len(used) < 2 + REGISTERS:
+        blob = bytearray([SPARSE, PRECISION, len(used) & 0xff, len(used) >> 8])
+        for i, v in used:
+            blob.extend((i & 0xff, i >> 8, v))
+        return bytes(blob)
+    return bytes([DENSE, PRECISION]) + bytes(registers)
+
+def count(registers):
+    '''estimate of the number of distinct macs'''
+    m = REGISTERS
+    s = sum(math.ldexp(1.0, -v) for v in registers)
+    zeros = registers.count(0)
+    estimate = 0.7213/(1 + 1.079/m)*m*m/s
+    if estimate <= 2.5*m and zeros > 0:
+        # linear counting is more accurate for the small sets
+        estimate = m*math.log(m/zeros)
+    return estimate
@@ -3,6 +3,7 @@
 import sqlite3
 import sys
 import argparse
+import hll
 
 parser = argparse.ArgumentParser(description='Merge one db into the current one')
 parser.add_argument('-o', '--output', default='probemon.db', help='file name of the target/output db')
@@ -15,7 +16,7 @@ c_in = conn_in.cursor()
 conn_out = sqlite3.connect(args.output)
 c_out = conn_out.cursor()
 
-c_in.execute('select * from probemon')
+c_in.execute('select date, mac, ssid, rssi from probemon')
 for row in c_in.fetchall():
     time, mac, ssid, rssi = row
 
@@ -49,7 +50,21 @@ for row in c_in.fetchall():
         r = c_out.fetchone()
     ssid_id = r[0]
 
-    c_out.execute('insert into probemon values (?, ?, ?, ?)', (time, mac_id, ssid_id, rssi))
+    c_out.execute('insert into probemon (date, mac, ssid, rssi) values (?, ?, ?, ?)', (time, mac_id, ssid_id, rssi))
+
+# the sketches of the same period merge into the one of the union of their macs
+c_in.execute('select count(*) from sqlite_master where type=? and name=?', ('table', 'uniques'))
+if c_in.fetchone()[0] == 1:
+    c_out.execute('''create table if not exists uniques(granularity integer, start integer, dimension integer,
+        value text, sketch blob, primary key(granularity, start, dimension, value))''')
+    c_in.execute('select granularity, start, dimension, value, sketch from uniques')
+    for granularity, start, dimension, value, sketch in c_in.fetchall():
+        key = (granularity, start, dimension, value)
+        c_out.execute('select sketch from uniques where granularity=? and start=? and dimension=? and value=?', key)
+        r = c_out.fetchone()
+        if r is not None:
+            sketch = hll.encode(hll.decode(sketch, hll.decode(r[0])))
+        c_out.execute('insert or replace into uniques values (?, ?, ?, ?, ?)', key + (sketch,))
 
 conn_out.commit()
 
@@ -6,6 +6,7 @@ import time
 import sys
 import os.path
 from yaml import load as yaml_load
+import hll
 try:
     from yaml import CLoader as Loader
 except ImportError:
@@ -16,6 +17,7 @@ from signal import signal, SIGPIPE, SIG_DFL
 signal(SIGPIPE, SIG_DFL)
 
 NUMOFSECSINADAY = 60*60*24
+GRANULARITIES = {'5min': 300, 'hour': 3600, 'day': NUMOFSECSINADAY}
 MAX_VENDOR_LENGTH = 25
 MAX_SSID_LENGTH = 15
 
@@ -109,6 +111,35 @@ def build_sql_query(after, before, macs, rssi, zero, day):
     sql = '%s where %s %s' % (sql_head, sql_where_clause, sql_tail)
     return sql, sql_args
 
+def print_uniques(c, granularity, after, before, ssid, vendor):
+    '''estimated number of distinct macs per period, from the sketches of the uniques table'''
+    sql = 'select start, sketch from uniques where granularity=? and dimension=? and value=?'
+    if ssid is not None:
+        sql_args = [GRANULARITIES[granularity], 1, ssid]
+    elif vendor is not None:
+        sql_args = [GRANULARITIES[granularity], 2, vendor]
+    else:
+        sql_args = [GRANULARITIES[granularity], 0, '']
+    if after is not None:
+        sql += ' and start>=?'
+        sql_args.append(after - after % GRANULARITIES[granularity])
+    if before is not None:
+        sql += ' and start<?'
+        sql_args.append(before)
+    c.execute(f'{sql} order by start', sql_args)
+
+    # the registers of the sketches merge into those of the whole time span
+    total = None
+    for start, sketch in c.fetchall():
+        registers = hll.decode(sketch)
+        total = hll.decode(sketch, total)
+        t = time.strftime('%Y-%m-%dT%H:%M', time.localtime(start))
+        print(f'{t}\t{round(hll.count(registers))}')
+    if total is None:
+        print('Nothing found.')
+    else:
+        print(f'Total\t{round(hll.count(total))}')
+
 def main():
     parser = argparse.ArgumentParser(description='Display various stats about mac addresses/probe requests in the database')
     parser.add_argument('-a', '--after', help='filter before this timestamp')
@@ -123,6 +154,8 @@ def main():
     parser.add_argument('-p', '--privacy', action='store_true', help='merge all LAA mac into one')
     parser.add_argument('-r', '--rssi', type=int, help='filter for that minimal RSSI value')
     parser.add_argument('-s', '--ssid', help='look up for mac that have probed for that ssid')
+    parser.add_argument('-u', '--uniques', choices=GRANULARITIES.keys(), help='estimate the number of distinct macs by period')
+    parser.add_argument('-v', '--vendor', help='with --uniques, only count the macs of that vendor')
     parser.add_argument('-z', '--zero', action='store_true', help='filter rssi value of 0')
     args = parser.parse_args()
 
@@ -170,6 +203,19 @@ def main():
         sys.exit(-1)
     is_stats_table_available = c.fetchone()[0] == 1
 
+    if args.uniques:
+        c.execute('select count(*) from sqlite_master where type=? and name=?', ('table', 'uniques'))
+        if c.fetchone()[0] == 0:
+            print('Error: no uniques table in the db', file=sys.stderr)
+            conn.close()
+            sys.exit(-1)
+        if args.day:
+            before = time.time()
+            after = before - NUMOFSECSINADAY
+        print_uniques(c, args.uniques, after, before, args.ssid, args.vendor)
+        conn.close()
+        return
+
     if args.ssid:
         c.execute('select id from ssid where name=?', (args.ssid,))
         ssid = c.fetchone()
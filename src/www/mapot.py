@@ -7,6 +7,8 @@ import sys
 from pathlib import Path
 import tempfile
 import atexit
+import urllib.request
+import urllib.error
 import probe_pb2
 from yaml import load as yaml_load
 try:
@@ -67,6 +69,23 @@ def create_app():
             db = g._database = sqlite3.connect(f'file:{DATABASE}?mode=ro', uri=True)
         return db
 
+    def native(path):
+        '''try to answer from the http endpoint of the C daemon, if configured'''
+        address = config.get('probemon_http')
+        if address is None:
+            return None
+        url = f'http://{address}{path}'
+        if request.query_string:
+            url += '?' + request.query_string.decode()
+        try:
+            with urllib.request.urlopen(url, timeout=1) as r:
+                resp = make_response(r.read())
+                resp.headers['Content-Type'] = r.headers['Content-Type']
+                return resp
+        except (urllib.error.URLError, OSError) as e:
+            # not running or reaching before its in-memory history
+            return None
+
     @app.teardown_appcontext
     def close_connection(exception):
         db = getattr(g, '_database', None)
@@ -186,16 +205,24 @@ def create_app():
                 return jsonify(data)
 
     @app.route('/api/stats/timestamp')
-    @cache.cached(timeout=60)
     def timestamp():
+        resp = native('/api/stats/timestamp')
+        return resp if resp is not None else timestamp_db()
+
+    @cache.cached(timeout=60)
+    def timestamp_db():
         '''returns latest modification time of the db'''
         ts = Path(DATABASE).stat().st_mtime
         timestamp = time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(ts))
         return jsonify({'timestamp': timestamp})
 
     @app.route('/api/stats')
-    @cache.cached(timeout=60, query_string=True)
     def stats():
+        resp = native('/api/stats')
+        return resp if resp is not None else stats_db()
+
+    @cache.cached(timeout=60, query_string=True)
+    def stats_db():
         '''returns stats for given macs between timestamp'''
         after = request.args.get('after')
         if after is not None:
@@ -385,8 +412,12 @@ def create_app():
         return resp
 
     @app.route('/api/probes/latest')
-    @cache.cached(timeout=60, query_string=True)
     def latest():
+        resp = native('/api/probes/latest')
+        return resp if resp is not None else latest_db()
+
+    @cache.cached(timeout=60, query_string=True)
+    def latest_db():
         '''returns latest probe requests'''
         format = request.args.get('format')
         if format is None: